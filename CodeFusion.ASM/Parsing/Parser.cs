@@ -380,6 +380,30 @@ class Parser
                 return Opcode.UTF;
             case "loadmemory":
                 return Opcode.LOAD_MEMORY;
+            case "memcopy":
+                return Opcode.MEM_COPY;
+            case "memfill":
+                return Opcode.MEM_FILL;
+            case "memcompare":
+                return Opcode.MEM_COMPARE;
+            case "memfind":
+                return Opcode.MEM_FIND;
+            case "vadd":
+                return Opcode.VADD;
+            case "vsub":
+                return Opcode.VSUB;
+            case "vmul":
+                return Opcode.VMUL;
+            case "vfma":
+                return Opcode.VFMA;
+            case "vmin":
+                return Opcode.VMIN;
+            case "vmax":
+                return Opcode.VMAX;
+            case "vsum":
+                return Opcode.VSUM;
+            case "vdot":
+                return Opcode.VDOT;
         }
 
         Report.PrintReport(source, token, $"Undefined instruction '{token.text}'");
@@ -5,12 +5,16 @@ namespace CodeFusion.Builder.Generator;
 
 public partial class Maker
 {
-    public static void MakeExecutable(string file, string outName, Platform platform)
+    public static void MakeExecutable(string file, string outName, Platform platform, bool predecode)
     {
         MakeFolder("obj");
         MakeFolder("obj/cf");
         CopyFile(file, "obj/cf", true);
         RenameFile(Path.Combine("obj", "cf", Path.GetFileName(file)), "code.bin");
+        if (predecode)
+        {
+            PredecodeFile(Path.Combine("obj", "cf", "code.bin"));
+        }
         MakeFolder("obj/refs");
 
         string part;
@@ -39,6 +43,7 @@ public partial class Maker
             "./image.o",
             "./loader.o",
             "./table.o",
-            "./code.o");
+            "./code.o",
+            "-pthread");
     }
 }
\ No newline at end of file
@@ -5,12 +5,16 @@ namespace CodeFusion.Builder.Generator;
 
 public partial class Maker
 {
-    public static void MakeLibrary(string file, string outName, Platform platform)
+    public static void MakeLibrary(string file, string outName, Platform platform, bool predecode)
     {
         MakeFolder("obj");
         MakeFolder("obj/cf");
         CopyFile(file, "obj/cf", true);
         RenameFile(Path.Combine("obj", "cf", Path.GetFileName(file)), "code.bin");
+        if (predecode)
+        {
+            PredecodeFile(Path.Combine("obj", "cf", "code.bin"));
+        }
 
         string part;
         if (platform == Platform.WINDOWS)
@@ -0,0 +1,55 @@
+using System;
+using System.IO;
+using CodeFusion.Format;
+using CodeFusion.VM;
+
+namespace CodeFusion.Builder.Generator;
+
+public partial class Maker
+{
+    private const int FLAGS_OFFSET = 5;
+    private const int POOL_COUNT_OFFSET = 14;
+    private const int PROGRAM_COUNT_OFFSET = 22;
+    private const int HEADER_SIZE = 46;
+    private const int POOL_ENTRY_SIZE = 10;
+
+    // Rewrites the program of a linked file into fixed width records so the VM can use them without decoding
+    private static void PredecodeFile(string path)
+    {
+        byte[] content = File.ReadAllBytes(path);
+        byte flags = content[FLAGS_OFFSET];
+        if ((flags & Metadata.PREDECODED) == Metadata.PREDECODED)
+        {
+            return;
+        }
+
+        ulong poolCount = BitConverter.ToUInt64(content, POOL_COUNT_OFFSET);
+        ulong programCount = BitConverter.ToUInt64(content, PROGRAM_COUNT_OFFSET);
+
+        int programStart = HEADER_SIZE + (int)poolCount * POOL_ENTRY_SIZE;
+        int i = programStart;
+        PredecodedProgramSection section = new PredecodedProgramSection();
+        for (ulong j = 0; j < programCount; j++)
+        {
+            byte opcode = content[i++];
+            if (!Opcode.HasOperand(opcode))
+            {
+                section.program.Add(new Inst(opcode));
+                continue;
+            }
+
+            byte size = content[i++];
+            byte[] bytes = new byte[8];
+            Array.Copy(content, i, bytes, 0, size);
+            i += size;
+            section.program.Add(new Inst(opcode, new Word(BitConverter.ToUInt64(bytes))));
+        }
+
+        content[FLAGS_OFFSET] = (byte)(flags | Metadata.PREDECODED);
+
+        using FileStream stream = new FileStream(path, FileMode.Create);
+        stream.Write(content, 0, programStart);
+        stream.Write(section.RecordBytes());
+        stream.Write(content, i, content.Length - i);
+    }
+}
@@ -19,6 +19,7 @@ public class Program
         Platform platform = Platform.WINDOWS;
         OutputType outputType = OutputType.EXE;
         string outputName = "a";
+        bool predecode = false;
 
 
         for (int i = 0; i < args.Length; i++)
@@ -47,6 +48,10 @@ public class Program
                     outputType = OutputType.LIB;
                 }
             }
+            else if (args[i] == "--predecode")
+            {
+                predecode = true;
+            }
             else
             {
                 file = args[i];
@@ -114,7 +119,7 @@ public class Program
                 Environment.Exit(1);
             }
 
-            Maker.MakeExecutable(file, outputName, platform);
+            Maker.MakeExecutable(file, outputName, platform, predecode);
         }
         else if (outputType == OutputType.LIB)
         {
@@ -124,7 +129,7 @@ public class Program
                 Environment.Exit(1);
             }
 
-            Maker.MakeLibrary(file, outputName, platform);
+            Maker.MakeLibrary(file, outputName, platform, predecode);
         }
     }
 }
\ No newline at end of file
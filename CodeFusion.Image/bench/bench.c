@@ -0,0 +1,372 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../cf/CodeFusion.h"
+#include "../bridge/interrupt.h"
+
+// Benchmark harness of the VM, built and run by `make bench`. Every program runs in a process of its own: once through
+// cf_execute_inst to count its instructions and to warm up, then a number of timed runs through cf_run on a fresh
+// machine each. All runs of a program share one runtime, so libraries are loaded and translated once. One CSV row per
+// program is written to stdout, with -b the ns per instruction of a previous run are compared against the current ones.
+//
+// The programs are assembled from the .cf files next to them:
+//   fib    recursive fib(30), CALL, RET and pool frames
+//   loops  nested loops adding the index to each element of a 1000 element array, LOADARRAY and STOREARRAY
+//   print  200000 lines written through INT 4, stdout is pointed to /dev/null
+//   vcall  2000000 VCALLs into vcall_lib.bin
+//
+// The harness replaces three interrupts: stdout (0) returns /dev/null, exit (6) ends the run instead of the process and
+// load_library (9) loads a library image from the program directory instead of a shared object.
+
+#define BENCH_RUNS 5
+#define BENCH_DIRECTORY "bench/programs"
+// Rows of a baseline file, more are ignored
+#define BASELINE_CAPACITY 64
+
+static const char *programs[] = {"fib", "loops", "print", "vcall"};
+
+typedef struct {
+    char name[64];
+    double ns_per_inst;
+} Baseline;
+
+// A loaded image, the memory of the library points into the file contents so both stay alive together
+typedef struct {
+    char *path;
+    void *contents;
+    CF_Library library;
+    uint64_t entry_point;
+    // Index in the runtime, UINT64_MAX until the library is added
+    uint64_t index;
+} Image;
+
+static const char *directory = BENCH_DIRECTORY;
+static FILE *null_output = NULL;
+static Image images[8];
+static size_t image_size = 0;
+
+static int exited = 0;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+static void *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *contents = size > 0 ? malloc((size_t) size) : NULL;
+    if (contents != NULL && fread(contents, 1, (size_t) size, file) != (size_t) size) {
+        free(contents);
+        contents = NULL;
+    }
+    fclose(file);
+    return contents;
+}
+
+// Loads an image of the program directory once, later calls return the same image. The library is loaded the same way
+// main.c and library.c do it.
+static Image *load_image(const char *name, uint8_t kind, double *seconds) {
+    for (size_t i = 0; i < image_size; i++) {
+        if (strcmp(images[i].path, name) == 0) {
+            return &images[i];
+        }
+    }
+    if (image_size == sizeof(images) / sizeof(images[0])) {
+        return NULL;
+    }
+
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char *path = malloc(length);
+    snprintf(path, length, "%s/%s", directory, name);
+    void *contents = read_file(path);
+    free(path);
+    if (contents == NULL) {
+        fprintf(stderr, "Failed to read %s/%s\n", directory, name);
+        return NULL;
+    }
+
+    double start = now();
+    Metadata metadata = {0};
+    void *buff = contents;
+    cf_load_metadata(&buff, &metadata);
+    if ((metadata.flags & kind) != kind) {
+        fprintf(stderr, "%s/%s has the wrong image type\n", directory, name);
+        free(contents);
+        return NULL;
+    }
+
+    Image *image = &images[image_size++];
+    image->path = strdup(name);
+    image->contents = contents;
+    image->library = (CF_Library) {0};
+    image->library.address_pool = create_hash_map(metadata.pool_size);
+    image->library.symbols = malloc(sizeof(CF_Symbol) * (metadata.symbol_size + 1));
+    cf_load_pool(&buff, &metadata, image->library.address_pool);
+    cf_load_program(&buff, &metadata, &image->library);
+    if (kind == FLAG_LIBRARY) {
+        cf_load_symbols(&buff, &metadata, &image->library);
+    }
+    cf_load_memory(&buff, &metadata, &image->library);
+    cf_verify_program(&image->library);
+    cf_fuse_program(&image->library);
+    image->entry_point = metadata.entry_point;
+    image->index = UINT64_MAX;
+    if (seconds != NULL) {
+        *seconds = now() - start;
+    }
+    return image;
+}
+
+static Status bench_stdout(CF_Machine *cf) {
+    if (cf->stack_size >= cf->stack_capacity) {
+        return STATUS_STACK_OVERFLOW;
+    }
+
+    cf->stack[cf->stack_size++] = WORD_PTR(null_output);
+    return STATUS_OK;
+}
+
+static Status bench_exit(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // Every engine stops with STATUS_ILLEGAL_ACCESS at the end of the program, the flag tells it apart from a fault
+    exited = 1;
+    cf->stack_size--;
+    cf->program_counter = cf_runtime_library(cf->runtime, cf->program_pool)->program_size;
+    return STATUS_OK;
+}
+
+static Status bench_load_library(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    Image *image = load_image(cf->stack[cf->stack_size - 1].as_ptr, FLAG_LIBRARY, NULL);
+    if (image == NULL) {
+        return STATUS_ILLEGAL_LIBRARY_INDEX;
+    }
+    // Later runs find the library in the runtime already
+    if (image->index == UINT64_MAX) {
+        uint64_t index;
+        Status status = cf_runtime_add_library(cf->runtime, image->library, &index);
+        if (status != STATUS_OK) {
+            return status;
+        }
+        image->index = index;
+    }
+    cf->stack[cf->stack_size - 1] = WORD_U64(image->index);
+    return STATUS_OK;
+}
+
+// Runs the program on a fresh machine, counting the instructions through cf_execute_inst or timing cf_run
+static Status run_program(CF_Runtime *runtime, const Image *program, uint64_t *instructions, double *seconds) {
+    CF_Machine *cf;
+    Status status = cf_machine_create(runtime, 0, 0, &cf);
+    if (status != STATUS_OK) {
+        return status;
+    }
+    cf->program_pool = (uint16_t) program->index;
+    cf->program_counter = program->entry_point;
+    exited = 0;
+
+    if (instructions != NULL) {
+        uint64_t count = 0;
+        do {
+            status = cf_execute_inst(cf);
+            count++;
+        } while (status == STATUS_OK);
+        // The failing fetch at the end is no instruction
+        *instructions = count - 1;
+    } else {
+        double start = now();
+        status = cf_run(cf, 0);
+        *seconds = now() - start;
+    }
+
+    cf_machine_destroy(cf);
+    return exited && status == STATUS_ILLEGAL_ACCESS ? STATUS_OK : status;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static const Baseline *find_baseline(const Baseline *baseline, size_t size, const char *name) {
+    for (size_t i = 0; i < size; i++) {
+        if (strcmp(baseline[i].name, name) == 0) {
+            return &baseline[i];
+        }
+    }
+    return NULL;
+}
+
+// Runs one program and writes its row, returns the exit status of the benchmark process
+static int bench_program(const char *name, int runs, int jit, const Baseline *baseline, size_t baseline_size) {
+    size_t length = strlen(name) + sizeof(".bin");
+    char *file = malloc(length);
+    snprintf(file, length, "%s.bin", name);
+    double load_time = 0;
+    Image *program = load_image(file, FLAG_EXECUTABLE, &load_time);
+    free(file);
+    if (program == NULL) {
+        return 1;
+    }
+    if (program->entry_point >= program->library.program_size) {
+        fprintf(stderr, "%s: illegal entry point\n", name);
+        return 1;
+    }
+
+    CF_Runtime *runtime = cf_runtime_create();
+    if (runtime == NULL) {
+        return 1;
+    }
+    cf_install_interrupts(runtime);
+    runtime->interrupts[0] = bench_stdout;
+    runtime->interrupts[6] = bench_exit;
+    runtime->interrupts[9] = bench_load_library;
+    // cf_execute_inst always interprets, so the count pass is not affected by the JIT
+    runtime->jit = (uint8_t) jit;
+
+    Status status = cf_runtime_add_library(runtime, program->library, &program->index);
+    uint64_t instructions = 0;
+    if (status == STATUS_OK) {
+        status = run_program(runtime, program, &instructions, NULL);
+    }
+    double *times = malloc((size_t) runs * sizeof(double));
+    for (int i = 0; i < runs && status == STATUS_OK; i++) {
+        status = run_program(runtime, program, NULL, &times[i]);
+    }
+    cf_runtime_destroy(runtime);
+    if (status != STATUS_OK) {
+        fprintf(stderr, "%s: VM stops with code '%x'\n", name, status);
+        free(times);
+        return 1;
+    }
+
+    // The median is less sensitive to a run disturbed by the rest of the system than the mean
+    qsort(times, (size_t) runs, sizeof(double), compare_double);
+    double median = runs % 2 == 1 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    free(times);
+    double ns_per_inst = instructions != 0 ? median * 1e9 / (double) instructions : 0;
+    double inst_per_sec = median > 0 ? (double) instructions / median : 0;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%s,%"PRIu64",%d,%.3f,%.3f,%.0f,%ld", name, instructions, runs, load_time * 1e6, ns_per_inst,
+           inst_per_sec, usage.ru_maxrss);
+    if (baseline != NULL) {
+        const Baseline *previous = find_baseline(baseline, baseline_size, name);
+        if (previous != NULL && previous->ns_per_inst > 0) {
+            printf(",%.3f,%+.1f", previous->ns_per_inst, (ns_per_inst / previous->ns_per_inst - 1) * 100);
+        } else {
+            printf(",,");
+        }
+    }
+    printf("\n");
+    return 0;
+}
+
+// Reads the name and ns_per_inst columns of a CSV file written by an earlier run
+static size_t read_baseline(const char *path, Baseline *baseline) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to read baseline %s\n", path);
+        exit(1);
+    }
+
+    size_t size = 0;
+    char line[512];
+    while (size < BASELINE_CAPACITY && fgets(line, sizeof(line), file) != NULL) {
+        char name[64];
+        uint64_t instructions;
+        int runs;
+        double load_time;
+        double ns_per_inst;
+        if (sscanf(line, "%63[^,],%"SCNu64",%d,%lf,%lf", name, &instructions, &runs, &load_time, &ns_per_inst) == 5) {
+            strcpy(baseline[size].name, name);
+            baseline[size].ns_per_inst = ns_per_inst;
+            size++;
+        }
+    }
+    fclose(file);
+    return size;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-d directory] [-r runs] [-b baseline.csv] [-j] [program...]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int runs = BENCH_RUNS;
+    int jit = 0;
+    const char *baseline_path = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "d:r:b:j")) != -1) {
+        switch (option) {
+            case 'd':
+                directory = optarg;
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                if (runs < 1) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 'j':
+                jit = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    static Baseline baseline[BASELINE_CAPACITY];
+    size_t baseline_size = baseline_path != NULL ? read_baseline(baseline_path, baseline) : 0;
+
+    null_output = fopen("/dev/null", "w");
+
+    printf("name,instructions,runs,load_us,ns_per_inst,inst_per_sec,peak_rss_kb%s\n",
+           baseline_path != NULL ? ",baseline_ns_per_inst,change_pct" : "");
+
+    const char **selected = optind < argc ? (const char **) argv + optind : programs;
+    size_t count = optind < argc ? (size_t) (argc - optind) : sizeof(programs) / sizeof(programs[0]);
+    int failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Each program in its own process so the peak RSS belongs to it alone
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            exit(bench_program(selected[i], runs, jit, baseline_path != NULL ? baseline : NULL, baseline_size));
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
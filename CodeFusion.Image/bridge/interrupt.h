@@ -3,6 +3,15 @@
 
 #include "../cf/machine.h"
 
-extern CF_Interrupt interrupts[INTERRUPT_CAPACITY];
+// Installs the standard interrupts (I/O, memory and libraries) into the interrupt table of the runtime
+void cf_install_interrupts(CF_Runtime *runtime);
+
+// Installs the non-blocking file and local socket interrupts, called by cf_install_interrupts. Does nothing on
+// platforms without a reactor, see cf/reactor.h.
+void cf_install_async_interrupts(CF_Runtime *runtime);
+
+// Installs the buffered write, read, flush and mmap interrupts, called by cf_install_interrupts. Does nothing on
+// platforms without writev, see cf/output.h.
+void cf_install_bulk_interrupts(CF_Runtime *runtime);
 
 #endif
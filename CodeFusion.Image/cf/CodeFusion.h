@@ -4,5 +4,6 @@
 #include "opcode.h"
 #include "machine.h"
 #include "loader.h"
+#include "stack.h"
 
 #endif
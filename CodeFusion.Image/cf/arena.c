@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+static CF_ArenaChunk *create_chunk(CF_ArenaChunk *prev, size_t size) {
+    size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    CF_ArenaChunk *chunk = malloc(sizeof(CF_ArenaChunk) + capacity);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    chunk->prev = prev;
+    chunk->next = NULL;
+    chunk->end = chunk->data + capacity;
+    chunk->mapped = 0;
+    return chunk;
+}
+
+static void free_chunks(CF_ArenaChunk *chunk) {
+    while (chunk != NULL) {
+        CF_ArenaChunk *next = chunk->next;
+        if (!chunk->mapped) {
+            free(chunk);
+        }
+        chunk = next;
+    }
+}
+
+void *cf_arena_grow(CF_Arena *arena, size_t size) {
+    CF_ArenaChunk *next = arena->chunk == NULL ? NULL : arena->chunk->next;
+
+    if (next == NULL || size > (size_t) (next->end - next->data)) {
+        // A cached chunk that is too small is dropped together with everything after it
+        free_chunks(next);
+        next = create_chunk(arena->chunk, size);
+        if (next == NULL) {
+            if (arena->chunk != NULL) {
+                arena->chunk->next = NULL;
+            }
+            return NULL;
+        }
+        if (arena->chunk != NULL) {
+            arena->chunk->next = next;
+        }
+    }
+
+    arena->chunk = next;
+    arena->top = next->data + size;
+#ifdef ZERO_POOL
+    cf_arena_zero(next->data, size);
+#endif
+    return next->data;
+}
+
+void cf_arena_zero(void *frame, size_t size) {
+    memset(frame, 0, size);
+}
+
+void cf_arena_free(CF_Arena *arena) {
+    if (arena->chunk == NULL) {
+        return;
+    }
+
+    CF_ArenaChunk *first = arena->chunk;
+    while (first->prev != NULL) {
+        first = first->prev;
+    }
+    free_chunks(first);
+    arena->chunk = NULL;
+    arena->top = NULL;
+}
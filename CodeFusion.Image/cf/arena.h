@@ -0,0 +1,58 @@
+#ifndef CF_ARENA_H
+#define CF_ARENA_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "debug.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct CF_ArenaChunk {
+    struct CF_ArenaChunk *prev;
+    struct CF_ArenaChunk *next;
+    uint8_t *end;
+    // Set for the chunk of a restored snapshot, which lies in the mapped image and is not freed
+    uint8_t mapped;
+    _Alignas(ARENA_ALIGNMENT) uint8_t data[];
+};
+
+typedef struct CF_ArenaChunk CF_ArenaChunk;
+
+// Bump allocator for the pool frames of a machine. Frames are released in reverse order of allocation, a push moves
+// the top forward and a pop rewinds it to the start of the popped frame. Chunks are kept after a pop so deep
+// recursion only allocates the first time it reaches a new depth.
+typedef struct {
+    CF_ArenaChunk *chunk;
+    uint8_t *top;
+} CF_Arena;
+
+void *cf_arena_grow(CF_Arena *arena, size_t size);
+
+void cf_arena_zero(void *frame, size_t size);
+
+void cf_arena_free(CF_Arena *arena);
+
+static inline void *cf_arena_push(CF_Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    if (arena->chunk == NULL || size > (size_t) (arena->chunk->end - arena->top)) {
+        return cf_arena_grow(arena, size);
+    }
+
+    void *frame = arena->top;
+    arena->top += size;
+#ifdef ZERO_POOL
+    cf_arena_zero(frame, size);
+#endif
+    return frame;
+}
+
+static inline void cf_arena_pop(CF_Arena *arena, void *frame) {
+    // The popped frame is the newest one, it only lies outside the current chunk if it was the first frame of it
+    while ((uint8_t *) frame < arena->chunk->data || (uint8_t *) frame > arena->chunk->end) {
+        arena->chunk = arena->chunk->prev;
+    }
+    arena->top = frame;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 //#define ENABLE_DEBUG
 //#define SLOW
+//#define ZERO_POOL
 
 
 #ifdef ENABLE_DEBUG
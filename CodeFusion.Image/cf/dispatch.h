@@ -0,0 +1,642 @@
+// Body of the threaded engine. This file is included by machine.c once per engine variant with ENGINE_NAME set to the
+// function name and ENGINE_VERIFIED set to 1 if the variant only runs libraries that passed cf_verify_program.
+//
+// The verified variant drops the per-instruction stack and operand checks. Instead ENTER() checks the stack
+// annotation of the instruction control was transferred to, which covers every instruction up to the next branch.
+
+#ifdef TOS_CACHE
+// The top of the operand stack lives in the local tos and its slot stack[sp - 1] is stale until SPILL() writes it back.
+// Entries below the top are always in memory. stack[-1] is a scratch slot (see cf_create_stacks), so an empty stack
+// is spilled and filled without a branch.
+#define TOP tos
+#define PUSH(value)                                                                              \
+do {                                                                                             \
+    stack[sp - 1] = tos;                                                                         \
+    tos = (value);                                                                               \
+    sp++;                                                                                        \
+} while (0)
+#define DROP(count)                                                                              \
+do {                                                                                             \
+    sp -= (count);                                                                               \
+    tos = stack[sp - 1];                                                                         \
+} while (0)
+#define COLLAPSE(count, value)                                                                   \
+do {                                                                                             \
+    tos = (value);                                                                               \
+    sp -= (count);                                                                               \
+} while (0)
+#define SPILL() (stack[sp - 1] = tos)
+#define FILL() (tos = stack[sp - 1])
+#else
+#define TOP stack[sp - 1]
+#define PUSH(value)                                                                              \
+do {                                                                                             \
+    stack[sp] = (value);                                                                         \
+    sp++;                                                                                        \
+} while (0)
+#define DROP(count) (sp -= (count))
+#define COLLAPSE(count, value)                                                                   \
+do {                                                                                             \
+    stack[sp - 1 - (count)] = (value);                                                           \
+    sp -= (count);                                                                               \
+} while (0)
+#define SPILL()
+#define FILL()
+#endif
+// Entries below the top, only valid after REQUIRE or the verifier made sure they exist
+#define SECOND stack[sp - 2]
+#define THIRD stack[sp - 3]
+
+#ifdef CF_GUARD_PAGES
+// Running past the end of either stack faults on its guard page, cf_run turns the fault into the status
+#define CHECK_OVERFLOW(condition, value)
+#else
+#define CHECK_OVERFLOW(condition, value)                                                         \
+do {                                                                                             \
+    if (condition) {                                                                             \
+        FAIL(value);                                                                             \
+    }                                                                                            \
+} while (0)
+#endif
+
+#if ENGINE_VERIFIED
+
+#define DISPATCH()                                                                               \
+do {                                                                                             \
+    if (*steps == 0) {                                                                           \
+        goto halt;                                                                               \
+    }                                                                                            \
+    (*steps)--;                                                                                  \
+    SAMPLE_POINT(cf, pc);                                                                        \
+    inst = &program[pc++];                                                                       \
+    PROFILE_STEP(cf, pc - 1, inst->opcode);                                                      \
+    goto *dispatch[inst->opcode];                                                                \
+} while (0)
+
+#define ENTER()                                                                                  \
+do {                                                                                             \
+    if (pc >= program_size) {                                                                    \
+        FAIL(STATUS_ILLEGAL_ACCESS);                                                             \
+    }                                                                                            \
+    if (sp < program[pc].stack_need) {                                                           \
+        FAIL(STATUS_STACK_UNDERFLOW);                                                            \
+    }                                                                                            \
+    CHECK_OVERFLOW(sp + program[pc].stack_grow > cf->stack_capacity, STATUS_STACK_OVERFLOW);     \
+} while (0)
+
+#define REQUIRE(count)
+#define RESERVE(count)
+#define CHECK_TARGET(target)
+
+#else
+
+#define DISPATCH()                                                                               \
+do {                                                                                             \
+    if (*steps == 0) {                                                                           \
+        goto halt;                                                                               \
+    }                                                                                            \
+    (*steps)--;                                                                                  \
+    if (pc >= program_size) {                                                                    \
+        FAIL(STATUS_ILLEGAL_ACCESS);                                                             \
+    }                                                                                            \
+    SAMPLE_POINT(cf, pc);                                                                        \
+    inst = &program[pc++];                                                                       \
+    PROFILE_STEP(cf, pc - 1, inst->opcode);                                                      \
+    goto *dispatch[inst->opcode];                                                                \
+} while (0)
+
+#define ENTER()
+
+#define REQUIRE(count)                                                                           \
+do {                                                                                             \
+    if (sp < (count)) {                                                                          \
+        FAIL(STATUS_STACK_UNDERFLOW);                                                            \
+    }                                                                                            \
+} while (0)
+
+#define RESERVE(count) CHECK_OVERFLOW(sp + (count) > cf->stack_capacity, STATUS_STACK_OVERFLOW)
+
+#define CHECK_TARGET(target)                                                                     \
+do {                                                                                             \
+    if ((target) >= program_size) {                                                              \
+        FAIL(STATUS_ILLEGAL_ACCESS);                                                             \
+    }                                                                                            \
+} while (0)
+
+#endif
+
+// Leaves the engine so cf_run can continue in the variant matching the library that is now active
+#define SWITCH_ENGINE()                                                                          \
+do {                                                                                             \
+    if (library->verified != ENGINE_VERIFIED) {                                                  \
+        goto halt;                                                                               \
+    }                                                                                            \
+} while (0)
+
+#define T_BINARY_OP(in, out, op)                                                                 \
+do {                                                                                             \
+    REQUIRE(2);                                                                                  \
+    COLLAPSE(1, (Word) {.as_##out = SECOND.as_##in op TOP.as_##in});                             \
+    DISPATCH();                                                                                  \
+} while (0)
+
+#define T_DIVISION_OP(in, op)                                                                    \
+do {                                                                                             \
+    REQUIRE(2);                                                                                  \
+    if (TOP.as_##in == 0) {                                                                      \
+        FAIL(STATUS_DIVISION_BY_ZERO);                                                           \
+    }                                                                                            \
+    COLLAPSE(1, (Word) {.as_##in = SECOND.as_##in op TOP.as_##in});                              \
+    DISPATCH();                                                                                  \
+} while (0)
+
+#define T_UNARY_OP(in, out, op)                                                                  \
+do {                                                                                             \
+    REQUIRE(1);                                                                                  \
+    TOP.as_##out = op TOP.as_##in;                                                               \
+    DISPATCH();                                                                                  \
+} while (0)
+
+#define T_CAST_OP(from, to, cast)                                                                \
+do {                                                                                             \
+    REQUIRE(1);                                                                                  \
+    TOP.as_##to = cast TOP.as_##from;                                                            \
+    DISPATCH();                                                                                  \
+} while (0)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Woverride-init"
+
+static Status ENGINE_NAME(CF_Machine *cf, uint64_t *steps) {
+    static const void *dispatch[256] = {
+            [0 ... 255] = &&op_illegal,
+            [INST_NOP] = &&op_nop,
+            [INST_PUSH] = &&op_push,
+            [INST_POP] = &&op_pop,
+            [INST_LOAD] = &&op_load,
+            [INST_STORE] = &&op_store,
+            [INST_MALLOC_POOL] = &&op_malloc_pool,
+            [INST_FREE_POOL] = &&op_free_pool,
+            [INST_PUSH_PTR] = &&op_push_ptr,
+            [INST_LOAD_PTR] = &&op_load_ptr,
+            [INST_STORE_PTR] = &&op_store_ptr,
+            [INST_DUP] = &&op_dup,
+            [INST_PUSH_ARRAY] = &&op_push_array,
+            [INST_LOAD_ARRAY] = &&op_load_array,
+            [INST_STORE_ARRAY] = &&op_store_array,
+            [INST_IADD] = &&op_iadd,
+            [INST_FADD] = &&op_fadd,
+            [INST_UADD] = &&op_uadd,
+            [INST_ISUB] = &&op_isub,
+            [INST_FSUB] = &&op_fsub,
+            [INST_USUB] = &&op_usub,
+            [INST_IMUL] = &&op_imul,
+            [INST_FMUL] = &&op_fmul,
+            [INST_UMUL] = &&op_umul,
+            [INST_IDIV] = &&op_idiv,
+            [INST_FDIV] = &&op_fdiv,
+            [INST_UDIV] = &&op_udiv,
+            [INST_IMOD] = &&op_imod,
+            [INST_FMOD] = &&op_fmod,
+            [INST_UMOD] = &&op_umod,
+            [INST_ILESS] = &&op_iless,
+            [INST_FLESS] = &&op_fless,
+            [INST_ULESS] = &&op_uless,
+            [INST_ILESS_EQUAL] = &&op_iless_equal,
+            [INST_FLESS_EQUAL] = &&op_fless_equal,
+            [INST_ULESS_EQUAL] = &&op_uless_equal,
+            [INST_IGREATER] = &&op_igreater,
+            [INST_FGREATER] = &&op_fgreater,
+            [INST_UGREATER] = &&op_ugreater,
+            [INST_IGREATER_EQUALS] = &&op_igreater_equals,
+            [INST_FGREATER_EQUALS] = &&op_fgreater_equals,
+            [INST_UGREATER_EQUALS] = &&op_ugreater_equals,
+            [INST_EQ] = &&op_eq,
+            [INST_NEQ] = &&op_neq,
+            [INST_AND] = &&op_and,
+            [INST_OR] = &&op_or,
+            [INST_XOR] = &&op_xor,
+            [INST_LSHIFT] = &&op_lshift,
+            [INST_RSHIFT] = &&op_rshift,
+            [INST_INEG] = &&op_ineg,
+            [INST_FNEG] = &&op_fneg,
+            [INST_UNEG] = &&op_uneg,
+            [INST_NOT] = &&op_not,
+            [INST_ONES] = &&op_ones,
+            [INST_INT] = &&op_int,
+            [INST_JMP] = &&op_jmp,
+            [INST_JMP_ZERO] = &&op_jmp_zero,
+            [INST_JMP_NOT_ZERO] = &&op_jmp_not_zero,
+            [INST_CALL] = &&op_call,
+            [INST_VCALL] = &&op_vcall,
+            [INST_RET] = &&op_ret,
+            [INST_ITU] = &&op_itu,
+            [INST_ITF] = &&op_itf,
+            [INST_FTI] = &&op_fti,
+            [INST_FTU] = &&op_ftu,
+            [INST_UTI] = &&op_uti,
+            [INST_UTF] = &&op_utf,
+            [INST_LOAD_MEMORY] = &&op_load_memory,
+            [INST_MEM_COPY] = &&op_mem_copy,
+            [INST_MEM_FILL] = &&op_mem_fill,
+            [INST_MEM_COMPARE] = &&op_mem_compare,
+            [INST_MEM_FIND] = &&op_mem_find,
+            [INST_VADD] = &&op_vector_map,
+            [INST_VSUB] = &&op_vector_map,
+            [INST_VMUL] = &&op_vector_map,
+            [INST_VFMA] = &&op_vector_map,
+            [INST_VMIN] = &&op_vector_map,
+            [INST_VMAX] = &&op_vector_map,
+            [INST_VSUM] = &&op_vector_sum,
+            [INST_VDOT] = &&op_vector_dot,
+            [INST_LOAD_SIZED] = &&op_load_sized,
+            [INST_STORE_SIZED] = &&op_store_sized,
+            [INST_PUSH_IADD] = &&op_push_iadd,
+            [INST_PUSH_ISUB] = &&op_push_isub,
+            [INST_ILESS_JMP_ZERO] = &&op_iless_jmp_zero,
+    };
+
+    Word *stack = cf->stack;
+    CF_Runtime *runtime = cf->runtime;
+    CF_Interrupt *interrupts = runtime->interrupts;
+    const CF_Library *library;
+    Inst *program;
+    uint64_t program_size;
+    uint8_t *memory;
+    uint64_t memory_size;
+    uint64_t pc;
+    uint64_t sp;
+#ifdef TOS_CACHE
+    Word tos;
+#endif
+    const Inst *inst;
+    Status status = STATUS_OK;
+
+    LOAD_STATE();
+#if ENGINE_VERIFIED
+    // Memory accesses are validated by cf_verify_program
+    (void) memory_size;
+#endif
+    ENTER();
+    DISPATCH();
+
+    op_nop:
+    DISPATCH();
+    op_push:
+    RESERVE(1);
+    PUSH(inst->operand);
+    DISPATCH();
+    op_pop:
+    REQUIRE(1);
+    DROP(1);
+    DISPATCH();
+    op_load:
+    REQUIRE(1);
+    TOP = read_pool_n(cf, inst->operand, TOP);
+    DISPATCH();
+    op_store:
+    REQUIRE(2);
+    write_pool_n(cf, inst->operand, SECOND, TOP);
+    DROP(2);
+    DISPATCH();
+    op_malloc_pool:
+    CHECK_OVERFLOW(cf->pool_stack_size >= cf->pool_stack_capacity, STATUS_CALL_STACK_OVERFLOW);
+    {
+        void *frame = cf_arena_push(&cf->pool_arena, inst->operand.as_u64);
+        if (frame == NULL) {
+            FAIL(STATUS_CALL_STACK_OVERFLOW);
+        }
+        cf->pool_stack[cf->pool_stack_size++].as_ptr = frame;
+    }
+    DISPATCH();
+    op_free_pool:
+    if (cf->pool_stack_size < 1) {
+        FAIL(STATUS_CALL_STACK_UNDERFLOW);
+    }
+    cf_arena_pop(&cf->pool_arena, cf->pool_stack[--cf->pool_stack_size].as_ptr);
+    DISPATCH();
+    op_push_ptr:
+    if (cf->pool_stack_size < 1) {
+        FAIL(STATUS_CALL_STACK_UNDERFLOW);
+    }
+    RESERVE(1);
+    PUSH(WORD_PTR((uint8_t *) cf->pool_stack[cf->pool_stack_size - 1].as_ptr + inst->operand.as_u64));
+    DISPATCH();
+    op_load_ptr:
+    REQUIRE(1);
+    TOP = read_ptr(TOP.as_ptr, inst->operand);
+    DISPATCH();
+    op_store_ptr:
+    REQUIRE(2);
+    write_ptr(SECOND.as_ptr, TOP, inst->operand);
+    DROP(2);
+    DISPATCH();
+    op_dup:
+#if !ENGINE_VERIFIED
+    if (sp <= inst->operand.as_u64) {
+        FAIL(STATUS_STACK_UNDERFLOW);
+    }
+#endif
+    RESERVE(1);
+    PUSH(inst->operand.as_u64 == 0 ? TOP : stack[sp - (1 + inst->operand.as_u64)]);
+    DISPATCH();
+    op_push_array:
+    REQUIRE(1);
+    TOP.as_ptr = cf_slab_alloc(&cf->heap, TOP.as_u64);
+    DISPATCH();
+    op_load_array:
+    REQUIRE(2);
+    COLLAPSE(1, read_ptr_at(SECOND.as_ptr, TOP, inst->operand));
+    DISPATCH();
+    op_store_array:
+    REQUIRE(3);
+    write_ptr_at(THIRD.as_ptr, SECOND, TOP, inst->operand);
+    DROP(3);
+    DISPATCH();
+    op_iadd: T_BINARY_OP(i64, i64, +);
+    op_fadd: T_BINARY_OP(f64, f64, +);
+    op_uadd: T_BINARY_OP(u64, u64, +);
+    op_isub: T_BINARY_OP(i64, i64, -);
+    op_fsub: T_BINARY_OP(f64, f64, -);
+    op_usub: T_BINARY_OP(u64, u64, -);
+    op_imul: T_BINARY_OP(i64, i64, *);
+    op_fmul: T_BINARY_OP(f64, f64, *);
+    op_umul: T_BINARY_OP(u64, u64, *);
+    op_idiv: T_DIVISION_OP(i64, /);
+    op_fdiv: T_DIVISION_OP(f64, /);
+    op_udiv: T_DIVISION_OP(u64, /);
+    op_imod: T_DIVISION_OP(i64, %);
+    op_fmod:
+    REQUIRE(2);
+    if (TOP.as_f64 == 0) {
+        FAIL(STATUS_DIVISION_BY_ZERO);
+    }
+    COLLAPSE(1, WORD_F64(remainder(SECOND.as_f64, TOP.as_f64)));
+    DISPATCH();
+    op_umod: T_DIVISION_OP(u64, %);
+    op_iless: T_BINARY_OP(i64, u64, <);
+    op_fless: T_BINARY_OP(f64, u64, <);
+    op_uless: T_BINARY_OP(u64, u64, <);
+    op_iless_equal: T_BINARY_OP(i64, u64, <=);
+    op_fless_equal: T_BINARY_OP(f64, u64, <=);
+    op_uless_equal: T_BINARY_OP(u64, u64, <=);
+    op_igreater: T_BINARY_OP(i64, u64, >);
+    op_fgreater: T_BINARY_OP(f64, u64, >);
+    op_ugreater: T_BINARY_OP(u64, u64, >);
+    op_igreater_equals: T_BINARY_OP(i64, u64, >=);
+    op_fgreater_equals: T_BINARY_OP(f64, u64, >=);
+    op_ugreater_equals: T_BINARY_OP(u64, u64, >=);
+    op_eq: T_BINARY_OP(u64, u64, ==);
+    op_neq: T_BINARY_OP(u64, u64, !=);
+    op_and: T_BINARY_OP(u64, u64, &);
+    op_or: T_BINARY_OP(u64, u64, |);
+    op_xor: T_BINARY_OP(u64, u64, ^);
+    op_lshift: T_BINARY_OP(u64, u64, <<);
+    op_rshift: T_BINARY_OP(u64, u64, >>);
+    op_ineg: T_UNARY_OP(i64, i64, -);
+    op_fneg: T_UNARY_OP(f64, f64, -);
+    op_uneg: T_UNARY_OP(u64, u64, -);
+    op_not: T_UNARY_OP(u64, u64, !);
+    op_ones: T_UNARY_OP(u64, u64, ~);
+    op_int:
+#if !ENGINE_VERIFIED
+    if (inst->operand.as_u64 >= INTERRUPT_CAPACITY) {
+        FAIL(STATUS_ILLEGAL_INTERRUPT);
+    }
+#endif
+    if (interrupts[inst->operand.as_u64] == NULL) {
+        FAIL(STATUS_ILLEGAL_INTERRUPT);
+    }
+    PRINT_DEBUG("Interrupt %"PRIu64"\n", inst->operand.as_u64);
+    SAVE_STATE();
+    status = interrupts[inst->operand.as_u64](cf);
+    LOAD_STATE();
+    if (status != STATUS_OK) {
+        goto halt;
+    }
+    SWITCH_ENGINE();
+    ENTER();
+    DISPATCH();
+    op_jmp:
+    CHECK_TARGET(inst->operand.as_u64);
+    pc = inst->operand.as_u64;
+    ENTER();
+    DISPATCH();
+    op_jmp_zero:
+    REQUIRE(1);
+    CHECK_TARGET(inst->operand.as_u64);
+    {
+        uint64_t condition = TOP.as_u64;
+        DROP(1);
+        if (condition == 0) {
+            pc = inst->operand.as_u64;
+        }
+    }
+    ENTER();
+    DISPATCH();
+    op_jmp_not_zero:
+    REQUIRE(1);
+    CHECK_TARGET(inst->operand.as_u64);
+    {
+        uint64_t condition = TOP.as_u64;
+        DROP(1);
+        if (condition != 0) {
+            pc = inst->operand.as_u64;
+        }
+    }
+    ENTER();
+    DISPATCH();
+    op_call:
+    RESERVE(2);
+    CHECK_TARGET(inst->operand.as_u64);
+    PUSH(WORD_U64(cf->program_pool));
+    PUSH(WORD_U64(pc));
+    pc = inst->operand.as_u64;
+    PROFILE_CALL(cf->program_pool, pc);
+    ENTER();
+    DISPATCH();
+    op_vcall:
+    REQUIRE(2);
+    {
+        uint64_t site = library->call_cache_base + inst->operand.as_u64;
+        CF_CallCache *cache = site < cf->call_cache_size ? &cf->call_caches[site] : grow_call_caches(cf, site);
+        if (cache == NULL) {
+            FAIL(STATUS_LIBRARY_OVERFLOW);
+        }
+        uint64_t generation = atomic_load_explicit(&runtime->library_generation, memory_order_acquire);
+        if (cache->generation != generation || cache->library != SECOND.as_u64 || cache->target != TOP.as_u64) {
+            if (SECOND.as_u64 >= atomic_load_explicit(&runtime->library_size, memory_order_acquire)) {
+                FAIL(STATUS_ILLEGAL_LIBRARY_INDEX);
+            }
+            CF_Library *entry = cf_runtime_library(runtime, SECOND.as_u64);
+            if (TOP.as_u64 >= entry->program_size) {
+                FAIL(STATUS_ILLEGAL_ACCESS);
+            }
+            cache->generation = generation;
+            cache->library = SECOND.as_u64;
+            cache->target = TOP.as_u64;
+            cache->entry = entry;
+        }
+        SECOND = WORD_U64(cf->program_pool);
+        TOP = WORD_U64(pc);
+        cf->program_pool = (uint16_t) cache->library;
+        ENTER_LIBRARY(cache->entry);
+        pc = cache->target;
+        PROFILE_CALL(cache->library, pc);
+    }
+    SWITCH_ENGINE();
+    ENTER();
+    DISPATCH();
+    op_ret:
+    REQUIRE(2);
+    // Returning into the active library needs no validation of the index
+    if (SECOND.as_u64 != cf->program_pool) {
+        if (SECOND.as_u64 >= atomic_load_explicit(&runtime->library_size, memory_order_acquire)) {
+            FAIL(STATUS_ILLEGAL_LIBRARY_INDEX);
+        }
+        cf->program_pool = (uint16_t) SECOND.as_u64;
+        ENTER_LIBRARY(cf_runtime_library(runtime, cf->program_pool));
+    }
+    if (TOP.as_u64 >= program_size) {
+        FAIL(STATUS_ILLEGAL_ACCESS);
+    }
+    pc = TOP.as_u64;
+    DROP(2);
+    PROFILE_RETURN();
+    SWITCH_ENGINE();
+    ENTER();
+    DISPATCH();
+    op_itu: T_CAST_OP(i64, u64, (uint64_t));
+    op_itf: T_CAST_OP(i64, f64, (double));
+    op_fti: T_CAST_OP(f64, i64, (int64_t));
+    op_ftu: T_CAST_OP(f64, u64, (uint64_t));
+    op_uti: T_CAST_OP(u64, i64, (int64_t));
+    op_utf: T_CAST_OP(u64, f64, (double));
+    op_load_memory:
+    RESERVE(1);
+    PRINT_DEBUG("Load memory address %"PRIu64" of size %"PRIu64"\n", inst->operand.as_u64, memory_size);
+#if !ENGINE_VERIFIED
+    if (inst->operand.as_u64 >= memory_size) {
+        FAIL(STATUS_ILLEGAL_ACCESS);
+    }
+#endif
+    PUSH(WORD_PTR(memory + inst->operand.as_u64));
+    DISPATCH();
+    op_mem_copy:
+    REQUIRE(3);
+    cf_memory_copy(THIRD.as_ptr, SECOND.as_ptr, TOP.as_u64);
+    DROP(3);
+    DISPATCH();
+    op_mem_fill:
+    REQUIRE(3);
+    cf_memory_fill(THIRD.as_ptr, (uint8_t) TOP.as_u64, SECOND.as_u64);
+    DROP(3);
+    DISPATCH();
+    op_mem_compare:
+    REQUIRE(3);
+    COLLAPSE(2, WORD_I64(cf_memory_compare(THIRD.as_ptr, SECOND.as_ptr, TOP.as_u64)));
+    DISPATCH();
+    op_mem_find:
+    REQUIRE(3);
+    COLLAPSE(2, WORD_I64(cf_memory_find(THIRD.as_ptr, (uint8_t) TOP.as_u64, SECOND.as_u64)));
+    DISPATCH();
+    op_vector_map:
+    REQUIRE(4);
+#if !ENGINE_VERIFIED
+    if (inst->operand.as_u64 >= VECTOR_TYPES) {
+        FAIL(STATUS_ILLEGAL_OPCODE);
+    }
+#endif
+    cf_vector_map(inst->opcode, (uint8_t) inst->operand.as_u64, stack[sp - 4].as_ptr, THIRD.as_ptr, SECOND.as_ptr,
+                  TOP.as_u64);
+    DROP(4);
+    DISPATCH();
+    op_vector_sum:
+    REQUIRE(2);
+#if !ENGINE_VERIFIED
+    if (inst->operand.as_u64 >= VECTOR_TYPES) {
+        FAIL(STATUS_ILLEGAL_OPCODE);
+    }
+#endif
+    COLLAPSE(1, cf_vector_sum((uint8_t) inst->operand.as_u64, SECOND.as_ptr, TOP.as_u64));
+    DISPATCH();
+    op_vector_dot:
+    REQUIRE(3);
+#if !ENGINE_VERIFIED
+    if (inst->operand.as_u64 >= VECTOR_TYPES) {
+        FAIL(STATUS_ILLEGAL_OPCODE);
+    }
+#endif
+    COLLAPSE(2, cf_vector_dot((uint8_t) inst->operand.as_u64, THIRD.as_ptr, SECOND.as_ptr, TOP.as_u64));
+    DISPATCH();
+
+    // Superinstructions replace the first instruction of the fused pair and skip the untouched second one, which
+    // stays in place for jumps that target it directly
+    op_load_sized:
+    RESERVE(1);
+    PUSH(read_pool_n(cf, inst->operand, WORD_U64(inst->argument)));
+    pc++;
+    DISPATCH();
+    op_store_sized:
+    REQUIRE(1);
+    RESERVE(1);
+    write_pool_n(cf, inst->operand, TOP, WORD_U64(inst->argument));
+    DROP(1);
+    pc++;
+    DISPATCH();
+    op_push_iadd:
+    REQUIRE(1);
+    RESERVE(1);
+    TOP.as_i64 += inst->operand.as_i64;
+    pc++;
+    DISPATCH();
+    op_push_isub:
+    REQUIRE(1);
+    RESERVE(1);
+    TOP.as_i64 -= inst->operand.as_i64;
+    pc++;
+    DISPATCH();
+    op_iless_jmp_zero:
+    REQUIRE(2);
+    CHECK_TARGET(inst->operand.as_u64);
+    {
+        int less = SECOND.as_i64 < TOP.as_i64;
+        DROP(2);
+        if (less) {
+            pc++;
+        } else {
+            pc = inst->operand.as_u64;
+        }
+    }
+    ENTER();
+    DISPATCH();
+    op_illegal:
+    FAIL(STATUS_ILLEGAL_OPCODE);
+
+    halt:
+    SAVE_STATE();
+    return status;
+}
+
+#pragma GCC diagnostic pop
+
+#undef TOP
+#undef PUSH
+#undef DROP
+#undef COLLAPSE
+#undef SPILL
+#undef FILL
+#undef SECOND
+#undef THIRD
+#undef CHECK_OVERFLOW
+#undef DISPATCH
+#undef ENTER
+#undef REQUIRE
+#undef RESERVE
+#undef CHECK_TARGET
+#undef SWITCH_ENGINE
+#undef T_BINARY_OP
+#undef T_DIVISION_OP
+#undef T_UNARY_OP
+#undef T_CAST_OP
@@ -1,33 +1,49 @@
 #include <stdlib.h>
 #include "hashmap.h"
 
+static size_t hash_index(HashMap *map, uint64_t key) {
+    return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> map->shift);
+}
+
 HashMap *create_hash_map(size_t size) {
-    HashMap *map = (HashMap *) malloc(sizeof(HashMap));
-    map->buckets = (HashNode **) calloc(size, sizeof(HashNode *));
-    map->size = size;
+    // Keep the load factor at or below one half so probe sequences stay short
+    size_t capacity = 8;
+    unsigned int bits = 3;
+    while (capacity < size * 2) {
+        capacity <<= 1;
+        bits++;
+    }
+
+    HashMap *map = (HashMap *) calloc(1, sizeof(HashMap) + capacity * sizeof(HashEntry));
+    map->size = capacity;
+    map->shift = 64 - bits;
 
     return map;
 }
 
 uint16_t get_hash_map(HashMap *map, uint64_t key) {
-    size_t index = key % map->size;
-    HashNode *current = map->buckets[index];
-    while (current != NULL) {
-        if (current->key == key) {
-            return current->value;
+    size_t mask = map->size - 1;
+    for (size_t i = hash_index(map, key), probes = 0; probes < map->size; i = (i + 1) & mask, probes++) {
+        HashEntry *entry = &map->entries[i];
+        if (!entry->used) {
+            return 0;
+        }
+        if (entry->key == key) {
+            return entry->value;
         }
-        current = current->next;
     }
     return 0;
 }
 
 void put_hash_map(HashMap *map, uint64_t key, uint16_t value) {
-    size_t index = key % map->size;
-    HashNode * node = (HashNode*) malloc(sizeof(HashNode));
-
-    node->key = key;
-    node->value = value;
-
-    node->next = map->buckets[index];
-    map->buckets[index] = node;
+    size_t mask = map->size - 1;
+    for (size_t i = hash_index(map, key), probes = 0; probes < map->size; i = (i + 1) & mask, probes++) {
+        HashEntry *entry = &map->entries[i];
+        if (!entry->used || entry->key == key) {
+            entry->key = key;
+            entry->value = value;
+            entry->used = 1;
+            return;
+        }
+    }
 }
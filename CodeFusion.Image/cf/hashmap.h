@@ -2,18 +2,19 @@
 #define CF_HASHMAP_H
 
 #include <inttypes.h>
+#include <stddef.h>
 
-struct HashNode {
+typedef struct {
     uint64_t key;
     uint16_t value;
-    struct HashNode *next;
-};
-
-typedef struct HashNode HashNode;
+    uint8_t used;
+} HashEntry;
 
+// Open addressing table with linear probing, the entries are part of the same allocation as the map
 typedef struct {
-    HashNode **buckets;
     size_t size;
+    unsigned int shift;
+    HashEntry entries[];
 } HashMap;
 
 HashMap *create_hash_map(size_t size);
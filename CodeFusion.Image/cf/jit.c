@@ -0,0 +1,1035 @@
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "memops.h"
+#include "opcode.h"
+
+#ifdef CF_JIT
+
+#include <sys/mman.h>
+
+// Register assignment of the native code. The stack register points at the first free entry of the operand stack,
+// so the top of the stack is at -8. All of them are callee saved and survive calls into the helpers.
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+#define BASE_REG RBX
+#define STACK_REG R12
+#define MACHINE_REG R13
+#define STEPS_REG R14
+#define STEPS_PTR_REG R15
+
+#define SLOT(index) (-8 * (index))
+
+// Condition codes of jcc and setcc
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+#define CC_L 0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G 0xF
+
+// Returned by the native code if the instruction at the program counter has to be executed by cf_execute_inst
+#define JIT_FALLBACK 0xFF
+
+// What an exit stub does with the step budget before it leaves the native code
+#define BUDGET_KEEP 0
+#define BUDGET_EXHAUSTED 1
+#define BUDGET_REFUND 2
+
+typedef uint32_t (*JitEntry)(CF_Machine *cf, const void *target, uint64_t *steps);
+
+typedef struct {
+    size_t at;
+    uint64_t target;
+} JumpFixup;
+
+typedef struct {
+    size_t at;
+    uint64_t program_counter;
+    uint32_t status;
+    uint8_t budget;
+} ExitStub;
+
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    size_t capacity;
+    int failed;
+    uint8_t verified;
+
+    size_t *labels;
+    size_t exit;
+    void **entries;
+
+    JumpFixup *jumps;
+    size_t jump_size;
+    size_t jump_capacity;
+
+    ExitStub *stubs;
+    size_t stub_size;
+    size_t stub_capacity;
+} Emitter;
+
+static uint64_t jit_read(const void *ptr, uint64_t size) {
+    uint64_t result = 0;
+    memcpy(&result, ptr, size);
+    return result;
+}
+
+static void jit_write(void *ptr, uint64_t value, uint64_t size) {
+    memcpy(ptr, &value, size);
+}
+
+// Returns 0 without pushing a frame if the arena cannot grow
+static uint64_t jit_malloc_pool(CF_Machine *cf, uint64_t size) {
+    void *frame = cf_arena_push(&cf->pool_arena, size);
+    if (frame == NULL) {
+        return 0;
+    }
+    cf->pool_stack[cf->pool_stack_size++].as_ptr = frame;
+    return 1;
+}
+
+static void jit_free_pool(CF_Machine *cf) {
+    cf_arena_pop(&cf->pool_arena, cf->pool_stack[--cf->pool_stack_size].as_ptr);
+}
+
+static void *jit_push_array(CF_Machine *cf, uint64_t size) {
+    return cf_slab_alloc(&cf->heap, size);
+}
+
+// The byte of MEMFILL and MEMFIND is passed as a whole register, the narrowing is left to C
+static void jit_memory_fill(void *dst, uint64_t value, uint64_t size) {
+    cf_memory_fill(dst, (uint8_t) value, size);
+}
+
+static int64_t jit_memory_find(const void *data, uint64_t value, uint64_t size) {
+    return cf_memory_find(data, (uint8_t) value, size);
+}
+
+static void *grow(void *items, size_t *capacity, size_t size, size_t item, int *failed) {
+    if (size < *capacity) {
+        return items;
+    }
+    size_t next = *capacity == 0 ? 64 : *capacity * 2;
+    void *result = realloc(items, next * item);
+    if (result == NULL) {
+        *failed = 1;
+        return items;
+    }
+    *capacity = next;
+    return result;
+}
+
+static void emit_u8(Emitter *e, uint8_t value) {
+    e->code = grow(e->code, &e->capacity, e->size, 1, &e->failed);
+    if (e->size < e->capacity) {
+        e->code[e->size++] = value;
+    }
+}
+
+static void emit_u32(Emitter *e, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit_u8(e, (uint8_t) (value >> (8 * i)));
+    }
+}
+
+static void emit_u64(Emitter *e, uint64_t value) {
+    emit_u32(e, (uint32_t) value);
+    emit_u32(e, (uint32_t) (value >> 32));
+}
+
+static void emit_bytes(Emitter *e, const uint8_t *bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        emit_u8(e, bytes[i]);
+    }
+}
+
+static int fits_i32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Legacy prefix, REX and opcode of an instruction. Opcodes above 0xFF are two byte opcodes starting with 0x0F.
+static void emit_opcode(Emitter *e, uint8_t prefix, uint8_t wide, uint16_t opcode, uint8_t reg, uint8_t rm) {
+    if (prefix != 0) {
+        emit_u8(e, prefix);
+    }
+    uint8_t rex = (uint8_t) (0x40 | wide << 3 | (reg & 8) >> 1 | (rm & 8) >> 3);
+    if (rex != 0x40) {
+        emit_u8(e, rex);
+    }
+    if (opcode > 0xFF) {
+        emit_u8(e, (uint8_t) (opcode >> 8));
+    }
+    emit_u8(e, (uint8_t) opcode);
+}
+
+// Instruction with a register and a [base + disp] operand
+static void emit_mem(Emitter *e, uint8_t prefix, uint8_t wide, uint16_t opcode, uint8_t reg, uint8_t base,
+                     int32_t disp) {
+    emit_opcode(e, prefix, wide, opcode, reg, base);
+    uint8_t mod = disp == 0 && (base & 7) != 5 ? 0 : disp >= INT8_MIN && disp <= INT8_MAX ? 1 : 2;
+    emit_u8(e, (uint8_t) (mod << 6 | (reg & 7) << 3 | (base & 7)));
+    if ((base & 7) == 4) {
+        emit_u8(e, 0x24);
+    }
+    if (mod == 1) {
+        emit_u8(e, (uint8_t) disp);
+    } else if (mod == 2) {
+        emit_u32(e, (uint32_t) disp);
+    }
+}
+
+// Instruction with two register operands
+static void emit_reg(Emitter *e, uint8_t prefix, uint8_t wide, uint16_t opcode, uint8_t reg, uint8_t rm) {
+    emit_opcode(e, prefix, wide, opcode, reg, rm);
+    emit_u8(e, (uint8_t) (0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+static void emit_load(Emitter *e, uint8_t reg, uint8_t base, int32_t disp) {
+    emit_mem(e, 0, 1, 0x8B, reg, base, disp);
+}
+
+static void emit_store(Emitter *e, uint8_t base, int32_t disp, uint8_t reg) {
+    emit_mem(e, 0, 1, 0x89, reg, base, disp);
+}
+
+static void emit_move_imm(Emitter *e, uint8_t reg, uint64_t value) {
+    if (value <= UINT32_MAX) {
+        emit_opcode(e, 0, 0, (uint16_t) (0xB8 + (reg & 7)), 0, reg);
+        emit_u32(e, (uint32_t) value);
+    } else {
+        emit_opcode(e, 0, 1, (uint16_t) (0xB8 + (reg & 7)), 0, reg);
+        emit_u64(e, value);
+    }
+}
+
+// reg = base + offset
+static void emit_address(Emitter *e, uint8_t reg, uint8_t base, uint64_t offset) {
+    if (fits_i32((int64_t) offset)) {
+        emit_mem(e, 0, 1, 0x8D, reg, base, (int32_t) offset);
+    } else {
+        emit_move_imm(e, RDX, offset);
+        emit_reg(e, 0, 1, 0x01, base, RDX);
+        emit_reg(e, 0, 1, 0x89, RDX, reg);
+    }
+}
+
+// Moves the stack register by count entries
+static void emit_adjust(Emitter *e, int32_t count) {
+    int32_t bytes = count * 8;
+    uint8_t ext = bytes < 0 ? 5 : 0;
+    bytes = bytes < 0 ? -bytes : bytes;
+    if (bytes <= INT8_MAX) {
+        emit_reg(e, 0, 1, 0x83, ext, STACK_REG);
+        emit_u8(e, (uint8_t) bytes);
+    } else {
+        emit_reg(e, 0, 1, 0x81, ext, STACK_REG);
+        emit_u32(e, (uint32_t) bytes);
+    }
+}
+
+static void emit_push(Emitter *e, uint8_t reg) {
+    emit_store(e, STACK_REG, 0, reg);
+    emit_adjust(e, 1);
+}
+
+static void emit_call(Emitter *e, uint64_t function) {
+    emit_move_imm(e, RAX, function);
+    emit_reg(e, 0, 0, 0xFF, 2, RAX);
+}
+
+// rax = pool frame of the active function
+static void emit_frame(Emitter *e) {
+    static const uint8_t load_frame[] = {0x48, 0x8B, 0x44, 0xC8, 0xF8}; // mov rax, [rax + rcx * 8 - 8]
+    emit_load(e, RAX, MACHINE_REG, (int32_t) offsetof(CF_Machine, pool_stack));
+    emit_load(e, RCX, MACHINE_REG, (int32_t) offsetof(CF_Machine, pool_stack_size));
+    emit_bytes(e, load_frame, sizeof(load_frame));
+}
+
+// Placeholder for the rel32 of a jump to the code of an instruction, resolved once every instruction is translated
+static void add_jump(Emitter *e, uint64_t target) {
+    e->jumps = grow(e->jumps, &e->jump_capacity, e->jump_size, sizeof(JumpFixup), &e->failed);
+    if (e->jump_size < e->jump_capacity) {
+        e->jumps[e->jump_size++] = (JumpFixup) {.at = e->size, .target = target};
+    }
+    emit_u32(e, 0);
+}
+
+static void emit_jump(Emitter *e, uint64_t target) {
+    emit_u8(e, 0xE9);
+    add_jump(e, target);
+}
+
+static void emit_branch(Emitter *e, uint8_t condition, uint64_t target) {
+    emit_u8(e, 0x0F);
+    emit_u8(e, (uint8_t) (0x80 | condition));
+    add_jump(e, target);
+}
+
+static void add_stub(Emitter *e, uint64_t program_counter, uint32_t status, uint8_t budget) {
+    e->stubs = grow(e->stubs, &e->stub_capacity, e->stub_size, sizeof(ExitStub), &e->failed);
+    if (e->stub_size < e->stub_capacity) {
+        e->stubs[e->stub_size++] = (ExitStub) {
+                .at = e->size, .program_counter = program_counter, .status = status, .budget = budget
+        };
+    }
+    emit_u32(e, 0);
+}
+
+// Leaves the native code with the status if the condition holds, the stub is placed behind the program
+static void emit_exit_if(Emitter *e, uint8_t condition, uint64_t program_counter, uint32_t status, uint8_t budget) {
+    emit_u8(e, 0x0F);
+    emit_u8(e, (uint8_t) (0x80 | condition));
+    add_stub(e, program_counter, status, budget);
+}
+
+static void emit_exit(Emitter *e, uint64_t program_counter, uint32_t status, uint8_t budget) {
+    emit_u8(e, 0xE9);
+    add_stub(e, program_counter, status, budget);
+}
+
+static void patch(Emitter *e, size_t at, size_t target) {
+    uint32_t relative = (uint32_t) ((int64_t) target - (int64_t) (at + 4));
+    if (at + 4 <= e->size) {
+        memcpy(e->code + at, &relative, sizeof(relative));
+    }
+}
+
+static void emit_underflow_check(Emitter *e, uint64_t count, uint64_t program_counter) {
+    if (count > INT32_MAX / 8) {
+        emit_exit(e, program_counter, STATUS_STACK_UNDERFLOW, BUDGET_KEEP);
+        return;
+    }
+    emit_mem(e, 0, 1, 0x8D, RAX, BASE_REG, (int32_t) (count * 8));
+    emit_reg(e, 0, 1, 0x3B, STACK_REG, RAX);
+    emit_exit_if(e, CC_B, program_counter, STATUS_STACK_UNDERFLOW, BUDGET_KEEP);
+}
+
+// Fails with STATUS_STACK_UNDERFLOW if the stack has less than count entries. Verified libraries check the
+// annotation of cf_verify_program in front of every instruction instead, see emit_inst.
+static void emit_require(Emitter *e, uint64_t pc, uint64_t count) {
+    if (count != 0 && !e->verified) {
+        emit_underflow_check(e, count, pc + 1);
+    }
+}
+
+// Fails with STATUS_ILLEGAL_ACCESS if the target is outside of the program, returns 0 in that case
+static int emit_check_target(Emitter *e, const CF_Library *library, uint64_t pc, uint64_t target) {
+    if (target >= library->program_size) {
+        emit_exit(e, pc + 1, STATUS_ILLEGAL_ACCESS, BUDGET_KEEP);
+        return 0;
+    }
+    return 1;
+}
+
+static void emit_jump_exit(Emitter *e) {
+    emit_u8(e, 0xE9);
+    emit_u32(e, (uint32_t) ((int64_t) e->exit - (int64_t) (e->size + 4)));
+}
+
+static void emit_fallback(Emitter *e, uint64_t pc) {
+    emit_move_imm(e, RSI, pc);
+    emit_move_imm(e, RAX, JIT_FALLBACK);
+    emit_jump_exit(e);
+}
+
+// Takes one step of the budget, leaving with the program counter at the instruction if there is none left
+static void emit_step(Emitter *e, uint64_t pc) {
+    emit_reg(e, 0, 1, 0x83, 5, STEPS_REG);
+    emit_u8(e, 1);
+    emit_exit_if(e, CC_B, pc, STATUS_OK, BUDGET_EXHAUSTED);
+}
+
+static void emit_binary(Emitter *e, uint64_t pc, uint16_t opcode) {
+    emit_require(e, pc, 2);
+    emit_load(e, RAX, STACK_REG, SLOT(2));
+    emit_mem(e, 0, 1, opcode, RAX, STACK_REG, SLOT(1));
+    emit_store(e, STACK_REG, SLOT(2), RAX);
+    emit_adjust(e, -1);
+}
+
+static void emit_float_binary(Emitter *e, uint64_t pc, uint16_t opcode) {
+    emit_require(e, pc, 2);
+    emit_mem(e, 0xF2, 0, 0x0F10, 0, STACK_REG, SLOT(2));
+    emit_mem(e, 0xF2, 0, opcode, 0, STACK_REG, SLOT(1));
+    emit_mem(e, 0xF2, 0, 0x0F11, 0, STACK_REG, SLOT(2));
+    emit_adjust(e, -1);
+}
+
+static void emit_compare(Emitter *e, uint64_t pc, uint8_t condition) {
+    emit_require(e, pc, 2);
+    emit_reg(e, 0, 0, 0x31, RCX, RCX);
+    emit_load(e, RAX, STACK_REG, SLOT(2));
+    emit_mem(e, 0, 1, 0x3B, RAX, STACK_REG, SLOT(1));
+    emit_reg(e, 0, 0, (uint16_t) (0x0F90 | condition), 0, RCX);
+    emit_store(e, STACK_REG, SLOT(2), RCX);
+    emit_adjust(e, -1);
+}
+
+// ucomisd sets the flags like an unsigned compare and reports unordered operands as below and equal, so comparing the
+// larger side first keeps NaN false for every operator
+static void emit_float_compare(Emitter *e, uint64_t pc, uint8_t condition, int swap) {
+    emit_require(e, pc, 2);
+    emit_reg(e, 0, 0, 0x31, RCX, RCX);
+    emit_mem(e, 0xF2, 0, 0x0F10, 0, STACK_REG, SLOT(2));
+    emit_mem(e, 0xF2, 0, 0x0F10, 1, STACK_REG, SLOT(1));
+    emit_reg(e, 0x66, 0, 0x0F2E, swap ? 1 : 0, swap ? 0 : 1);
+    emit_reg(e, 0, 0, (uint16_t) (0x0F90 | condition), 0, RCX);
+    emit_store(e, STACK_REG, SLOT(2), RCX);
+    emit_adjust(e, -1);
+}
+
+static void emit_division(Emitter *e, uint64_t pc, int is_signed, int remainder) {
+    emit_require(e, pc, 2);
+    emit_mem(e, 0, 1, 0x83, 7, STACK_REG, SLOT(1));
+    emit_u8(e, 0);
+    emit_exit_if(e, CC_E, pc + 1, STATUS_DIVISION_BY_ZERO, BUDGET_KEEP);
+    emit_load(e, RAX, STACK_REG, SLOT(2));
+    if (is_signed) {
+        static const uint8_t cqo[] = {0x48, 0x99};
+        emit_bytes(e, cqo, sizeof(cqo));
+    } else {
+        emit_reg(e, 0, 0, 0x31, RDX, RDX);
+    }
+    emit_mem(e, 0, 1, 0xF7, is_signed ? 7 : 6, STACK_REG, SLOT(1));
+    emit_store(e, STACK_REG, SLOT(2), remainder ? RDX : RAX);
+    emit_adjust(e, -1);
+}
+
+static void emit_shift(Emitter *e, uint64_t pc, uint8_t ext) {
+    emit_require(e, pc, 2);
+    emit_load(e, RCX, STACK_REG, SLOT(1));
+    emit_load(e, RAX, STACK_REG, SLOT(2));
+    emit_reg(e, 0, 1, 0xD3, ext, RAX);
+    emit_store(e, STACK_REG, SLOT(2), RAX);
+    emit_adjust(e, -1);
+}
+
+// Reads size bytes at [rax + offset] into rax like read_ptr does
+static void emit_read_sized(Emitter *e, uint64_t offset, uint64_t size) {
+    if (fits_i32((int64_t) offset) && (size == 1 || size == 2 || size == 4 || size == 8)) {
+        uint16_t opcode = size == 1 ? 0x0FB6 : size == 2 ? 0x0FB7 : 0x8B;
+        emit_mem(e, 0, size == 8, opcode, RAX, RAX, (int32_t) offset);
+        return;
+    }
+    emit_address(e, RDI, RAX, offset);
+    emit_move_imm(e, RSI, size);
+    emit_call(e, (uint64_t) (uintptr_t) jit_read);
+}
+
+// Writes the low size bytes of rcx to [rax + offset] like write_ptr does
+static void emit_write_sized(Emitter *e, uint64_t offset, uint64_t size) {
+    if (fits_i32((int64_t) offset) && (size == 1 || size == 2 || size == 4 || size == 8)) {
+        emit_mem(e, size == 2 ? 0x66 : 0, size == 8, size == 1 ? 0x88 : 0x89, RCX, RAX, (int32_t) offset);
+        return;
+    }
+    emit_address(e, RDI, RAX, offset);
+    emit_reg(e, 0, 1, 0x89, RCX, RSI);
+    emit_move_imm(e, RDX, size);
+    emit_call(e, (uint64_t) (uintptr_t) jit_write);
+}
+
+static void emit_pool_check(Emitter *e, uint64_t pc) {
+    emit_mem(e, 0, 1, 0x83, 7, MACHINE_REG, (int32_t) offsetof(CF_Machine, pool_stack_size));
+    emit_u8(e, 0);
+    emit_exit_if(e, CC_E, pc + 1, STATUS_CALL_STACK_UNDERFLOW, BUDGET_KEEP);
+}
+
+// The templates follow the checked engine in dispatch.h: every instruction counts one step and a failing instruction
+// leaves the program counter behind it
+static void emit_inst(Emitter *e, const CF_Library *library, uint64_t pc) {
+    const Inst *inst = &library->program[pc];
+    uint64_t operand = inst->operand.as_u64;
+
+    // The verified engine checks the annotation whenever control is transferred. Checking it in front of every
+    // instruction fails at the same place: within a block the annotation of the entry covers the later ones.
+    if (e->verified && inst->stack_need != 0) {
+        emit_underflow_check(e, inst->stack_need, pc);
+    }
+
+    switch (inst->opcode) {
+        case INST_INT:
+        case INST_VCALL:
+        case INST_FMOD:
+        case INST_FTU:
+        case INST_UTF:
+        case INST_VADD:
+        case INST_VSUB:
+        case INST_VMUL:
+        case INST_VFMA:
+        case INST_VMIN:
+        case INST_VMAX:
+        case INST_VSUM:
+        case INST_VDOT:
+            emit_fallback(e, pc);
+            return;
+        case INST_LOAD_SIZED:
+        case INST_STORE_SIZED:
+        case INST_PUSH_IADD:
+        case INST_PUSH_ISUB:
+        case INST_ILESS_JMP_ZERO:
+            // Fused instructions continue behind their second half
+            if (pc + 1 >= library->program_size) {
+                emit_fallback(e, pc);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    emit_step(e, pc);
+
+    switch (inst->opcode) {
+        case INST_NOP:
+            return;
+        case INST_PUSH:
+            if (fits_i32(inst->operand.as_i64)) {
+                emit_mem(e, 0, 1, 0xC7, 0, STACK_REG, 0);
+                emit_u32(e, (uint32_t) operand);
+                emit_adjust(e, 1);
+            } else {
+                emit_move_imm(e, RAX, operand);
+                emit_push(e, RAX);
+            }
+            return;
+        case INST_POP:
+            emit_require(e, pc, 1);
+            emit_adjust(e, -1);
+            return;
+        case INST_LOAD:
+            emit_require(e, pc, 1);
+            emit_frame(e);
+            emit_address(e, RDI, RAX, operand);
+            emit_load(e, RSI, STACK_REG, SLOT(1));
+            emit_call(e, (uint64_t) (uintptr_t) jit_read);
+            emit_store(e, STACK_REG, SLOT(1), RAX);
+            return;
+        case INST_STORE:
+            emit_require(e, pc, 2);
+            emit_frame(e);
+            emit_address(e, RDI, RAX, operand);
+            emit_load(e, RSI, STACK_REG, SLOT(2));
+            emit_load(e, RDX, STACK_REG, SLOT(1));
+            emit_call(e, (uint64_t) (uintptr_t) jit_write);
+            emit_adjust(e, -2);
+            return;
+        case INST_MALLOC_POOL:
+            emit_reg(e, 0, 1, 0x89, MACHINE_REG, RDI);
+            emit_move_imm(e, RSI, operand);
+            emit_call(e, (uint64_t) (uintptr_t) jit_malloc_pool);
+            emit_reg(e, 0, 1, 0x85, RAX, RAX);
+            emit_exit_if(e, CC_E, pc + 1, STATUS_CALL_STACK_OVERFLOW, BUDGET_KEEP);
+            return;
+        case INST_FREE_POOL:
+            emit_pool_check(e, pc);
+            emit_reg(e, 0, 1, 0x89, MACHINE_REG, RDI);
+            emit_call(e, (uint64_t) (uintptr_t) jit_free_pool);
+            return;
+        case INST_PUSH_PTR:
+            emit_pool_check(e, pc);
+            emit_frame(e);
+            emit_address(e, RAX, RAX, operand);
+            emit_push(e, RAX);
+            return;
+        case INST_LOAD_PTR:
+            emit_require(e, pc, 1);
+            emit_load(e, RDI, STACK_REG, SLOT(1));
+            emit_move_imm(e, RSI, operand);
+            emit_call(e, (uint64_t) (uintptr_t) jit_read);
+            emit_store(e, STACK_REG, SLOT(1), RAX);
+            return;
+        case INST_STORE_PTR:
+            emit_require(e, pc, 2);
+            emit_load(e, RDI, STACK_REG, SLOT(2));
+            emit_load(e, RSI, STACK_REG, SLOT(1));
+            emit_move_imm(e, RDX, operand);
+            emit_call(e, (uint64_t) (uintptr_t) jit_write);
+            emit_adjust(e, -2);
+            return;
+        case INST_DUP:
+            if (operand >= INT32_MAX / 8) {
+                emit_exit(e, pc + 1, STATUS_STACK_UNDERFLOW, BUDGET_KEEP);
+                return;
+            }
+            emit_require(e, pc, operand + 1);
+            emit_load(e, RAX, STACK_REG, SLOT((int32_t) operand + 1));
+            emit_push(e, RAX);
+            return;
+        case INST_PUSH_ARRAY:
+            emit_require(e, pc, 1);
+            emit_reg(e, 0, 1, 0x89, MACHINE_REG, RDI);
+            emit_load(e, RSI, STACK_REG, SLOT(1));
+            emit_call(e, (uint64_t) (uintptr_t) jit_push_array);
+            emit_store(e, STACK_REG, SLOT(1), RAX);
+            return;
+        case INST_LOAD_ARRAY:
+            emit_require(e, pc, 2);
+            emit_load(e, RDI, STACK_REG, SLOT(2));
+            emit_mem(e, 0, 1, 0x03, RDI, STACK_REG, SLOT(1));
+            emit_move_imm(e, RSI, operand);
+            emit_call(e, (uint64_t) (uintptr_t) jit_read);
+            emit_store(e, STACK_REG, SLOT(2), RAX);
+            emit_adjust(e, -1);
+            return;
+        case INST_STORE_ARRAY:
+            emit_require(e, pc, 3);
+            emit_load(e, RDI, STACK_REG, SLOT(3));
+            emit_mem(e, 0, 1, 0x03, RDI, STACK_REG, SLOT(2));
+            emit_load(e, RSI, STACK_REG, SLOT(1));
+            emit_move_imm(e, RDX, operand);
+            emit_call(e, (uint64_t) (uintptr_t) jit_write);
+            emit_adjust(e, -3);
+            return;
+        case INST_MEM_COPY:
+        case INST_MEM_COMPARE:
+            emit_require(e, pc, 3);
+            emit_load(e, RDI, STACK_REG, SLOT(3));
+            emit_load(e, RSI, STACK_REG, SLOT(2));
+            emit_load(e, RDX, STACK_REG, SLOT(1));
+            if (inst->opcode == INST_MEM_COPY) {
+                emit_call(e, (uint64_t) (uintptr_t) cf_memory_copy);
+                emit_adjust(e, -3);
+            } else {
+                emit_call(e, (uint64_t) (uintptr_t) cf_memory_compare);
+                emit_store(e, STACK_REG, SLOT(3), RAX);
+                emit_adjust(e, -2);
+            }
+            return;
+        case INST_MEM_FILL:
+        case INST_MEM_FIND:
+            // The byte is on top and the length below it, the kernels take them the other way round
+            emit_require(e, pc, 3);
+            emit_load(e, RDI, STACK_REG, SLOT(3));
+            emit_load(e, RSI, STACK_REG, SLOT(1));
+            emit_load(e, RDX, STACK_REG, SLOT(2));
+            if (inst->opcode == INST_MEM_FILL) {
+                emit_call(e, (uint64_t) (uintptr_t) jit_memory_fill);
+                emit_adjust(e, -3);
+            } else {
+                emit_call(e, (uint64_t) (uintptr_t) jit_memory_find);
+                emit_store(e, STACK_REG, SLOT(3), RAX);
+                emit_adjust(e, -2);
+            }
+            return;
+        case INST_IADD:
+        case INST_UADD:
+            emit_binary(e, pc, 0x03);
+            return;
+        case INST_ISUB:
+        case INST_USUB:
+            emit_binary(e, pc, 0x2B);
+            return;
+        case INST_IMUL:
+        case INST_UMUL:
+            emit_binary(e, pc, 0x0FAF);
+            return;
+        case INST_AND:
+            emit_binary(e, pc, 0x23);
+            return;
+        case INST_OR:
+            emit_binary(e, pc, 0x0B);
+            return;
+        case INST_XOR:
+            emit_binary(e, pc, 0x33);
+            return;
+        case INST_FADD:
+            emit_float_binary(e, pc, 0x0F58);
+            return;
+        case INST_FSUB:
+            emit_float_binary(e, pc, 0x0F5C);
+            return;
+        case INST_FMUL:
+            emit_float_binary(e, pc, 0x0F59);
+            return;
+        case INST_FDIV: {
+            // xmm1 == 0.0 without the unordered case, jp skips the following jcc of 6 bytes
+            static const uint8_t skip_unordered[] = {0x7A, 0x06};
+            emit_require(e, pc, 2);
+            emit_mem(e, 0xF2, 0, 0x0F10, 1, STACK_REG, SLOT(1));
+            emit_reg(e, 0x66, 0, 0x0F57, 0, 0);
+            emit_reg(e, 0x66, 0, 0x0F2E, 1, 0);
+            emit_bytes(e, skip_unordered, sizeof(skip_unordered));
+            emit_exit_if(e, CC_E, pc + 1, STATUS_DIVISION_BY_ZERO, BUDGET_KEEP);
+            emit_mem(e, 0xF2, 0, 0x0F10, 0, STACK_REG, SLOT(2));
+            emit_reg(e, 0xF2, 0, 0x0F5E, 0, 1);
+            emit_mem(e, 0xF2, 0, 0x0F11, 0, STACK_REG, SLOT(2));
+            emit_adjust(e, -1);
+            return;
+        }
+        case INST_IDIV:
+            emit_division(e, pc, 1, 0);
+            return;
+        case INST_UDIV:
+            emit_division(e, pc, 0, 0);
+            return;
+        case INST_IMOD:
+            emit_division(e, pc, 1, 1);
+            return;
+        case INST_UMOD:
+            emit_division(e, pc, 0, 1);
+            return;
+        case INST_ILESS:
+            emit_compare(e, pc, CC_L);
+            return;
+        case INST_ULESS:
+            emit_compare(e, pc, CC_B);
+            return;
+        case INST_ILESS_EQUAL:
+            emit_compare(e, pc, CC_LE);
+            return;
+        case INST_ULESS_EQUAL:
+            emit_compare(e, pc, CC_BE);
+            return;
+        case INST_IGREATER:
+            emit_compare(e, pc, CC_G);
+            return;
+        case INST_UGREATER:
+            emit_compare(e, pc, CC_A);
+            return;
+        case INST_IGREATER_EQUALS:
+            emit_compare(e, pc, CC_GE);
+            return;
+        case INST_UGREATER_EQUALS:
+            emit_compare(e, pc, CC_AE);
+            return;
+        case INST_EQ:
+            emit_compare(e, pc, CC_E);
+            return;
+        case INST_NEQ:
+            emit_compare(e, pc, CC_NE);
+            return;
+        case INST_FLESS:
+            emit_float_compare(e, pc, CC_A, 1);
+            return;
+        case INST_FLESS_EQUAL:
+            emit_float_compare(e, pc, CC_AE, 1);
+            return;
+        case INST_FGREATER:
+            emit_float_compare(e, pc, CC_A, 0);
+            return;
+        case INST_FGREATER_EQUALS:
+            emit_float_compare(e, pc, CC_AE, 0);
+            return;
+        case INST_LSHIFT:
+            emit_shift(e, pc, 4);
+            return;
+        case INST_RSHIFT:
+            emit_shift(e, pc, 5);
+            return;
+        case INST_INEG:
+        case INST_UNEG:
+            emit_require(e, pc, 1);
+            emit_mem(e, 0, 1, 0xF7, 3, STACK_REG, SLOT(1));
+            return;
+        case INST_ONES:
+            emit_require(e, pc, 1);
+            emit_mem(e, 0, 1, 0xF7, 2, STACK_REG, SLOT(1));
+            return;
+        case INST_FNEG:
+            // Flips the sign bit
+            emit_require(e, pc, 1);
+            emit_mem(e, 0, 1, 0x0FBA, 7, STACK_REG, SLOT(1));
+            emit_u8(e, 63);
+            return;
+        case INST_NOT:
+            emit_require(e, pc, 1);
+            emit_reg(e, 0, 0, 0x31, RCX, RCX);
+            emit_mem(e, 0, 1, 0x83, 7, STACK_REG, SLOT(1));
+            emit_u8(e, 0);
+            emit_reg(e, 0, 0, (uint16_t) (0x0F90 | CC_E), 0, RCX);
+            emit_store(e, STACK_REG, SLOT(1), RCX);
+            return;
+        case INST_ITU:
+        case INST_UTI:
+            emit_require(e, pc, 1);
+            return;
+        case INST_ITF:
+            emit_require(e, pc, 1);
+            emit_mem(e, 0xF2, 1, 0x0F2A, 0, STACK_REG, SLOT(1));
+            emit_mem(e, 0xF2, 0, 0x0F11, 0, STACK_REG, SLOT(1));
+            return;
+        case INST_FTI:
+            emit_require(e, pc, 1);
+            emit_mem(e, 0xF2, 1, 0x0F2C, RAX, STACK_REG, SLOT(1));
+            emit_store(e, STACK_REG, SLOT(1), RAX);
+            return;
+        case INST_JMP:
+            if (emit_check_target(e, library, pc, operand)) {
+                emit_jump(e, operand);
+            }
+            return;
+        case INST_JMP_ZERO:
+        case INST_JMP_NOT_ZERO:
+            emit_require(e, pc, 1);
+            if (emit_check_target(e, library, pc, operand)) {
+                emit_load(e, RAX, STACK_REG, SLOT(1));
+                emit_adjust(e, -1);
+                emit_reg(e, 0, 1, 0x85, RAX, RAX);
+                emit_branch(e, inst->opcode == INST_JMP_ZERO ? CC_E : CC_NE, operand);
+            }
+            return;
+        case INST_CALL:
+            if (emit_check_target(e, library, pc, operand)) {
+                emit_mem(e, 0, 0, 0x0FB7, RAX, MACHINE_REG, (int32_t) offsetof(CF_Machine, program_pool));
+                emit_store(e, STACK_REG, 0, RAX);
+                emit_move_imm(e, RAX, pc + 1);
+                emit_store(e, STACK_REG, 8, RAX);
+                emit_adjust(e, 2);
+                emit_jump(e, operand);
+            }
+            return;
+        case INST_RET:
+            // Returns into the active library jump through the entry table, everything else goes through
+            // cf_execute_inst and leaves the native code
+            emit_require(e, pc, 2);
+            emit_mem(e, 0, 0, 0x0FB7, RAX, MACHINE_REG, (int32_t) offsetof(CF_Machine, program_pool));
+            emit_mem(e, 0, 1, 0x39, RAX, STACK_REG, SLOT(2));
+            emit_exit_if(e, CC_NE, pc, JIT_FALLBACK, BUDGET_REFUND);
+            emit_load(e, RCX, STACK_REG, SLOT(1));
+            emit_move_imm(e, RAX, library->program_size);
+            emit_reg(e, 0, 1, 0x3B, RCX, RAX);
+            emit_exit_if(e, CC_AE, pc + 1, STATUS_ILLEGAL_ACCESS, BUDGET_KEEP);
+            emit_adjust(e, -2);
+            {
+                static const uint8_t jump_entry[] = {0xFF, 0x24, 0xC8}; // jmp [rax + rcx * 8]
+                emit_move_imm(e, RAX, (uint64_t) (uintptr_t) e->entries);
+                emit_bytes(e, jump_entry, sizeof(jump_entry));
+            }
+            return;
+        case INST_LOAD_MEMORY:
+            if (operand >= library->memory_size) {
+                emit_exit(e, pc + 1, STATUS_ILLEGAL_ACCESS, BUDGET_KEEP);
+                return;
+            }
+            emit_move_imm(e, RAX, (uint64_t) (uintptr_t) ((uint8_t *) library->memory + operand));
+            emit_push(e, RAX);
+            return;
+        case INST_LOAD_SIZED:
+            emit_frame(e);
+            emit_read_sized(e, operand, inst->argument);
+            emit_push(e, RAX);
+            emit_jump(e, pc + 2);
+            return;
+        case INST_STORE_SIZED:
+            emit_require(e, pc, 1);
+            emit_frame(e);
+            emit_load(e, RCX, STACK_REG, SLOT(1));
+            emit_write_sized(e, operand, inst->argument);
+            emit_adjust(e, -1);
+            emit_jump(e, pc + 2);
+            return;
+        case INST_PUSH_IADD:
+        case INST_PUSH_ISUB:
+            emit_require(e, pc, 1);
+            if (fits_i32(inst->operand.as_i64)) {
+                emit_mem(e, 0, 1, 0x81, inst->opcode == INST_PUSH_IADD ? 0 : 5, STACK_REG, SLOT(1));
+                emit_u32(e, (uint32_t) operand);
+            } else {
+                emit_move_imm(e, RAX, operand);
+                emit_mem(e, 0, 1, inst->opcode == INST_PUSH_IADD ? 0x01 : 0x29, RAX, STACK_REG, SLOT(1));
+            }
+            emit_jump(e, pc + 2);
+            return;
+        case INST_ILESS_JMP_ZERO:
+            emit_require(e, pc, 2);
+            if (emit_check_target(e, library, pc, operand)) {
+                emit_load(e, RAX, STACK_REG, SLOT(2));
+                emit_adjust(e, -2);
+                emit_mem(e, 0, 1, 0x3B, RAX, STACK_REG, 8);
+                emit_branch(e, CC_GE, operand);
+                emit_jump(e, pc + 2);
+            }
+            return;
+        default:
+            // Unknown opcodes fail in cf_execute_inst, which takes the step again
+            emit_exit(e, pc, JIT_FALLBACK, BUDGET_REFUND);
+            return;
+    }
+}
+
+// Entered with the machine in rdi, the code of the first instruction in rsi and the step budget in rdx
+static void emit_prologue(Emitter *e) {
+    static const uint8_t save[] = {0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}; // push rbx, r12 - r15
+    static const uint8_t stack_top[] = {0x4E, 0x8D, 0x24, 0xE3}; // lea r12, [rbx + r12 * 8]
+    static const uint8_t enter[] = {0xFF, 0xE6}; // jmp rsi
+    emit_bytes(e, save, sizeof(save));
+    emit_reg(e, 0, 1, 0x89, RDI, MACHINE_REG);
+    emit_reg(e, 0, 1, 0x89, RDX, STEPS_PTR_REG);
+    emit_load(e, STEPS_REG, RDX, 0);
+    emit_load(e, BASE_REG, MACHINE_REG, (int32_t) offsetof(CF_Machine, stack));
+    emit_load(e, STACK_REG, MACHINE_REG, (int32_t) offsetof(CF_Machine, stack_size));
+    emit_bytes(e, stack_top, sizeof(stack_top));
+    emit_bytes(e, enter, sizeof(enter));
+}
+
+// Writes the registers back to the machine and returns the status in eax, the program counter is passed in rsi
+static void emit_epilogue(Emitter *e) {
+    static const uint8_t restore[] = {0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}; // pop, ret
+    e->exit = e->size;
+    emit_store(e, MACHINE_REG, (int32_t) offsetof(CF_Machine, program_counter), RSI);
+    emit_reg(e, 0, 1, 0x89, STACK_REG, RCX);
+    emit_reg(e, 0, 1, 0x29, BASE_REG, RCX);
+    emit_reg(e, 0, 1, 0xC1, 5, RCX);
+    emit_u8(e, 3);
+    emit_store(e, MACHINE_REG, (int32_t) offsetof(CF_Machine, stack_size), RCX);
+    emit_store(e, STEPS_PTR_REG, 0, STEPS_REG);
+    emit_bytes(e, restore, sizeof(restore));
+}
+
+static void emit_stubs(Emitter *e) {
+    for (size_t i = 0; i < e->stub_size; i++) {
+        const ExitStub *stub = &e->stubs[i];
+        patch(e, stub->at, e->size);
+        if (stub->budget == BUDGET_EXHAUSTED) {
+            // The decrement wrapped around
+            emit_reg(e, 0, 0, 0x31, STEPS_REG, STEPS_REG);
+        } else if (stub->budget == BUDGET_REFUND) {
+            emit_reg(e, 0, 1, 0x83, 0, STEPS_REG);
+            emit_u8(e, 1);
+        }
+        emit_move_imm(e, RSI, stub->program_counter);
+        emit_move_imm(e, RAX, stub->status);
+        emit_jump_exit(e);
+    }
+}
+
+static uint8_t *map_code(const Emitter *e) {
+    uint8_t *code = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(code, e->code, e->size);
+    // The mapping is never writable and executable at the same time
+    if (mprotect(code, e->size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, e->size);
+        return NULL;
+    }
+    return code;
+}
+
+CF_JitCode *cf_jit_compile(const CF_Library *library) {
+    uint64_t size = library->program_size;
+    CF_JitCode *jit = calloc(1, sizeof(CF_JitCode));
+    Emitter e = {0};
+    e.labels = malloc((size + 1) * sizeof(size_t));
+    if (jit == NULL || e.labels == NULL) {
+        free(jit);
+        free(e.labels);
+        return NULL;
+    }
+    jit->entries = malloc((size + 1) * sizeof(void *));
+    e.entries = jit->entries;
+    e.failed = jit->entries == NULL;
+    e.verified = library->verified;
+
+    emit_prologue(&e);
+    emit_epilogue(&e);
+    for (uint64_t pc = 0; pc < size && !e.failed; pc++) {
+        e.labels[pc] = e.size;
+        emit_inst(&e, library, pc);
+    }
+    // Running off the end of the program, the verified engine fails before it takes the step
+    e.labels[size] = e.size;
+    if (!e.verified) {
+        emit_step(&e, size);
+    }
+    emit_exit(&e, size, STATUS_ILLEGAL_ACCESS, BUDGET_KEEP);
+
+    if (!e.failed) {
+        for (size_t i = 0; i < e.jump_size; i++) {
+            patch(&e, e.jumps[i].at, e.labels[e.jumps[i].target]);
+        }
+        emit_stubs(&e);
+    }
+    if (!e.failed) {
+        jit->code = map_code(&e);
+        jit->code_size = e.size;
+    }
+    if (jit->code != NULL) {
+        for (uint64_t pc = 0; pc <= size; pc++) {
+            jit->entries[pc] = jit->code + e.labels[pc];
+        }
+    } else {
+        free(jit->entries);
+        free(jit);
+        jit = NULL;
+    }
+
+    free(e.code);
+    free(e.labels);
+    free(e.jumps);
+    free(e.stubs);
+    return jit;
+}
+
+void cf_jit_free(CF_JitCode *jit) {
+    if (jit == NULL) {
+        return;
+    }
+    munmap(jit->code, jit->code_size);
+    free(jit->entries);
+    free(jit);
+}
+
+Status cf_jit_run(CF_Machine *cf, uint64_t *steps) {
+    for (;;) {
+        const CF_Library *library = cf_runtime_library(cf->runtime, cf->program_pool);
+        if (library->jit == NULL) {
+            return STATUS_OK;
+        }
+
+        if (cf->program_counter <= library->program_size) {
+            JitEntry entry;
+            *(void **) &entry = library->jit->code;
+            uint32_t result = entry(cf, library->jit->entries[cf->program_counter], steps);
+            if (result != JIT_FALLBACK) {
+                return (Status) result;
+            }
+        }
+
+        if (*steps == 0) {
+            return STATUS_OK;
+        }
+        (*steps)--;
+        Status status = cf_execute_inst(cf);
+        if (status != STATUS_OK) {
+            return status;
+        }
+    }
+}
+
+#else
+
+CF_JitCode *cf_jit_compile(const CF_Library *library) {
+    (void) library;
+    return NULL;
+}
+
+void cf_jit_free(CF_JitCode *jit) {
+    (void) jit;
+}
+
+Status cf_jit_run(CF_Machine *cf, uint64_t *steps) {
+    (void) cf;
+    (void) steps;
+    return STATUS_OK;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CF_JIT_H
+#define CF_JIT_H
+
+#include "machine.h"
+#include "stack.h"
+
+#if defined(__x86_64__) && defined(__linux__) && defined(THREADED_DISPATCH) && defined(CF_GUARD_PAGES) && \
+    !defined(CF_PROFILE) && !defined(CF_SAMPLE)
+// Libraries can be translated to x86-64 machine code. The native code relies on the guard pages for stack overflows
+// and runs inside the guard scope of the threaded cf_run. Profile builds interpret everything to count dispatches,
+// sampling builds to publish the program counter of every dispatch.
+#define CF_JIT
+#endif
+
+// Environment variable read by main.c: "1" translates every library added to the machine, "diff" runs the program
+// once with the interpreter and once with the JIT and compares the final machines
+#define JIT_ENV "CF_JIT"
+
+// Native code of a library. Every instruction is translated on its own, entries holds the address of the code of
+// each instruction plus one for the end of the program.
+typedef struct CF_JitCode {
+    uint8_t *code;
+    uint64_t code_size;
+    void **entries;
+} CF_JitCode;
+
+// Translates the program of a library, returns NULL if the platform has no JIT or the code could not be mapped
+CF_JitCode *cf_jit_compile(const CF_Library *library);
+
+void cf_jit_free(CF_JitCode *jit);
+
+// Runs the native code of the active library until it fails, the budget is used up or control moves into a library
+// without native code, which returns STATUS_OK with steps left. Instructions without a template (INT, VCALL and a few
+// conversions) and returns into other libraries are executed by cf_execute_inst.
+Status cf_jit_run(CF_Machine *cf, uint64_t *steps);
+
+#endif
@@ -1,29 +1,44 @@
 #include <memory.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include "loader.h"
 #include "opcode.h"
+#include "vector.h"
 #include "debug.h"
 
-static void read_buff(void *dst, size_t item_size, size_t count, void **buff) {
-    void *dst2 = dst;
+// The image is packed, every field is read with a fixed size memcpy which compiles down to a single unaligned load
+static uint64_t read_u64(const uint8_t **buff) {
+    uint64_t value;
+    memcpy(&value, *buff, sizeof(value));
+    *buff += sizeof(value);
+    return value;
+}
 
-    for (size_t i = 0; i < count; i++) {
-        memcpy(dst2, *buff, item_size);
-        *buff += item_size;
-        dst2 += item_size;
-    }
+static uint16_t read_u16(const uint8_t **buff) {
+    uint16_t value;
+    memcpy(&value, *buff, sizeof(value));
+    *buff += sizeof(value);
+    return value;
+}
+
+static uint8_t read_u8(const uint8_t **buff) {
+    return *(*buff)++;
 }
 
 void cf_load_metadata(void **buff, Metadata *metadata) {
     PRINT_DEBUG("Start loading metadata\n");
-    read_buff(metadata->magic, 1, 3, buff);
-    read_buff(&metadata->version, sizeof(metadata->version), 1, buff);
-    read_buff(&metadata->flags, sizeof(metadata->flags), 1, buff);
-    read_buff(&metadata->entry_point, sizeof(metadata->entry_point), 1, buff);
-    read_buff(&metadata->pool_size, sizeof(metadata->pool_size), 1, buff);
-    read_buff(&metadata->program_size, sizeof(metadata->program_size), 1, buff);
-    read_buff(&metadata->symbol_size, sizeof(metadata->symbol_size), 1, buff);
-    read_buff(&metadata->memory_size, sizeof(metadata->memory_size), 1, buff);
+    const uint8_t *cursor = *buff;
+    memcpy(metadata->magic, cursor, sizeof(metadata->magic));
+    cursor += sizeof(metadata->magic);
+    metadata->version = read_u16(&cursor);
+    metadata->flags = read_u8(&cursor);
+    metadata->entry_point = read_u64(&cursor);
+    metadata->pool_size = read_u64(&cursor);
+    metadata->program_size = read_u64(&cursor);
+    metadata->symbol_size = read_u64(&cursor);
+    metadata->memory_size = read_u64(&cursor);
+    *buff = (void *) cursor;
 
     if (metadata->magic[0] != '.' || metadata->magic[1] != 'C' || metadata->magic[2] != 'F') {
         fprintf(stderr, "Program has not the correct file format\n");
@@ -39,59 +54,447 @@ void cf_load_metadata(void **buff, Metadata *metadata) {
 
 void cf_load_pool(void **buff, Metadata *metadata, HashMap *pool) {
     PRINT_DEBUG("Start loading stack pool\n");
-    for (uint16_t i = 0; i < metadata->pool_size; i++) {
-        uint64_t address;
-        uint16_t value;
-        read_buff(&address, sizeof(Word), 1, buff);
-        read_buff(&value, sizeof(uint16_t), 1, buff);
+    const uint8_t *cursor = *buff;
+    for (uint64_t i = 0; i < metadata->pool_size; i++) {
+        uint64_t address = read_u64(&cursor);
+        uint16_t value = read_u16(&cursor);
 
         put_hash_map(pool, address, value);
     }
+    *buff = (void *) cursor;
     PRINT_DEBUG("Finished loading stack pool\n");
 }
 
+// Fixed width records emitted by the builder, the layout matches Inst with the verifier fields zeroed
+static_assert(offsetof(Inst, opcode) == 0 && offsetof(Inst, operand) == 8,
+              "Predecoded records expect the opcode at byte 0 and the operand at byte 8");
+
+static void load_predecoded_program(const uint8_t **buff, Metadata *metadata, CF_Library *library) {
+    memcpy(library->program, *buff, metadata->program_size * sizeof(Inst));
+    *buff += metadata->program_size * sizeof(Inst);
+    library->program_size = metadata->program_size;
+}
+
+// Operands are stored as a size byte followed by up to 8 little endian bytes. As long as at least 8 more
+// instructions follow, the next 8 bytes are known to be inside the program, so the operand is read with one
+// unaligned load and cut to its size with a mask instead of a copy per byte.
+static void load_encoded_program(const uint8_t **buff, Metadata *metadata, CF_Library *library) {
+    uint8_t has_operand[256];
+    for (int i = 0; i < 256; i++) {
+        has_operand[i] = (uint8_t) cf_inst_has_operand((uint8_t) i);
+    }
+
+    const uint8_t *cursor = *buff;
+    Inst *inst = library->program;
+    uint64_t count = metadata->program_size;
+    uint64_t i = 0;
+
+    for (; i + 8 < count; i++, inst++) {
+        *inst = (Inst) {.opcode = *cursor++};
+        if (has_operand[inst->opcode]) {
+            unsigned int size = *cursor++;
+            uint64_t value;
+            memcpy(&value, cursor, sizeof(value));
+            // Shifting in two halves keeps a size of 8 defined and yields a zero mask for a size of 0
+            uint64_t mask = ((UINT64_C(1) << (size * 4)) << (size * 4)) - 1;
+            inst->operand = WORD_U64(value & mask);
+            cursor += size;
+        }
+    }
+    for (; i < count; i++, inst++) {
+        *inst = (Inst) {.opcode = *cursor++};
+        if (has_operand[inst->opcode]) {
+            uint8_t size = *cursor++;
+            memcpy(&inst->operand.as_u64, cursor, size);
+            cursor += size;
+        }
+    }
+
+    *buff = cursor;
+    library->program_size = count;
+}
+
 void cf_load_program(void **buff, Metadata *metadata, CF_Library *library) {
     PRINT_DEBUG("Start loading program\n");
-    for (size_t i = 0; i < metadata->program_size; i++) {
-        Inst inst;
-        read_buff(&inst.opcode, 1, 1, buff);
-        if (cf_inst_has_operand(inst.opcode)) {
-            uint8_t size;
-            read_buff(&size, 1, 1, buff);
-            if (size == 0) {
-                inst.operand = WORD_U64(0);
-            } else {
-                read_buff(&inst.operand.as_u64, size, 1, buff);
-            }
+    library->program = malloc(metadata->program_size * sizeof(Inst));
+    if (library->program == NULL && metadata->program_size != 0) {
+        fprintf(stderr, "Could not allocate %"PRIu64" instructions\n", metadata->program_size);
+        exit(1);
+    }
+
+    const uint8_t *cursor = *buff;
+    if ((metadata->flags & FLAG_PREDECODED) == FLAG_PREDECODED) {
+        load_predecoded_program(&cursor, metadata, library);
+    } else {
+        load_encoded_program(&cursor, metadata, library);
+    }
+    *buff = (void *) cursor;
+
+    uint64_t call_sites = 0;
+    for (uint64_t i = 0; i < library->program_size; i++) {
+        Inst *inst = &library->program[i];
+        if (inst->opcode == INST_MALLOC_POOL) {
+            // Resolve the pool address to the frame size once instead of on every call
+            inst->operand = WORD_U64(get_hash_map(library->address_pool, inst->operand.as_u64));
+        } else if (inst->opcode == INST_VCALL) {
+            inst->operand = WORD_U64(call_sites++);
         }
-        library->program[library->program_size++] = inst;
     }
+
+    // The caches of the sites are allocated per machine, see cf_runtime_add_library
+    library->call_cache_size = call_sites;
     PRINT_DEBUG("Finished loading program\n");
 }
 
+// FNV-1a
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (uint8_t) *name) * UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+static void build_symbol_index(CF_Library *library) {
+    // Keep the load factor at or below one half, the index always has an empty slot to end a lookup
+    uint32_t size = 8;
+    while (size < library->symbol_size * 2) {
+        size <<= 1;
+    }
+
+    library->symbol_index = calloc(size, sizeof(uint32_t));
+    if (library->symbol_index == NULL) {
+        fprintf(stderr, "Could not allocate the symbol index\n");
+        exit(1);
+    }
+    library->symbol_index_size = size;
+
+    uint32_t mask = size - 1;
+    for (uint32_t i = 0; i < library->symbol_size; i++) {
+        const char *name = library->symbols[i].name;
+        uint32_t slot = (uint32_t) hash_name(name) & mask;
+        uint32_t entry;
+        while ((entry = library->symbol_index[slot]) != 0 && strcmp(library->symbols[entry - 1].name, name) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        // The first symbol of a name wins like it did for the linear search
+        if (entry == 0) {
+            library->symbol_index[slot] = i + 1;
+        }
+    }
+}
+
 void cf_load_symbols(void **buff, Metadata *metadata, CF_Library *library) {
     PRINT_DEBUG("Start loading symbols\n");
-    for (size_t i = 0; i < metadata->symbol_size; i++) {
-        uint64_t address;
-        uint16_t size;
-        read_buff(&size, sizeof(uint16_t), 1, buff);
+    const uint8_t *cursor = *buff;
+    for (uint64_t i = 0; i < metadata->symbol_size; i++) {
+        uint16_t size = read_u16(&cursor);
         char *name = malloc(size + 1);
-        read_buff(name, 1, size, buff);
+        memcpy(name, cursor, size);
         name[size] = '\0';
+        cursor += size;
 
-        read_buff(&address, sizeof(uint64_t), 1, buff);
+        uint64_t address = read_u64(&cursor);
 
         library->symbols[library->symbol_size++] = ((CF_Symbol) {
                 .name = name,
                 .address = address
         });
     }
+    *buff = (void *) cursor;
+    build_symbol_index(library);
     PRINT_DEBUG("Finished loading symbols\n");
 }
 
+const CF_Symbol *cf_find_symbol(const CF_Library *library, const char *name) {
+    if (library->symbol_index == NULL) {
+        return NULL;
+    }
+
+    uint32_t mask = library->symbol_index_size - 1;
+    for (uint32_t slot = (uint32_t) hash_name(name) & mask;; slot = (slot + 1) & mask) {
+        uint32_t entry = library->symbol_index[slot];
+        if (entry == 0) {
+            return NULL;
+        }
+        if (strcmp(library->symbols[entry - 1].name, name) == 0) {
+            return &library->symbols[entry - 1];
+        }
+    }
+}
+
 void cf_load_memory(void **buff, Metadata *metadata, CF_Library *library) {
     PRINT_DEBUG("Start loading memory\n");
     library->memory_size = metadata->memory_size;
     library->memory = *buff;
     PRINT_DEBUG("Finished loading memory\n");
 }
+
+// Stack entries an instruction needs and the change of the stack size after it, returns 0 for unknown opcodes
+static int stack_effect(const Inst *inst, int64_t *need, int64_t *delta) {
+    switch (inst->opcode) {
+        case INST_NOP:
+        case INST_MALLOC_POOL:
+        case INST_FREE_POOL:
+        case INST_INT:
+        case INST_JMP:
+            *need = 0;
+            *delta = 0;
+            return 1;
+        case INST_PUSH:
+        case INST_PUSH_PTR:
+        case INST_LOAD_MEMORY:
+            *need = 0;
+            *delta = 1;
+            return 1;
+        case INST_CALL:
+            *need = 0;
+            *delta = 2;
+            return 1;
+        case INST_POP:
+        case INST_JMP_ZERO:
+        case INST_JMP_NOT_ZERO:
+            *need = 1;
+            *delta = -1;
+            return 1;
+        case INST_LOAD:
+        case INST_LOAD_PTR:
+        case INST_PUSH_ARRAY:
+        case INST_INEG:
+        case INST_FNEG:
+        case INST_UNEG:
+        case INST_NOT:
+        case INST_ONES:
+        case INST_ITU:
+        case INST_ITF:
+        case INST_FTI:
+        case INST_FTU:
+        case INST_UTI:
+        case INST_UTF:
+            *need = 1;
+            *delta = 0;
+            return 1;
+        case INST_STORE:
+        case INST_STORE_PTR:
+            *need = 2;
+            *delta = -2;
+            return 1;
+        case INST_VCALL:
+            *need = 2;
+            *delta = 0;
+            return 1;
+        case INST_RET:
+            *need = 2;
+            *delta = -2;
+            return 1;
+        case INST_DUP:
+            if (inst->operand.as_u64 >= UINT16_MAX) {
+                return 0;
+            }
+            *need = (int64_t) inst->operand.as_u64 + 1;
+            *delta = 1;
+            return 1;
+        case INST_LOAD_ARRAY:
+        case INST_IADD:
+        case INST_FADD:
+        case INST_UADD:
+        case INST_ISUB:
+        case INST_FSUB:
+        case INST_USUB:
+        case INST_IMUL:
+        case INST_FMUL:
+        case INST_UMUL:
+        case INST_IDIV:
+        case INST_FDIV:
+        case INST_UDIV:
+        case INST_IMOD:
+        case INST_FMOD:
+        case INST_UMOD:
+        case INST_ILESS:
+        case INST_FLESS:
+        case INST_ULESS:
+        case INST_ILESS_EQUAL:
+        case INST_FLESS_EQUAL:
+        case INST_ULESS_EQUAL:
+        case INST_IGREATER:
+        case INST_FGREATER:
+        case INST_UGREATER:
+        case INST_IGREATER_EQUALS:
+        case INST_FGREATER_EQUALS:
+        case INST_UGREATER_EQUALS:
+        case INST_EQ:
+        case INST_NEQ:
+        case INST_AND:
+        case INST_OR:
+        case INST_XOR:
+        case INST_LSHIFT:
+        case INST_RSHIFT:
+            *need = 2;
+            *delta = -1;
+            return 1;
+        case INST_STORE_ARRAY:
+        case INST_MEM_COPY:
+        case INST_MEM_FILL:
+            *need = 3;
+            *delta = -3;
+            return 1;
+        case INST_MEM_COMPARE:
+        case INST_MEM_FIND:
+        case INST_VDOT:
+            *need = 3;
+            *delta = -2;
+            return 1;
+        case INST_VADD:
+        case INST_VSUB:
+        case INST_VMUL:
+        case INST_VFMA:
+        case INST_VMIN:
+        case INST_VMAX:
+            *need = 4;
+            *delta = -4;
+            return 1;
+        case INST_VSUM:
+            *need = 2;
+            *delta = -1;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Instructions after which the engine re-checks the annotation of the next instruction
+static int ends_block(uint8_t opcode) {
+    switch (opcode) {
+        case INST_INT:
+        case INST_JMP:
+        case INST_JMP_ZERO:
+        case INST_JMP_NOT_ZERO:
+        case INST_CALL:
+        case INST_VCALL:
+        case INST_RET:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int verify_operand(const Inst *inst, const CF_Library *library) {
+    switch (inst->opcode) {
+        case INST_JMP:
+        case INST_JMP_ZERO:
+        case INST_JMP_NOT_ZERO:
+        case INST_CALL:
+            return inst->operand.as_u64 < library->program_size;
+        case INST_LOAD_MEMORY:
+            return inst->operand.as_u64 < library->memory_size;
+        case INST_INT:
+            return inst->operand.as_u64 < INTERRUPT_CAPACITY;
+        case INST_VADD:
+        case INST_VSUB:
+        case INST_VMUL:
+        case INST_VFMA:
+        case INST_VMIN:
+        case INST_VMAX:
+        case INST_VSUM:
+        case INST_VDOT:
+            return inst->operand.as_u64 < VECTOR_TYPES;
+        default:
+            return 1;
+    }
+}
+
+int cf_verify_program(CF_Library *library) {
+    PRINT_DEBUG("Start verifying program\n");
+    library->verified = 0;
+
+    if (library->program_size == 0 || !ends_block(library->program[library->program_size - 1].opcode)) {
+        PRINT_DEBUG("Program can run past its last instruction\n");
+        return 0;
+    }
+
+    // Walk every basic block backwards so each instruction is annotated with the stack requirements of the
+    // remaining block. A block entered at any of its instructions can then be checked once on entry.
+    for (size_t i = library->program_size; i-- > 0;) {
+        Inst *inst = &library->program[i];
+        int64_t need;
+        int64_t delta;
+
+        if (!stack_effect(inst, &need, &delta) || !verify_operand(inst, library)) {
+            PRINT_DEBUG("Instruction %zu can not be verified\n", i);
+            return 0;
+        }
+
+        int64_t grow = delta > 0 ? delta : 0;
+        if (!ends_block(inst->opcode)) {
+            const Inst *next = &library->program[i + 1];
+            if (next->stack_need - delta > need) {
+                need = next->stack_need - delta;
+            }
+            if (delta + next->stack_grow > grow) {
+                grow = delta + next->stack_grow;
+            }
+        }
+
+        if (need > UINT16_MAX || grow > UINT16_MAX) {
+            PRINT_DEBUG("Instruction %zu exceeds the range of the stack annotations\n", i);
+            return 0;
+        }
+        inst->stack_need = (uint16_t) need;
+        inst->stack_grow = (uint16_t) grow;
+    }
+
+    library->verified = 1;
+    PRINT_DEBUG("Finished verifying program\n");
+    return 1;
+}
+
+static uint8_t fused_opcode(const Inst *first, const Inst *second) {
+    switch (first->opcode) {
+        case INST_PUSH:
+            switch (second->opcode) {
+                case INST_LOAD:
+                    return first->operand.as_u64 <= UINT16_MAX ? INST_LOAD_SIZED : INST_NOP;
+                case INST_STORE:
+                    return first->operand.as_u64 <= UINT16_MAX ? INST_STORE_SIZED : INST_NOP;
+                case INST_IADD:
+                    return INST_PUSH_IADD;
+                case INST_ISUB:
+                    return INST_PUSH_ISUB;
+                default:
+                    return INST_NOP;
+            }
+        case INST_ILESS:
+            return second->opcode == INST_JMP_ZERO ? INST_ILESS_JMP_ZERO : INST_NOP;
+        default:
+            return INST_NOP;
+    }
+}
+
+void cf_fuse_program(CF_Library *library) {
+    PRINT_DEBUG("Start fusing program\n");
+    // Pairs are matched on the original opcodes from left to right, the second instruction of every pair is kept
+    // unchanged so jump targets and return addresses stay valid
+    for (size_t i = 0; i + 1 < library->program_size; i++) {
+        Inst *first = &library->program[i];
+        const Inst *second = &library->program[i + 1];
+
+        uint8_t opcode = fused_opcode(first, second);
+        switch (opcode) {
+            case INST_LOAD_SIZED:
+            case INST_STORE_SIZED:
+                first->argument = (uint16_t) first->operand.as_u64;
+                first->operand = second->operand;
+                break;
+            case INST_PUSH_IADD:
+            case INST_PUSH_ISUB:
+                break;
+            case INST_ILESS_JMP_ZERO:
+                first->operand = second->operand;
+                break;
+            default:
+                continue;
+        }
+        first->opcode = opcode;
+    }
+    PRINT_DEBUG("Finished fusing program\n");
+}
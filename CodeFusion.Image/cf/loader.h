@@ -10,6 +10,8 @@
 #define FLAG_EXECUTABLE 0b10
 #define FLAG_CONTAINS_ERROR 0b100
 #define FLAG_LIBRARY 0b1000
+// The program consists of fixed width Inst records instead of variable length operands
+#define FLAG_PREDECODED 0b10000
 
 typedef struct {
     char magic[3];
@@ -26,10 +28,23 @@ void cf_load_metadata(void **buff, Metadata *metadata);
 
 void cf_load_pool(void **buff, Metadata *metadata, HashMap *pool);
 
+// Allocates the program of the library from the program size. Expects the address pool of the library to be loaded
+// already, mallocpool operands are replaced by the frame size and VCALL operands by the index of their call cache
 void cf_load_program(void **buff, Metadata *metadata, CF_Library *library);
 
+// Loads the symbols into the preallocated symbols of the library and builds the name index used by cf_find_symbol
 void cf_load_symbols(void **buff, Metadata *metadata, CF_Library *library);
 
+// Returns the symbol with the given name or NULL if the library does not export it
+const CF_Symbol *cf_find_symbol(const CF_Library *library, const char *name);
+
 void cf_load_memory(void **buff, Metadata *metadata, CF_Library *library);
 
+// Validates the static operands and annotates the stack usage of every instruction, has to run after the program and
+// memory are loaded. Returns 1 and sets the verified flag of the library if the program passed.
+int cf_verify_program(CF_Library *library);
+
+// Rewrites common instruction pairs into superinstructions, has to run after cf_verify_program
+void cf_fuse_program(CF_Library *library);
+
 #endif
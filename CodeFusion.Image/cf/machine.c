@@ -3,6 +3,14 @@
 #include <math.h>
 #include <memory.h>
 #include "machine.h"
+#include "stack.h"
+#include "jit.h"
+#include "memops.h"
+#include "vector.h"
+#include "output.h"
+#include "scheduler.h"
+#include "profile.h"
+#include "sample.h"
 #include "opcode.h"
 #include "debug.h"
 
@@ -21,7 +29,7 @@
 #define UNARY_OP(cf, in, out, op)                                                                \
 {                                                                                                \
     if ((cf)->stack_size < 1) {                                                                  \
-        return STATUS_STACK_OVERFLOW;                                                            \
+        return STATUS_STACK_UNDERFLOW;                                                           \
     }                                                                                            \
     (cf)->stack[(cf)->stack_size - 1].as_##out = op (cf)->stack[(cf)->stack_size - 1].as_##in;   \
     return STATUS_OK;                                                                            \
@@ -36,12 +44,10 @@
     return STATUS_OK;                                                                            \
 }
 
-#define CF_PROGRAM_SIZE(cf) (cf->libraries[cf->program_pool].program_size)
-#define CF_MEMORY_SIZE(cf) (cf->libraries[cf->program_pool].memory_size)
-#define CF_PROGRAM(cf) (cf->libraries[cf->program_pool].program)
-#define CF_ADDR_POOL(cf) (cf->libraries[cf->program_pool].address_pool)
-
-CF_Interrupt interrupts[INTERRUPT_CAPACITY] = {0};
+#define CF_LIBRARY(cf) cf_runtime_library((cf)->runtime, (cf)->program_pool)
+#define CF_PROGRAM_SIZE(cf) (CF_LIBRARY(cf)->program_size)
+#define CF_MEMORY_SIZE(cf) (CF_LIBRARY(cf)->memory_size)
+#define CF_PROGRAM(cf) (CF_LIBRARY(cf)->program)
 
 static Word read_ptr(void *ptr, Word size) {
     Word result = WORD_U64(0);
@@ -70,18 +76,143 @@ static void write_pool_n(CF_Machine *cf, Word offset, Word value, Word size) {
     write_ptr_at(cf->pool_stack[cf->pool_stack_size - 1].as_ptr, offset, value, size);
 }
 
+static void lock_runtime(CF_Runtime *runtime) {
+    // Only adding and unloading libraries take the lock, both are rare and short
+    while (atomic_flag_test_and_set_explicit(&runtime->lock, memory_order_acquire)) {
+    }
+}
+
+static void unlock_runtime(CF_Runtime *runtime) {
+    atomic_flag_clear_explicit(&runtime->lock, memory_order_release);
+}
+
+CF_Runtime *cf_runtime_create(void) {
+    CF_Runtime *runtime = calloc(1, sizeof(CF_Runtime));
+    if (runtime != NULL) {
+        atomic_flag_clear(&runtime->lock);
+    }
+    return runtime;
+}
+
+static void release_library(CF_Library *library) {
+    cf_jit_free(library->jit);
+    if (library->mapped) {
+        return;
+    }
+    free(library->program);
+    for (uint32_t i = 0; i < library->symbol_size; i++) {
+        free(library->symbols[i].name);
+    }
+    free(library->symbols);
+    free(library->symbol_index);
+    free(library->address_pool);
+    // The memory lies in the loaded image itself
+    if (library->release != NULL) {
+        library->release(library);
+    }
+}
+
+void cf_runtime_destroy(CF_Runtime *runtime) {
+    if (runtime == NULL) {
+        return;
+    }
+    CF_Scheduler *scheduler = atomic_load(&runtime->scheduler);
+    if (scheduler != NULL) {
+        cf_scheduler_destroy(scheduler);
+    }
+    uint64_t size = atomic_load(&runtime->library_size);
+    for (uint64_t i = 0; i < size; i++) {
+        release_library(cf_runtime_library(runtime, i));
+    }
+    for (uint64_t i = 0; i < LIBRARY_CHUNKS; i++) {
+        free(runtime->library_chunks[i]);
+    }
+    free(runtime);
+}
+
+Status cf_runtime_add_library(CF_Runtime *runtime, CF_Library library, uint64_t *index) {
+    if (runtime->jit && library.jit == NULL) {
+        // Libraries the JIT cannot translate are interpreted
+        library.jit = cf_jit_compile(&library);
+    }
+
+    lock_runtime(runtime);
+    uint64_t size = atomic_load_explicit(&runtime->library_size, memory_order_relaxed);
+    CF_Library **chunk = &runtime->library_chunks[size / LIBRARY_CHUNK_SIZE];
+    if (size < LIBRARY_CAPACITY && *chunk == NULL) {
+        *chunk = calloc(LIBRARY_CHUNK_SIZE, sizeof(CF_Library));
+    }
+    if (size >= LIBRARY_CAPACITY || *chunk == NULL) {
+        unlock_runtime(runtime);
+        cf_jit_free(library.jit);
+        return STATUS_LIBRARY_OVERFLOW;
+    }
+
+    library.call_cache_base = atomic_load_explicit(&runtime->call_cache_size, memory_order_relaxed);
+    atomic_store_explicit(&runtime->call_cache_size, library.call_cache_base + library.call_cache_size,
+                          memory_order_relaxed);
+    (*chunk)[size % LIBRARY_CHUNK_SIZE] = library;
+    *index = size;
+    atomic_store_explicit(&runtime->library_size, size + 1, memory_order_release);
+    atomic_fetch_add(&runtime->library_generation, 1);
+    unlock_runtime(runtime);
+    return STATUS_OK;
+}
+
+Status cf_runtime_unload_library(CF_Runtime *runtime, uint64_t index) {
+    if (index >= atomic_load(&runtime->library_size)) {
+        return STATUS_ILLEGAL_LIBRARY_INDEX;
+    }
+
+    lock_runtime(runtime);
+    // Every jump, call and return into the library checks the program size
+    cf_runtime_library(runtime, index)->program_size = 0;
+    atomic_fetch_add(&runtime->library_generation, 1);
+    unlock_runtime(runtime);
+    return STATUS_OK;
+}
+
+Status cf_machine_create(CF_Runtime *runtime, uint64_t stack_capacity, uint64_t pool_stack_capacity,
+                         CF_Machine **machine) {
+    CF_Machine *cf = calloc(1, sizeof(CF_Machine));
+    if (cf == NULL) {
+        return STATUS_STACK_OVERFLOW;
+    }
+    Status status = cf_create_stacks(cf, stack_capacity, pool_stack_capacity);
+    if (status != STATUS_OK) {
+        free(cf);
+        return status;
+    }
+    cf->runtime = runtime;
+    *machine = cf;
+    return STATUS_OK;
+}
+
+void cf_machine_destroy(CF_Machine *cf) {
+    if (cf == NULL) {
+        return;
+    }
+    cf_output_flush(cf);
+    free(cf->output);
+    cf_destroy_stacks(cf);
+    cf_arena_free(&cf->pool_arena);
+    free(cf->call_caches);
+    free(cf);
+}
+
 Status cf_execute_inst(CF_Machine *cf) {
     if (cf->program_counter >= CF_PROGRAM_SIZE(cf)) {
         return STATUS_ILLEGAL_ACCESS;
     }
 
     Inst inst = CF_PROGRAM(cf)[cf->program_counter++];
+    PROFILE_STEP(cf, cf->program_counter - 1, inst.opcode);
 
     switch (inst.opcode) {
         case INST_NOP:
             return STATUS_OK;
         case INST_PUSH:
-            if (cf->stack_size >= STACK_CAPACITY) {
+            if (cf->stack_size >= cf->stack_capacity) {
                 return STATUS_STACK_OVERFLOW;
             }
             cf->stack[cf->stack_size++] = inst.operand;
@@ -106,23 +237,29 @@ Status cf_execute_inst(CF_Machine *cf) {
             cf->stack_size -= 2;
             return STATUS_OK;
         case INST_MALLOC_POOL:
-            if (cf->pool_stack_size >= CALLSTACK_CAPACITY) {
+            if (cf->pool_stack_size >= cf->pool_stack_capacity) {
                 return STATUS_CALL_STACK_OVERFLOW;
             }
-            cf->pool_stack[cf->pool_stack_size++].as_ptr = malloc(get_hash_map(CF_ADDR_POOL(cf), inst.operand.as_u64));
-            return STATUS_OK;
+            {
+                void *frame = cf_arena_push(&cf->pool_arena, inst.operand.as_u64);
+                if (frame == NULL) {
+                    return STATUS_CALL_STACK_OVERFLOW;
+                }
+                cf->pool_stack[cf->pool_stack_size++].as_ptr = frame;
+                return STATUS_OK;
+            }
         case INST_FREE_POOL:
             if (cf->pool_stack_size < 1) {
                 return STATUS_CALL_STACK_UNDERFLOW;
             }
-            free(cf->pool_stack[--cf->pool_stack_size].as_ptr);
+            cf_arena_pop(&cf->pool_arena, cf->pool_stack[--cf->pool_stack_size].as_ptr);
             return STATUS_OK;
         case INST_PUSH_PTR:
             if (cf->pool_stack_size < 1) {
                 return STATUS_CALL_STACK_UNDERFLOW;
             }
-            if (cf->stack_size >= STACK_CAPACITY) {
-                return STATUS_STACK_UNDERFLOW;
+            if (cf->stack_size >= cf->stack_capacity) {
+                return STATUS_STACK_OVERFLOW;
             }
             cf->stack[cf->stack_size++].as_ptr = cf->pool_stack[cf->pool_stack_size - 1].as_ptr + inst.operand.as_u64;
             return STATUS_OK;
@@ -140,19 +277,20 @@ Status cf_execute_inst(CF_Machine *cf) {
             cf->stack_size -= 2;
             return STATUS_OK;
         case INST_DUP:
-            if (cf->stack_size < inst.operand.as_u64) {
+            if (cf->stack_size <= inst.operand.as_u64) {
                 return STATUS_STACK_UNDERFLOW;
             }
-            if (cf->stack_size > STACK_CAPACITY) {
+            if (cf->stack_size >= cf->stack_capacity) {
                 return STATUS_STACK_OVERFLOW;
             }
-            cf->stack[cf->stack_size++] = cf->stack[cf->stack_size - (1 + inst.operand.as_u64)];
+            cf->stack[cf->stack_size] = cf->stack[cf->stack_size - (1 + inst.operand.as_u64)];
+            cf->stack_size++;
             return STATUS_OK;
         case INST_PUSH_ARRAY:
             if (cf->stack_size < 1) {
                 return STATUS_STACK_UNDERFLOW;
             }
-            cf->stack[cf->stack_size - 1].as_ptr = malloc(cf->stack[cf->stack_size - 1].as_u64);
+            cf->stack[cf->stack_size - 1].as_ptr = cf_slab_alloc(&cf->heap, cf->stack[cf->stack_size - 1].as_u64);
             return STATUS_OK;
         case INST_LOAD_ARRAY:
             if (cf->stack_size < 2) {
@@ -208,7 +346,7 @@ Status cf_execute_inst(CF_Machine *cf) {
                 (cf)->stack[(cf)->stack_size - 2].as_f64 =
                         remainder((cf)->stack[(cf)->stack_size - 2].as_f64, (cf)->stack[(cf)->stack_size - 1].as_f64);
                 (cf)->stack_size--;
-                break;
+                return STATUS_OK;
             }
         case INST_UMOD:
             if (cf->stack[cf->stack_size - 1].as_u64 == 0) {
@@ -240,11 +378,11 @@ Status cf_execute_inst(CF_Machine *cf) {
         case INST_NOT: UNARY_OP(cf, u64, u64, !)
         case INST_ONES: UNARY_OP(cf, u64, u64, ~)
         case INST_INT:
-            if (interrupts[inst.operand.as_u64] == NULL) {
+            if (cf->runtime->interrupts[inst.operand.as_u64] == NULL) {
                 return STATUS_ILLEGAL_INTERRUPT;
             }
             PRINT_DEBUG("Interrupt %"PRIu64"\n", inst.operand.as_u64);
-            return interrupts[inst.operand.as_u64](cf);
+            return cf->runtime->interrupts[inst.operand.as_u64](cf);
         case INST_JMP:
             if (inst.operand.as_u64 >= CF_PROGRAM_SIZE(cf)) {
                 return STATUS_ILLEGAL_ACCESS;
@@ -274,7 +412,7 @@ Status cf_execute_inst(CF_Machine *cf) {
             }
             return STATUS_OK;
         case INST_CALL:
-            if (cf->stack_size >= STACK_CAPACITY || cf->stack_size + 1 >= STACK_CAPACITY) {
+            if (cf->stack_size + 1 >= cf->stack_capacity) {
                 return STATUS_STACK_OVERFLOW;
             }
             if (inst.operand.as_u64 >= CF_PROGRAM_SIZE(cf)) {
@@ -283,12 +421,13 @@ Status cf_execute_inst(CF_Machine *cf) {
             cf->stack[cf->stack_size++] = WORD_U64(cf->program_pool);
             cf->stack[cf->stack_size++] = WORD_U64(cf->program_counter);
             cf->program_counter = inst.operand.as_u64;
+            PROFILE_CALL(cf->program_pool, cf->program_counter);
             return STATUS_OK;
         case INST_VCALL:
             if (cf->stack_size < 2) {
                 return STATUS_STACK_UNDERFLOW;
             }
-            if (cf->stack[cf->stack_size - 2].as_u64 >= cf->library_size) {
+            if (cf->stack[cf->stack_size - 2].as_u64 >= cf->runtime->library_size) {
                 return STATUS_ILLEGAL_LIBRARY_INDEX;
             }
 
@@ -302,13 +441,14 @@ Status cf_execute_inst(CF_Machine *cf) {
             uint64_t newIC = cf->stack[cf->stack_size - 1].as_u64;
             cf->stack[cf->stack_size - 1] = WORD_U64(cf->program_counter);
             cf->program_counter = newIC;
+            PROFILE_CALL(cf->program_pool, newIC);
             return STATUS_OK;
         case INST_RET:
             if (cf->stack_size < 2) {
                 return STATUS_STACK_UNDERFLOW;
             }
 
-            if (cf->stack[cf->stack_size - 2].as_u64 >= cf->library_size) {
+            if (cf->stack[cf->stack_size - 2].as_u64 >= cf->runtime->library_size) {
                 return STATUS_ILLEGAL_LIBRARY_INDEX;
             }
             if (cf->stack[cf->stack_size - 2].as_u64 != cf->program_pool) {
@@ -320,6 +460,7 @@ Status cf_execute_inst(CF_Machine *cf) {
             }
             cf->program_counter = cf->stack[cf->stack_size - 1].as_u64;
             cf->stack_size -= 2;
+            PROFILE_RETURN();
             return STATUS_OK;
         case INST_ITU: CAST_OP(cf, i64, u64, (uint64_t))
         case INST_ITF: CAST_OP(cf, i64, f64, (double))
@@ -328,16 +469,258 @@ Status cf_execute_inst(CF_Machine *cf) {
         case INST_UTI: CAST_OP(cf, u64, i64, (int64_t))
         case INST_UTF: CAST_OP(cf, u64, f64, (double))
         case INST_LOAD_MEMORY:
-            if (cf->stack_size >= STACK_CAPACITY) {
+            if (cf->stack_size >= cf->stack_capacity) {
                 return STATUS_STACK_OVERFLOW;
             }
             PRINT_DEBUG("Load memory address %"PRIu64" of size %"PRIu64"\n", inst.operand.as_u64, CF_MEMORY_SIZE(cf));
             if (inst.operand.as_u64 >= CF_MEMORY_SIZE(cf)) {
                 return STATUS_ILLEGAL_ACCESS;
             }
-            cf->stack[cf->stack_size++] = WORD_PTR(cf->libraries[cf->program_pool].memory + inst.operand.as_u64);
+            cf->stack[cf->stack_size++] = WORD_PTR(CF_LIBRARY(cf)->memory + inst.operand.as_u64);
+            return STATUS_OK;
+        case INST_MEM_COPY:
+            if (cf->stack_size < 3) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            cf_memory_copy(cf->stack[cf->stack_size - 3].as_ptr, cf->stack[cf->stack_size - 2].as_ptr,
+                           cf->stack[cf->stack_size - 1].as_u64);
+            cf->stack_size -= 3;
+            return STATUS_OK;
+        case INST_MEM_FILL:
+            if (cf->stack_size < 3) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            cf_memory_fill(cf->stack[cf->stack_size - 3].as_ptr, (uint8_t) cf->stack[cf->stack_size - 1].as_u64,
+                           cf->stack[cf->stack_size - 2].as_u64);
+            cf->stack_size -= 3;
+            return STATUS_OK;
+        case INST_MEM_COMPARE:
+            if (cf->stack_size < 3) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            cf->stack[cf->stack_size - 3] = WORD_I64(
+                    cf_memory_compare(cf->stack[cf->stack_size - 3].as_ptr, cf->stack[cf->stack_size - 2].as_ptr,
+                                      cf->stack[cf->stack_size - 1].as_u64));
+            cf->stack_size -= 2;
+            return STATUS_OK;
+        case INST_MEM_FIND:
+            if (cf->stack_size < 3) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            cf->stack[cf->stack_size - 3] = WORD_I64(
+                    cf_memory_find(cf->stack[cf->stack_size - 3].as_ptr, (uint8_t) cf->stack[cf->stack_size - 1].as_u64,
+                                   cf->stack[cf->stack_size - 2].as_u64));
+            cf->stack_size -= 2;
+            return STATUS_OK;
+        case INST_VADD:
+        case INST_VSUB:
+        case INST_VMUL:
+        case INST_VFMA:
+        case INST_VMIN:
+        case INST_VMAX:
+            if (cf->stack_size < 4) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (inst.operand.as_u64 >= VECTOR_TYPES) {
+                return STATUS_ILLEGAL_OPCODE;
+            }
+            cf_vector_map(inst.opcode, (uint8_t) inst.operand.as_u64, cf->stack[cf->stack_size - 4].as_ptr,
+                          cf->stack[cf->stack_size - 3].as_ptr, cf->stack[cf->stack_size - 2].as_ptr,
+                          cf->stack[cf->stack_size - 1].as_u64);
+            cf->stack_size -= 4;
+            return STATUS_OK;
+        case INST_VSUM:
+            if (cf->stack_size < 2) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (inst.operand.as_u64 >= VECTOR_TYPES) {
+                return STATUS_ILLEGAL_OPCODE;
+            }
+            cf->stack[cf->stack_size - 2] = cf_vector_sum((uint8_t) inst.operand.as_u64,
+                                                          cf->stack[cf->stack_size - 2].as_ptr,
+                                                          cf->stack[cf->stack_size - 1].as_u64);
+            cf->stack_size--;
+            return STATUS_OK;
+        case INST_VDOT:
+            if (cf->stack_size < 3) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (inst.operand.as_u64 >= VECTOR_TYPES) {
+                return STATUS_ILLEGAL_OPCODE;
+            }
+            cf->stack[cf->stack_size - 3] = cf_vector_dot((uint8_t) inst.operand.as_u64,
+                                                          cf->stack[cf->stack_size - 3].as_ptr,
+                                                          cf->stack[cf->stack_size - 2].as_ptr,
+                                                          cf->stack[cf->stack_size - 1].as_u64);
+            cf->stack_size -= 2;
+            return STATUS_OK;
+        case INST_LOAD_SIZED:
+            if (cf->stack_size >= cf->stack_capacity) {
+                return STATUS_STACK_OVERFLOW;
+            }
+            cf->stack[cf->stack_size++] = read_pool_n(cf, inst.operand, WORD_U64(inst.argument));
+            cf->program_counter++;
+            return STATUS_OK;
+        case INST_STORE_SIZED:
+            if (cf->stack_size < 1) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (cf->stack_size >= cf->stack_capacity) {
+                return STATUS_STACK_OVERFLOW;
+            }
+            write_pool_n(cf, inst.operand, cf->stack[cf->stack_size - 1], WORD_U64(inst.argument));
+            cf->stack_size--;
+            cf->program_counter++;
+            return STATUS_OK;
+        case INST_PUSH_IADD:
+            if (cf->stack_size < 1) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (cf->stack_size >= cf->stack_capacity) {
+                return STATUS_STACK_OVERFLOW;
+            }
+            cf->stack[cf->stack_size - 1].as_i64 += inst.operand.as_i64;
+            cf->program_counter++;
+            return STATUS_OK;
+        case INST_PUSH_ISUB:
+            if (cf->stack_size < 1) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (cf->stack_size >= cf->stack_capacity) {
+                return STATUS_STACK_OVERFLOW;
+            }
+            cf->stack[cf->stack_size - 1].as_i64 -= inst.operand.as_i64;
+            cf->program_counter++;
+            return STATUS_OK;
+        case INST_ILESS_JMP_ZERO:
+            if (cf->stack_size < 2) {
+                return STATUS_STACK_UNDERFLOW;
+            }
+            if (inst.operand.as_u64 >= CF_PROGRAM_SIZE(cf)) {
+                return STATUS_ILLEGAL_ACCESS;
+            }
+            cf->stack_size -= 2;
+            if (cf->stack[cf->stack_size].as_i64 < cf->stack[cf->stack_size + 1].as_i64) {
+                cf->program_counter++;
+            } else {
+                cf->program_counter = inst.operand.as_u64;
+            }
             return STATUS_OK;
     }
 
     return STATUS_ILLEGAL_OPCODE;
 }
+
+#ifdef THREADED_DISPATCH
+
+// Grows the cache table of the machine to the VCALL sites of all libraries of the runtime, returns NULL if the table
+// could not be allocated
+static CF_CallCache *grow_call_caches(CF_Machine *cf, uint64_t site) {
+    uint64_t size = atomic_load(&cf->runtime->call_cache_size);
+    if (site >= size) {
+        return NULL;
+    }
+    CF_CallCache *caches = realloc(cf->call_caches, size * sizeof(CF_CallCache));
+    if (caches == NULL) {
+        return NULL;
+    }
+    // A generation of 0 never matches, the runtime counts one up for its first library
+    memset(caches + cf->call_cache_size, 0, (size - cf->call_cache_size) * sizeof(CF_CallCache));
+    cf->call_caches = caches;
+    cf->call_cache_size = size;
+    return &caches[site];
+}
+
+// Direct-threaded engine. Program counter, stack size and the active library's program are kept in locals and are
+// only written back to the machine when execution leaves the loop or an interrupt needs to observe the machine.
+// The engine body lives in dispatch.h and is instantiated twice: a checked variant for libraries that failed
+// verification and a variant for verified libraries that relies on the annotations of cf_verify_program.
+
+#define SAVE_STATE()                                                                             \
+do {                                                                                             \
+    SPILL();                                                                                     \
+    cf->program_counter = pc;                                                                    \
+    cf->stack_size = sp;                                                                         \
+} while (0)
+
+// Caches the parts of the active library the engine needs, only VCALL and RET change the active library
+#define ENTER_LIBRARY(value)                                                                     \
+do {                                                                                             \
+    library = (value);                                                                           \
+    program = library->program;                                                                  \
+    program_size = library->program_size;                                                        \
+    memory = library->memory;                                                                    \
+    memory_size = library->memory_size;                                                          \
+} while (0)
+
+#define LOAD_STATE()                                                                             \
+do {                                                                                             \
+    ENTER_LIBRARY(cf_runtime_library(cf->runtime, cf->program_pool));                            \
+    pc = cf->program_counter;                                                                    \
+    sp = cf->stack_size;                                                                         \
+    FILL();                                                                                      \
+} while (0)
+
+#define FAIL(value)                                                                              \
+do {                                                                                             \
+    status = (value);                                                                            \
+    goto halt;                                                                                   \
+} while (0)
+
+#define ENGINE_NAME run_checked
+#define ENGINE_VERIFIED 0
+#include "dispatch.h"
+#undef ENGINE_NAME
+#undef ENGINE_VERIFIED
+
+#define ENGINE_NAME run_verified
+#define ENGINE_VERIFIED 1
+#include "dispatch.h"
+#undef ENGINE_NAME
+#undef ENGINE_VERIFIED
+
+Status cf_run(CF_Machine *cf, uint64_t max_steps) {
+    uint64_t steps = max_steps == 0 ? UINT64_MAX : max_steps;
+    Status status;
+
+#ifdef CF_GUARD_PAGES
+    CF_GuardScope scope;
+    cf_guard_enter(&scope, cf);
+    if (setjmp(scope.jump) != 0) {
+        cf_guard_leave(&scope);
+        return scope.status;
+    }
+#endif
+
+    // The engines return STATUS_OK with steps left whenever control moves into a library of the other kind
+    do {
+        const CF_Library *library = cf_runtime_library(cf->runtime, cf->program_pool);
+        if (library->jit != NULL) {
+            status = cf_jit_run(cf, &steps);
+        } else if (library->verified) {
+            status = run_verified(cf, &steps);
+        } else {
+            status = run_checked(cf, &steps);
+        }
+    } while (status == STATUS_OK && steps != 0);
+
+#ifdef CF_GUARD_PAGES
+    cf_guard_leave(&scope);
+#endif
+    return status;
+}
+
+#else
+
+Status cf_run(CF_Machine *cf, uint64_t max_steps) {
+    Status status;
+    uint64_t steps = max_steps == 0 ? UINT64_MAX : max_steps;
+
+    do {
+        status = cf_execute_inst(cf);
+    } while (status == STATUS_OK && --steps != 0);
+
+    return status;
+}
+
+#endif
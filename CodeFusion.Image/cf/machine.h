@@ -4,13 +4,21 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdatomic.h>
 #include "hashmap.h"
+#include "arena.h"
+#include "slab.h"
 
-#define STACK_CAPACITY 1024
-#define PROGRAM_CAPACITY 1024
-#define CALLSTACK_CAPACITY 1024
+// Default number of entries of the operand stack and the pool stack, see cf_create_stacks
+#define STACK_CAPACITY (64 * 1024)
+#define CALLSTACK_CAPACITY (64 * 1024)
 #define INTERRUPT_CAPACITY 255
-#define LIBRARY_CAPACITY 255
+// Upper bound of loaded libraries, the table itself grows on demand
+#define LIBRARY_CAPACITY 65535
+// Libraries are stored in chunks that never move, so a machine can keep a pointer to a library while another thread
+// adds one
+#define LIBRARY_CHUNK_SIZE 64
+#define LIBRARY_CHUNKS ((LIBRARY_CAPACITY + LIBRARY_CHUNK_SIZE - 1) / LIBRARY_CHUNK_SIZE)
 
 #define WORD_U64(value) ((Word){.as_u64 = value})
 #define WORD_I64(value) ((Word){.as_i64 = value})
@@ -26,10 +34,17 @@ typedef union {
 
 typedef struct {
     uint8_t opcode;
+    // Filled in by cf_verify_program: stack entries needed and additional stack entries used by the instructions
+    // from this one up to the next branch
+    uint16_t stack_need;
+    uint16_t stack_grow;
+    // Second immediate of superinstructions produced by cf_fuse_program
+    uint16_t argument;
     Word operand;
 } Inst;
 
 static_assert(sizeof(Word) == 8, "Size of Word must be 64Bit aka. 8Bytes");
+static_assert(sizeof(Inst) == 16, "Size of Inst must be 16Bytes");
 static_assert(LIBRARY_CAPACITY <= (65535) && LIBRARY_CAPACITY > 1,
               "LIBRARY_CAPACITY must fit in a unsigned short (65535) and must be greater than 1");
 
@@ -38,35 +53,50 @@ typedef struct {
     uint64_t address;
 } CF_Symbol;
 
+struct CF_Library;
+struct CF_JitCode;
+
+// Monomorphic inline cache of a VCALL site. It remembers the last (library, address) pair the site called together
+// with the validated target library and is valid as long as the library generation of the runtime is unchanged.
 typedef struct {
-    Inst program[PROGRAM_CAPACITY];
+    uint64_t generation;
+    uint64_t library;
+    uint64_t target;
+    struct CF_Library *entry;
+} CF_CallCache;
+
+typedef struct CF_Library {
+    Inst *program;
     uint64_t program_size;
+    uint8_t verified;
+
+    // Number of VCALL sites, the operand of a VCALL is the index of its site. The caches of the sites belong to the
+    // machines, the sites of the library are numbered from call_cache_base in the cache table of a machine.
+    uint64_t call_cache_size;
+    uint64_t call_cache_base;
 
     HashMap *address_pool;
 
     CF_Symbol *symbols;
     uint32_t symbol_size;
+    // Open addressing index over the symbol names built by cf_load_symbols, a slot holds the position of the symbol
+    // plus one and 0 marks an empty slot
+    uint32_t *symbol_index;
+    uint32_t symbol_index_size;
 
     void *memory;
     uint64_t memory_size;
 
     const char *path;
     void *handler;
-} CF_Library;
-
-typedef struct {
-    Word stack[STACK_CAPACITY];
-    uint64_t stack_size;
-
-    Word pool_stack[CALLSTACK_CAPACITY];
-    uint64_t pool_stack_size;
+    // Closes the handler when the runtime is destroyed, set by the loader that opened it
+    void (*release)(struct CF_Library *library);
 
-    uint64_t program_counter;
-    uint16_t program_pool;
-
-    CF_Library libraries[LIBRARY_CAPACITY];
-    uint64_t library_size;
-} CF_Machine;
+    // Native code produced by cf_jit_compile, NULL for interpreted libraries
+    struct CF_JitCode *jit;
+    // Set for libraries of a restored snapshot, their program, pool, symbols and memory lie in the mapped image
+    uint8_t mapped;
+} CF_Library;
 
 typedef enum {
     STATUS_OK,
@@ -82,10 +112,91 @@ typedef enum {
     STATUS_ILLEGAL_LIBRARY_INDEX,
     STATUS_LIBRARY_OVERFLOW,
     STATUS_SYMBOL_NOT_FOUND,
+    // Not a failure: an interrupt suspended the task of the machine, see scheduler.h
+    STATUS_YIELD,
 } Status;
 
-typedef Status (*CF_Interrupt)(CF_Machine *);
+struct CF_Machine;
+
+typedef Status (*CF_Interrupt)(struct CF_Machine *);
+
+// State shared by all machines running the same programs: the interrupt table and the loaded libraries. Program
+// images are read-only once added, so any number of machines can run them on different threads. Adding and unloading
+// libraries takes the lock, machines read the table without it.
+typedef struct CF_Runtime {
+    CF_Interrupt interrupts[INTERRUPT_CAPACITY];
+
+    CF_Library *library_chunks[LIBRARY_CHUNKS];
+    // Stored after the library is written, so a machine that sees the size sees the library
+    _Atomic uint64_t library_size;
+    // Changes whenever a library is added or unloaded, invalidates every CF_CallCache
+    _Atomic uint64_t library_generation;
+    // VCALL sites of all added libraries, the size of a complete cache table
+    _Atomic uint64_t call_cache_size;
+    atomic_flag lock;
+    // Translate libraries to native code when they are added, see jit.h
+    uint8_t jit;
+    // Created by the first spawn, see scheduler.h
+    _Atomic(struct CF_Scheduler *) scheduler;
+    // Identifies the programs the runtime was started with, a snapshot is only restored by a runtime with the same
+    // key, see snapshot.h
+    uint64_t snapshot_key;
+} CF_Runtime;
+
+typedef struct CF_Machine {
+    Word *stack;
+    uint64_t stack_size;
+    uint64_t stack_capacity;
+
+    Word *pool_stack;
+    uint64_t pool_stack_size;
+    uint64_t pool_stack_capacity;
+    CF_Arena pool_arena;
+
+    uint64_t program_counter;
+    uint16_t program_pool;
+
+    CF_Runtime *runtime;
+    // Inline caches of the VCALL sites of every library, grown when a VCALL site past its end runs
+    CF_CallCache *call_caches;
+    uint64_t call_cache_size;
+
+    // Task the machine runs, NULL for a machine that is run directly
+    struct CF_Task *task;
+    // Buffer of the bulk write interrupt, allocated by the first write, see output.h
+    struct CF_Output *output;
+    // Statistics of the arrays of PUSHARRAY and the malloc interrupt, see slab.h
+    CF_HeapStats heap;
+} CF_Machine;
+
+static inline CF_Library *cf_runtime_library(const CF_Runtime *runtime, uint64_t index) {
+    return &runtime->library_chunks[index / LIBRARY_CHUNK_SIZE][index % LIBRARY_CHUNK_SIZE];
+}
+
+// Creates a runtime without libraries and with an empty interrupt table, see cf_install_interrupts
+CF_Runtime *cf_runtime_create(void);
+
+// Releases the runtime and every library added to it, no machine may run on it anymore
+void cf_runtime_destroy(CF_Runtime *runtime);
+
+// Appends a library to the library table of the runtime and stores its index in index. The runtime owns the library
+// from then on. Safe to call while machines run on other threads.
+Status cf_runtime_add_library(CF_Runtime *runtime, CF_Library library, uint64_t *index);
+
+// Makes a library unreachable, VCALL and RET into it fail from then on. Other machines may still run code of it, so
+// the image is only released by cf_runtime_destroy.
+Status cf_runtime_unload_library(CF_Runtime *runtime, uint64_t index);
+
+// Creates a machine with its own stacks on the runtime. Capacities of 0 are taken as described at cf_create_stacks.
+Status cf_machine_create(CF_Runtime *runtime, uint64_t stack_capacity, uint64_t pool_stack_capacity,
+                         CF_Machine **machine);
+
+void cf_machine_destroy(CF_Machine *cf);
 
 Status cf_execute_inst(CF_Machine *cf);
 
+// Executes at most max_steps instructions (0 means no limit) and returns the first status that is not STATUS_OK,
+// or STATUS_OK if the step budget is used up
+Status cf_run(CF_Machine *cf, uint64_t max_steps);
+
 #endif
@@ -0,0 +1,155 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "memops.h"
+
+#ifdef CF_MEMOPS_SIMD
+#include <immintrin.h>
+#endif
+
+typedef int64_t (*CompareKernel)(const uint8_t *a, const uint8_t *b, uint64_t size);
+typedef int64_t (*FindKernel)(const uint8_t *data, uint8_t value, uint64_t size);
+
+static int64_t compare_from(const uint8_t *a, const uint8_t *b, uint64_t i, uint64_t size) {
+    for (; i < size; i++) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static int64_t find_from(const uint8_t *data, uint8_t value, uint64_t i, uint64_t size) {
+    for (; i < size; i++) {
+        if (data[i] == value) {
+            return (int64_t) i;
+        }
+    }
+    return -1;
+}
+
+#ifdef CF_MEMOPS_SIMD
+
+// The kernels compare a vector at a time and take the position of the first hit from the byte mask of the result.
+// The bytes behind the last whole vector are handled one by one.
+
+static int64_t compare_sse2(const uint8_t *a, const uint8_t *b, uint64_t size) {
+    uint64_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                       _mm_loadu_si128((const __m128i *) (b + i)));
+        uint32_t differ = (uint32_t) _mm_movemask_epi8(equal) ^ 0xFFFFu;
+        if (differ != 0) {
+            i += (uint64_t) __builtin_ctz(differ);
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return compare_from(a, b, i, size);
+}
+
+static int64_t find_sse2(const uint8_t *data, uint8_t value, uint64_t size) {
+    __m128i pattern = _mm_set1_epi8((char) value);
+    uint64_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i)), pattern);
+        uint32_t found = (uint32_t) _mm_movemask_epi8(equal);
+        if (found != 0) {
+            return (int64_t) (i + (uint64_t) __builtin_ctz(found));
+        }
+    }
+    return find_from(data, value, i, size);
+}
+
+__attribute__((target("avx2")))
+static int64_t compare_avx2(const uint8_t *a, const uint8_t *b, uint64_t size) {
+    uint64_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                          _mm256_loadu_si256((const __m256i *) (b + i)));
+        uint32_t differ = ~(uint32_t) _mm256_movemask_epi8(equal);
+        if (differ != 0) {
+            i += (uint64_t) __builtin_ctz(differ);
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return compare_sse2(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static int64_t find_avx2(const uint8_t *data, uint8_t value, uint64_t size) {
+    __m256i pattern = _mm256_set1_epi8((char) value);
+    uint64_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + i)), pattern);
+        uint32_t found = (uint32_t) _mm256_movemask_epi8(equal);
+        if (found != 0) {
+            return (int64_t) (i + (uint64_t) __builtin_ctz(found));
+        }
+    }
+    int64_t rest = find_sse2(data + i, value, size - i);
+    return rest < 0 ? -1 : (int64_t) i + rest;
+}
+
+static int has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static int64_t compare_resolve(const uint8_t *a, const uint8_t *b, uint64_t size);
+static int64_t find_resolve(const uint8_t *data, uint8_t value, uint64_t size);
+
+// Start with the resolvers, which store the kernel for the processor and run it. Threads racing on the first call
+// store the same kernel.
+static _Atomic(CompareKernel) compare_kernel = compare_resolve;
+static _Atomic(FindKernel) find_kernel = find_resolve;
+
+static int64_t compare_resolve(const uint8_t *a, const uint8_t *b, uint64_t size) {
+    CompareKernel kernel = has_avx2() ? compare_avx2 : compare_sse2;
+    atomic_store_explicit(&compare_kernel, kernel, memory_order_relaxed);
+    return kernel(a, b, size);
+}
+
+static int64_t find_resolve(const uint8_t *data, uint8_t value, uint64_t size) {
+    FindKernel kernel = has_avx2() ? find_avx2 : find_sse2;
+    atomic_store_explicit(&find_kernel, kernel, memory_order_relaxed);
+    return kernel(data, value, size);
+}
+
+#else
+
+static int64_t compare_portable(const uint8_t *a, const uint8_t *b, uint64_t size) {
+    int result = memcmp(a, b, size);
+    return result < 0 ? -1 : result > 0;
+}
+
+static int64_t find_portable(const uint8_t *data, uint8_t value, uint64_t size) {
+    const uint8_t *found = memchr(data, value, size);
+    return found == NULL ? -1 : found - data;
+}
+
+static _Atomic(CompareKernel) compare_kernel = compare_portable;
+static _Atomic(FindKernel) find_kernel = find_portable;
+
+#endif
+
+void cf_memory_copy(void *dst, const void *src, uint64_t size) {
+    memmove(dst, src, size);
+}
+
+void cf_memory_fill(void *dst, uint8_t value, uint64_t size) {
+    memset(dst, value, size);
+}
+
+int64_t cf_memory_compare(const void *a, const void *b, uint64_t size) {
+    // Short ranges are done before a vector would be full
+    if (size < 16) {
+        return compare_from(a, b, 0, size);
+    }
+    return atomic_load_explicit(&compare_kernel, memory_order_relaxed)(a, b, size);
+}
+
+int64_t cf_memory_find(const void *data, uint8_t value, uint64_t size) {
+    if (size < 16) {
+        return find_from(data, value, 0, size);
+    }
+    return atomic_load_explicit(&find_kernel, memory_order_relaxed)(data, value, size);
+}
@@ -0,0 +1,25 @@
+#ifndef CF_MEMOPS_H
+#define CF_MEMOPS_H
+
+#include <inttypes.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// Comparing and searching use SSE2 or AVX2 kernels, picked by the first call after asking the processor
+#define CF_MEMOPS_SIMD
+#endif
+
+// Kernels of the bulk memory instructions MEMCOPY, MEMFILL, MEMCOMPARE and MEMFIND. Copying and filling are left to
+// memmove and memset, the C library already picks the fastest variant for the processor.
+
+// Copies size bytes from src to dst, the ranges may overlap
+void cf_memory_copy(void *dst, const void *src, uint64_t size);
+
+void cf_memory_fill(void *dst, uint8_t value, uint64_t size);
+
+// Returns -1, 0 or 1 as the first size bytes of a are less than, equal to or greater than those of b
+int64_t cf_memory_compare(const void *a, const void *b, uint64_t size);
+
+// Returns the index of the first byte equal to value within size bytes of data or -1 if there is none
+int64_t cf_memory_find(const void *data, uint8_t value, uint64_t size);
+
+#endif
@@ -18,6 +18,14 @@ int cf_inst_has_operand(uint8_t opcode) {
         case INST_JMP_NOT_ZERO:
         case INST_CALL:
         case INST_LOAD_MEMORY:
+        case INST_VADD:
+        case INST_VSUB:
+        case INST_VMUL:
+        case INST_VFMA:
+        case INST_VMIN:
+        case INST_VMAX:
+        case INST_VSUM:
+        case INST_VDOT:
             return 1;
         default:
             return 0;
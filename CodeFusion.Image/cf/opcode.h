@@ -70,6 +70,25 @@
 #define INST_UTI ((uint8_t)65)
 #define INST_UTF ((uint8_t)66)
 #define INST_LOAD_MEMORY ((uint8_t)67)
+#define INST_MEM_COPY ((uint8_t)68)
+#define INST_MEM_FILL ((uint8_t)69)
+#define INST_MEM_COMPARE ((uint8_t)70)
+#define INST_MEM_FIND ((uint8_t)71)
+#define INST_VADD ((uint8_t)72)
+#define INST_VSUB ((uint8_t)73)
+#define INST_VMUL ((uint8_t)74)
+#define INST_VFMA ((uint8_t)75)
+#define INST_VMIN ((uint8_t)76)
+#define INST_VMAX ((uint8_t)77)
+#define INST_VSUM ((uint8_t)78)
+#define INST_VDOT ((uint8_t)79)
+
+// Superinstructions created by cf_fuse_program, they only exist in memory and are never part of a .bin file
+#define INST_LOAD_SIZED ((uint8_t)128)
+#define INST_STORE_SIZED ((uint8_t)129)
+#define INST_PUSH_IADD ((uint8_t)130)
+#define INST_PUSH_ISUB ((uint8_t)131)
+#define INST_ILESS_JMP_ZERO ((uint8_t)132)
 
 int cf_inst_has_operand(uint8_t opcode);
 
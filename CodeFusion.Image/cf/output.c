@@ -0,0 +1,118 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "reactor.h"
+
+#ifdef CF_OUTPUT
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Writes all pieces, advancing them past what went out. Descriptors opened by the asynchronous interrupts are
+// non-blocking, the thread waits for them here because a half written buffer cannot be handed back to the program.
+static int write_all(int fd, struct iovec *pieces, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, pieces, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                cf_reactor_block(fd, REACTOR_WRITE);
+                continue;
+            }
+            return 0;
+        }
+
+        size_t left = (size_t) written;
+        while (count > 0 && left >= pieces->iov_len) {
+            left -= pieces->iov_len;
+            pieces++;
+            count--;
+        }
+        if (count > 0) {
+            pieces->iov_base = (uint8_t *) pieces->iov_base + left;
+            pieces->iov_len -= left;
+        }
+    }
+    return 1;
+}
+
+int cf_output_write(CF_Machine *cf, int fd, const void *data, uint64_t size) {
+    CF_Output *output = cf->output;
+    if (output == NULL) {
+        output = malloc(sizeof(CF_Output));
+        if (output == NULL) {
+            fflush(NULL);
+            struct iovec piece = {.iov_base = (void *) data, .iov_len = size};
+            return write_all(fd, &piece, 1);
+        }
+        output->fd = fd;
+        output->size = 0;
+        cf->output = output;
+    }
+
+    if (output->fd != fd && !cf_output_flush(cf)) {
+        return 0;
+    }
+    output->fd = fd;
+    // Bytes the write interrupt left in a stdio buffer were written before these ones
+    if (output->size == 0) {
+        fflush(NULL);
+    }
+    if (output->size + size <= OUTPUT_BUFFER_SIZE) {
+        memcpy(output->data + output->size, data, size);
+        output->size += size;
+        return 1;
+    }
+
+    // The buffered bytes and the new ones go out with one call, the new ones are not copied
+    struct iovec pieces[2] = {
+            {.iov_base = output->data, .iov_len = output->size},
+            {.iov_base = (void *) data, .iov_len = size},
+    };
+    output->size = 0;
+    return write_all(fd, pieces, 2);
+}
+
+int cf_output_sync(CF_Machine *cf, FILE *file) {
+    CF_Output *output = cf->output;
+    if (output == NULL || output->size == 0 || output->fd != fileno(file)) {
+        return 1;
+    }
+    return cf_output_flush(cf);
+}
+
+int cf_output_flush(CF_Machine *cf) {
+    CF_Output *output = cf->output;
+    if (output == NULL || output->size == 0) {
+        return 1;
+    }
+    struct iovec piece = {.iov_base = output->data, .iov_len = output->size};
+    output->size = 0;
+    return write_all(output->fd, &piece, 1);
+}
+
+#else
+
+int cf_output_write(CF_Machine *cf, int fd, const void *data, uint64_t size) {
+    (void) cf;
+    (void) fd;
+    (void) data;
+    (void) size;
+    return 0;
+}
+
+int cf_output_sync(CF_Machine *cf, FILE *file) {
+    (void) cf;
+    (void) file;
+    return 1;
+}
+
+int cf_output_flush(CF_Machine *cf) {
+    (void) cf;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef CF_OUTPUT_H
+#define CF_OUTPUT_H
+
+#include <stdio.h>
+#include "machine.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+// Output is buffered per machine and written with writev, without it the bulk I/O interrupts are not installed
+#define CF_OUTPUT
+#endif
+
+// Bytes a machine buffers before they are written, larger writes go out directly together with the buffered bytes
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Output buffer of a machine. It holds the bytes of one descriptor, writing to another one flushes it first. Writes
+// through stdio keep their order with the buffered ones: the buffer flushes the stdio streams before it starts to
+// fill and the write interrupt calls cf_output_sync before it writes to a stream.
+typedef struct CF_Output {
+    int fd;
+    uint64_t size;
+    uint8_t data[OUTPUT_BUFFER_SIZE];
+} CF_Output;
+
+// Appends the bytes to the output buffer of the machine, the buffer is allocated by the first write. Returns 0 if
+// writing failed, the buffer is empty afterwards in any case.
+int cf_output_write(CF_Machine *cf, int fd, const void *data, uint64_t size);
+
+// Writes the buffered bytes of the machine if they belong to the descriptor of file, returns 0 if that failed
+int cf_output_sync(CF_Machine *cf, FILE *file);
+
+// Writes the buffered bytes of the machine, returns 0 if that failed. Called by cf_machine_destroy, before the exit
+// interrupt ends the process and when a task ends.
+int cf_output_flush(CF_Machine *cf);
+
+#endif
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "opcode.h"
+#include "symbolize.h"
+
+#ifdef CF_PROFILE
+
+#define NO_NODE UINT32_MAX
+
+// Node of the calling context tree, one per distinct chain of called functions
+typedef struct {
+    uint64_t library;
+    uint64_t start;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint64_t count;
+} ProfileNode;
+
+// Dispatch counts per program counter of one library. The program pointer tells if the slot still belongs to the
+// library that was counted, an unloaded library can be replaced by a new one.
+typedef struct {
+    const Inst *program;
+    uint64_t size;
+    uint64_t *counts;
+} ProfileLibrary;
+
+static CF_Machine *machine = NULL;
+static uint64_t total = 0;
+static uint64_t opcode_counts[256] = {0};
+
+static ProfileLibrary *libraries = NULL;
+static size_t library_size = 0;
+
+static ProfileNode *nodes = NULL;
+static uint32_t node_size = 0;
+static uint32_t node_capacity = 0;
+static uint32_t current = NO_NODE;
+
+static const char *opcode_names[256] = {
+        [INST_NOP] = "nop",
+        [INST_PUSH] = "push",
+        [INST_POP] = "pop",
+        [INST_LOAD] = "load",
+        [INST_STORE] = "store",
+        [INST_MALLOC_POOL] = "mallocpool",
+        [INST_FREE_POOL] = "freepool",
+        [INST_PUSH_PTR] = "pushptr",
+        [INST_LOAD_PTR] = "loadptr",
+        [INST_STORE_PTR] = "storeptr",
+        [INST_DUP] = "dup",
+        [INST_PUSH_ARRAY] = "pusharray",
+        [INST_LOAD_ARRAY] = "loadarray",
+        [INST_STORE_ARRAY] = "storearray",
+        [INST_IADD] = "iadd",
+        [INST_FADD] = "fadd",
+        [INST_UADD] = "uadd",
+        [INST_ISUB] = "isub",
+        [INST_FSUB] = "fsub",
+        [INST_USUB] = "usub",
+        [INST_IMUL] = "imul",
+        [INST_FMUL] = "fmul",
+        [INST_UMUL] = "umul",
+        [INST_IDIV] = "idiv",
+        [INST_FDIV] = "fdiv",
+        [INST_UDIV] = "udiv",
+        [INST_IMOD] = "imod",
+        [INST_FMOD] = "fmod",
+        [INST_UMOD] = "umod",
+        [INST_ILESS] = "ile",
+        [INST_FLESS] = "fle",
+        [INST_ULESS] = "ule",
+        [INST_ILESS_EQUAL] = "ileq",
+        [INST_FLESS_EQUAL] = "fleq",
+        [INST_ULESS_EQUAL] = "uleq",
+        [INST_IGREATER] = "ige",
+        [INST_FGREATER] = "fge",
+        [INST_UGREATER] = "uge",
+        [INST_IGREATER_EQUALS] = "igeq",
+        [INST_FGREATER_EQUALS] = "fgeq",
+        [INST_UGREATER_EQUALS] = "ugeq",
+        [INST_EQ] = "eq",
+        [INST_NEQ] = "neq",
+        [INST_AND] = "and",
+        [INST_OR] = "or",
+        [INST_XOR] = "xor",
+        [INST_LSHIFT] = "lshift",
+        [INST_RSHIFT] = "rshift",
+        [INST_INEG] = "ineg",
+        [INST_FNEG] = "fneg",
+        [INST_UNEG] = "uneg",
+        [INST_NOT] = "not",
+        [INST_ONES] = "ones",
+        [INST_INT] = "int",
+        [INST_JMP] = "jmp",
+        [INST_JMP_ZERO] = "jmpz",
+        [INST_JMP_NOT_ZERO] = "jmpnz",
+        [INST_CALL] = "call",
+        [INST_VCALL] = "vcall",
+        [INST_RET] = "ret",
+        [INST_ITU] = "itu",
+        [INST_ITF] = "itf",
+        [INST_FTI] = "fti",
+        [INST_FTU] = "ftu",
+        [INST_UTI] = "uti",
+        [INST_UTF] = "utf",
+        [INST_LOAD_MEMORY] = "loadmemory",
+        [INST_MEM_COPY] = "memcopy",
+        [INST_MEM_FILL] = "memfill",
+        [INST_MEM_COMPARE] = "memcompare",
+        [INST_MEM_FIND] = "memfind",
+        [INST_VADD] = "vadd",
+        [INST_VSUB] = "vsub",
+        [INST_VMUL] = "vmul",
+        [INST_VFMA] = "vfma",
+        [INST_VMIN] = "vmin",
+        [INST_VMAX] = "vmax",
+        [INST_VSUM] = "vsum",
+        [INST_VDOT] = "vdot",
+        [INST_LOAD_SIZED] = "load_sized",
+        [INST_STORE_SIZED] = "store_sized",
+        [INST_PUSH_IADD] = "push_iadd",
+        [INST_PUSH_ISUB] = "push_isub",
+        [INST_ILESS_JMP_ZERO] = "ile_jmpz",
+};
+
+static void write_profile(void);
+
+static uint32_t add_node(uint64_t library, uint64_t start, uint32_t parent) {
+    if (node_size == node_capacity) {
+        uint32_t capacity = node_capacity == 0 ? 64 : node_capacity * 2;
+        ProfileNode *grown = realloc(nodes, capacity * sizeof(ProfileNode));
+        if (grown == NULL) {
+            return NO_NODE;
+        }
+        nodes = grown;
+        node_capacity = capacity;
+    }
+
+    nodes[node_size] = (ProfileNode) {
+            .library = library, .start = start, .parent = parent, .first_child = NO_NODE, .next_sibling = NO_NODE
+    };
+    if (parent != NO_NODE) {
+        nodes[node_size].next_sibling = nodes[parent].first_child;
+        nodes[parent].first_child = node_size;
+    }
+    return node_size++;
+}
+
+void cf_profile_start(CF_Machine *cf) {
+    machine = cf;
+    current = add_node(cf->program_pool, cf->program_counter, NO_NODE);
+    atexit(write_profile);
+}
+
+static ProfileLibrary *profile_library(const CF_Machine *cf) {
+    uint64_t index = cf->program_pool;
+    if (index >= library_size) {
+        size_t size = index + 1;
+        ProfileLibrary *grown = realloc(libraries, size * sizeof(ProfileLibrary));
+        if (grown == NULL) {
+            return NULL;
+        }
+        memset(grown + library_size, 0, (size - library_size) * sizeof(ProfileLibrary));
+        libraries = grown;
+        library_size = size;
+    }
+
+    ProfileLibrary *library = &libraries[index];
+    const CF_Library *source = cf_runtime_library(cf->runtime, index);
+    if (library->program != source->program) {
+        free(library->counts);
+        library->program = source->program;
+        library->size = source->program_size;
+        library->counts = calloc(source->program_size, sizeof(uint64_t));
+    }
+    return library;
+}
+
+void cf_profile_step(const CF_Machine *cf, uint64_t pc, uint8_t opcode) {
+    total++;
+    opcode_counts[opcode]++;
+    ProfileLibrary *library = profile_library(cf);
+    if (library != NULL && library->counts != NULL && pc < library->size) {
+        library->counts[pc]++;
+    }
+    if (current != NO_NODE) {
+        nodes[current].count++;
+    }
+}
+
+void cf_profile_call(uint64_t library, uint64_t target) {
+    if (current == NO_NODE) {
+        return;
+    }
+    for (uint32_t child = nodes[current].first_child; child != NO_NODE; child = nodes[child].next_sibling) {
+        if (nodes[child].library == library && nodes[child].start == target) {
+            current = child;
+            return;
+        }
+    }
+    uint32_t child = add_node(library, target, current);
+    if (child != NO_NODE) {
+        current = child;
+    }
+}
+
+void cf_profile_return(void) {
+    // A return out of the root, e.g. from a function the profile started in, keeps counting at the root
+    if (current != NO_NODE && nodes[current].parent != NO_NODE) {
+        current = nodes[current].parent;
+    }
+}
+
+static void write_string(FILE *file, const char *value) {
+    fputc('"', file);
+    for (const char *c = value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char) *c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned int) (unsigned char) *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void write_opcode(FILE *file, unsigned int opcode) {
+    if (opcode_names[opcode] != NULL) {
+        write_string(file, opcode_names[opcode]);
+    } else {
+        fprintf(file, "\"op_%u\"", opcode);
+    }
+}
+
+static void write_json(FILE *file, const CF_Functions *functions, uint64_t count) {
+    fprintf(file, "{\n  \"instructions\": %"PRIu64",\n  \"opcodes\": {", total);
+    const char *separator = "";
+    for (unsigned int opcode = 0; opcode < 256; opcode++) {
+        if (opcode_counts[opcode] != 0) {
+            fprintf(file, "%s\n    ", separator);
+            write_opcode(file, opcode);
+            fprintf(file, ": %"PRIu64, opcode_counts[opcode]);
+            separator = ",";
+        }
+    }
+    fprintf(file, "\n  },\n  \"libraries\": [");
+
+    for (uint64_t index = 0; index < count; index++) {
+        const ProfileLibrary *library = &libraries[index];
+        const CF_Library *source = cf_runtime_library(machine->runtime, index);
+        const CF_Functions *bounds = &functions[index];
+        fprintf(file, "%s\n    {\n      \"index\": %"PRIu64",\n      \"path\": ", index == 0 ? "" : ",", index);
+        if (source->path != NULL) {
+            write_string(file, source->path);
+        } else {
+            fputs("null", file);
+        }
+
+        // Self counts per function
+        fprintf(file, ",\n      \"functions\": [");
+        separator = "";
+        for (uint64_t f = 0; f < bounds->size && library->counts != NULL; f++) {
+            uint64_t end = f + 1 < bounds->size ? bounds->starts[f + 1] : library->size;
+            uint64_t self = 0;
+            for (uint64_t pc = bounds->starts[f]; pc < end && pc < library->size; pc++) {
+                self += library->counts[pc];
+            }
+            if (self == 0) {
+                continue;
+            }
+            fprintf(file, "%s\n        {\"name\": \"", separator);
+            cf_write_function_name(file, source, bounds->starts[f]);
+            fprintf(file, "\", \"start\": %"PRIu64", \"end\": %"PRIu64", \"count\": %"PRIu64"}",
+                    bounds->starts[f], end, self);
+            separator = ",";
+        }
+
+        fprintf(file, "\n      ],\n      \"pcs\": [");
+        separator = "";
+        for (uint64_t pc = 0; pc < library->size && library->counts != NULL; pc++) {
+            if (library->counts[pc] == 0) {
+                continue;
+            }
+            fprintf(file, "%s\n        {\"pc\": %"PRIu64", \"opcode\": ", separator, pc);
+            write_opcode(file, library->program[pc].opcode);
+            fprintf(file, ", \"count\": %"PRIu64"}", library->counts[pc]);
+            separator = ",";
+        }
+        fprintf(file, "\n      ]\n    }");
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+// One line per call path with its own dispatches: "entry;caller;callee count"
+static void write_folded(FILE *file, const CF_Functions *functions, uint64_t count) {
+    uint32_t *path = malloc((node_size + 1) * sizeof(uint32_t));
+    if (path == NULL) {
+        return;
+    }
+
+    for (uint32_t node = 0; node < node_size; node++) {
+        if (nodes[node].count == 0) {
+            continue;
+        }
+        uint32_t depth = 0;
+        for (uint32_t at = node; at != NO_NODE; at = nodes[at].parent) {
+            path[depth++] = at;
+        }
+        while (depth-- > 0) {
+            const ProfileNode *frame = &nodes[path[depth]];
+            uint64_t start = frame->start;
+            if (frame->library < count) {
+                start = cf_function_start(&functions[frame->library], frame->start);
+            }
+            cf_write_function_name(file, cf_runtime_library(machine->runtime, frame->library), start);
+            fputc(depth == 0 ? ' ' : ';', file);
+        }
+        fprintf(file, "%"PRIu64"\n", nodes[node].count);
+    }
+    free(path);
+}
+
+static void write_profile(void) {
+    const char *path = getenv(PROFILE_PATH_ENV);
+    if (path == NULL) {
+        path = PROFILE_PATH_DEFAULT;
+    }
+
+    // Libraries unloaded while running have no program left to describe
+    uint64_t loaded = machine->runtime->library_size;
+    uint64_t count = library_size < loaded ? library_size : loaded;
+    CF_Functions *functions = calloc(count + 1, sizeof(CF_Functions));
+    if (functions == NULL) {
+        return;
+    }
+    for (uint64_t index = 0; index < count; index++) {
+        if (libraries[index].program == cf_runtime_library(machine->runtime, index)->program) {
+            functions[index] = cf_collect_functions(cf_runtime_library(machine->runtime, index));
+        }
+    }
+
+    FILE *file = fopen(path, "w");
+    if (file != NULL) {
+        write_json(file, functions, count);
+        fclose(file);
+    } else {
+        fprintf(stderr, "Failed to write profile: %s\n", path);
+    }
+
+    size_t length = strlen(path);
+    char *folded_path = malloc(length + sizeof(".folded"));
+    if (folded_path != NULL) {
+        memcpy(folded_path, path, length);
+        memcpy(folded_path + length, ".folded", sizeof(".folded"));
+        file = fopen(folded_path, "w");
+        if (file != NULL) {
+            write_folded(file, functions, count);
+            fclose(file);
+        }
+        free(folded_path);
+    }
+
+    for (uint64_t index = 0; index < count; index++) {
+        cf_free_functions(&functions[index]);
+    }
+    free(functions);
+}
+
+#endif
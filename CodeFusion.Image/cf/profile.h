@@ -0,0 +1,36 @@
+#ifndef CF_PROFILE_H
+#define CF_PROFILE_H
+
+#include "machine.h"
+
+// Environment variable naming the file the profile is written to when the process exits. The JSON profile is written
+// to the path itself and the collapsed stacks for flame graphs to the path with ".folded" appended.
+#define PROFILE_PATH_ENV "CF_PROFILE_PATH"
+#define PROFILE_PATH_DEFAULT "cf-profile.json"
+
+#ifdef CF_PROFILE
+
+// Starts counting dispatches of the machine, the root of the call tree is the function at the program counter.
+// The profile is written by an exit handler, so programs ending through the exit interrupt are covered as well.
+void cf_profile_start(CF_Machine *cf);
+
+void cf_profile_step(const CF_Machine *cf, uint64_t pc, uint8_t opcode);
+
+// Control moved into the function at target of the given library through CALL or VCALL
+void cf_profile_call(uint64_t library, uint64_t target);
+
+void cf_profile_return(void);
+
+#define PROFILE_STEP(cf, pc, opcode) cf_profile_step(cf, pc, opcode)
+#define PROFILE_CALL(library, target) cf_profile_call(library, target)
+#define PROFILE_RETURN() cf_profile_return()
+
+#else
+
+#define PROFILE_STEP(cf, pc, opcode)
+#define PROFILE_CALL(library, target)
+#define PROFILE_RETURN()
+
+#endif
+
+#endif
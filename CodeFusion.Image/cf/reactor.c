@@ -0,0 +1,138 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include "reactor.h"
+
+#ifdef CF_REACTOR
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define REACTOR_EVENTS 64
+
+struct CF_Reactor {
+    int epoll;
+    // Written by cf_reactor_destroy to stop the thread, watched with a NULL item
+    int stop;
+    pthread_t thread;
+    void (*ready)(void *context, void *item);
+    void *context;
+};
+
+static void *run_reactor(void *argument) {
+    CF_Reactor *reactor = argument;
+    struct epoll_event events[REACTOR_EVENTS];
+    for (;;) {
+        int count = epoll_wait(reactor->epoll, events, REACTOR_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NULL;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                return NULL;
+            }
+            reactor->ready(reactor->context, events[i].data.ptr);
+        }
+    }
+}
+
+CF_Reactor *cf_reactor_create(void (*ready)(void *context, void *item), void *context) {
+    CF_Reactor *reactor = calloc(1, sizeof(CF_Reactor));
+    if (reactor == NULL) {
+        return NULL;
+    }
+    reactor->ready = ready;
+    reactor->context = context;
+    reactor->epoll = epoll_create1(EPOLL_CLOEXEC);
+    reactor->stop = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (reactor->epoll < 0 || reactor->stop < 0 ||
+        epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, reactor->stop, &event) != 0 ||
+        pthread_create(&reactor->thread, NULL, run_reactor, reactor) != 0) {
+        if (reactor->epoll >= 0) {
+            close(reactor->epoll);
+        }
+        if (reactor->stop >= 0) {
+            close(reactor->stop);
+        }
+        free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+void cf_reactor_destroy(CF_Reactor *reactor) {
+    if (reactor == NULL) {
+        return;
+    }
+    uint64_t value = 1;
+    if (write(reactor->stop, &value, sizeof(value)) != sizeof(value)) {
+        pthread_cancel(reactor->thread);
+    }
+    pthread_join(reactor->thread, NULL);
+    close(reactor->stop);
+    close(reactor->epoll);
+    free(reactor);
+}
+
+int cf_reactor_watch(CF_Reactor *reactor, int fd, uint32_t events, void *item) {
+    if (reactor == NULL) {
+        return 0;
+    }
+    struct epoll_event event = {.events = EPOLLONESHOT, .data.ptr = item};
+    if (events & REACTOR_READ) {
+        event.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & REACTOR_WRITE) {
+        event.events |= EPOLLOUT;
+    }
+    // A descriptor stays in the set after its one-shot event until it is closed
+    if (epoll_ctl(reactor->epoll, EPOLL_CTL_MOD, fd, &event) == 0) {
+        return 1;
+    }
+    return errno == ENOENT && epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void cf_reactor_block(int fd, uint32_t events) {
+    struct pollfd target = {.fd = fd, .events = 0};
+    if (events & REACTOR_READ) {
+        target.events |= POLLIN;
+    }
+    if (events & REACTOR_WRITE) {
+        target.events |= POLLOUT;
+    }
+    while (poll(&target, 1, -1) < 0 && errno == EINTR) {
+    }
+}
+
+#else
+
+CF_Reactor *cf_reactor_create(void (*ready)(void *context, void *item), void *context) {
+    (void) ready;
+    (void) context;
+    return NULL;
+}
+
+void cf_reactor_destroy(CF_Reactor *reactor) {
+    (void) reactor;
+}
+
+int cf_reactor_watch(CF_Reactor *reactor, int fd, uint32_t events, void *item) {
+    (void) reactor;
+    (void) fd;
+    (void) events;
+    (void) item;
+    return 0;
+}
+
+void cf_reactor_block(int fd, uint32_t events) {
+    (void) fd;
+    (void) events;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef CF_REACTOR_H
+#define CF_REACTOR_H
+
+#include <inttypes.h>
+
+#ifdef __linux__
+// File descriptors can be watched through epoll, without it the asynchronous I/O interrupts are not installed
+#define CF_REACTOR
+#endif
+
+// Readiness a machine waits for
+#define REACTOR_READ 1
+#define REACTOR_WRITE 2
+
+// Thread waiting on an epoll set. Every watch is one-shot: once the descriptor is ready the item is handed to the
+// ready callback and the descriptor has to be watched again for the next wait.
+typedef struct CF_Reactor CF_Reactor;
+
+// Creates the reactor and starts its thread, ready is called on that thread. Returns NULL without CF_REACTOR.
+CF_Reactor *cf_reactor_create(void (*ready)(void *context, void *item), void *context);
+
+// Stops the thread, items still watched are not handed to the callback anymore
+void cf_reactor_destroy(CF_Reactor *reactor);
+
+// Watches fd once for events, returns 0 if the descriptor cannot be watched (e.g. a regular file, which is always
+// ready) and the caller has to retry on its own
+int cf_reactor_watch(CF_Reactor *reactor, int fd, uint32_t events, void *item);
+
+// Blocks the calling thread until fd is ready for events, for machines that are no task
+void cf_reactor_block(int fd, uint32_t events);
+
+#endif
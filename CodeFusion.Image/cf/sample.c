@@ -0,0 +1,320 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "sample.h"
+#include "opcode.h"
+#include "symbolize.h"
+
+#ifdef CF_SAMPLE
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+
+// Deepest return chain a sample records, deeper chains keep their newest frames
+#define SAMPLE_DEPTH 64
+// Number of samples the ring holds between two drains, a power of two
+#define SAMPLE_RING_SIZE 1024
+
+// The prologue the compiler emits moves the return address pushed by CALL and VCALL into the new pool frame: the
+// program counter at offset 0 and the library at offset 8
+#define FRAME_RETURN_PC 0
+#define FRAME_RETURN_LIBRARY 8
+
+// A location is packed into one word, the library in the upper 16 bits and the program counter below
+#define LOCATION(library, pc) (((uint64_t) (library) << 48) | ((pc) & LOCATION_PC_MASK))
+#define LOCATION_PC_MASK ((UINT64_C(1) << 48) - 1)
+#define LOCATION_LIBRARY(location) ((location) >> 48)
+#define LOCATION_PC(location) ((location) & LOCATION_PC_MASK)
+
+// Raw sample as taken by the signal handler, the active location first and then one return location per pool frame,
+// newest first. Nothing is validated in the handler, cf_sample_drain drops what is not a return address.
+typedef struct {
+    uint32_t depth;
+    uint8_t truncated;
+    uint64_t locations[SAMPLE_DEPTH];
+} Sample;
+
+// Aggregated call path from the entry function to the sampled function, each location is the start of a function
+typedef struct {
+    uint64_t hash;
+    uint64_t *functions;
+    uint32_t depth;
+    uint8_t truncated;
+    uint64_t count;
+} SampleStack;
+
+// Function boundaries of one library, rebuilt when the slot holds a different program
+typedef struct {
+    const Inst *program;
+    CF_Functions functions;
+} SampleLibrary;
+
+static CF_Machine *machine = NULL;
+// Location of the entry point, every path starts in its function
+static uint64_t entry = 0;
+
+// Single producer (the signal handler), single consumer (cf_sample_drain) ring. Both run on the thread of the
+// machine, the handler may interrupt the drain at any point, so the slots are handed over by the two counters alone.
+static Sample ring[SAMPLE_RING_SIZE];
+static atomic_uint_fast64_t ring_head = 0;
+static atomic_uint_fast64_t ring_tail = 0;
+static atomic_uint_fast64_t dropped = 0;
+
+static SampleStack *stacks = NULL;
+static uint64_t stack_size = 0;
+static uint64_t stack_capacity = 0;
+static uint64_t sample_count = 0;
+
+static SampleLibrary *libraries = NULL;
+static uint64_t library_size = 0;
+
+static void write_samples(void);
+
+static void take_sample(int signal) {
+    (void) signal;
+    const CF_Machine *cf = machine;
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring_tail, memory_order_acquire) >= SAMPLE_RING_SIZE) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    Sample *sample = &ring[head & (SAMPLE_RING_SIZE - 1)];
+    uint32_t depth = 0;
+    sample->locations[depth++] = LOCATION(cf->program_pool, *(volatile const uint64_t *) &cf->program_counter);
+
+    uint64_t frames = cf->pool_stack_size;
+    uint64_t oldest = frames > SAMPLE_DEPTH - 1 ? frames - (SAMPLE_DEPTH - 1) : 0;
+    for (uint64_t i = frames; i > oldest; i--) {
+        const uint8_t *frame = cf->pool_stack[i - 1].as_ptr;
+        if (frame == NULL) {
+            continue;
+        }
+        uint64_t pc;
+        uint16_t library;
+        memcpy(&pc, frame + FRAME_RETURN_PC, sizeof(pc));
+        memcpy(&library, frame + FRAME_RETURN_LIBRARY, sizeof(library));
+        sample->locations[depth++] = LOCATION(library, pc);
+    }
+    sample->depth = depth;
+    sample->truncated = oldest != 0;
+
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+void cf_sample_start(CF_Machine *cf) {
+    machine = cf;
+    entry = LOCATION(cf->program_pool, cf->program_counter);
+
+    long rate = SAMPLE_RATE_DEFAULT;
+    const char *value = getenv(SAMPLE_RATE_ENV);
+    if (value != NULL) {
+        char *end;
+        long parsed = strtol(value, &end, 10);
+        if (end != value && *end == '\0' && parsed > 0 && parsed <= 1000000) {
+            rate = parsed;
+        }
+    }
+
+    struct sigaction action = {0};
+    action.sa_handler = take_sample;
+    // Interrupts blocking in read or write must not fail with EINTR because of a sample
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        fprintf(stderr, "Failed to install the sampling handler\n");
+        return;
+    }
+
+    long interval = 1000000 / rate;
+    struct itimerval timer = {0};
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = (suseconds_t) (interval % 1000000);
+    timer.it_value = timer.it_interval;
+    atexit(write_samples);
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+static const CF_Functions *library_functions(uint64_t index) {
+    if (index >= library_size) {
+        SampleLibrary *grown = realloc(libraries, (index + 1) * sizeof(SampleLibrary));
+        if (grown == NULL) {
+            return NULL;
+        }
+        memset(grown + library_size, 0, (index + 1 - library_size) * sizeof(SampleLibrary));
+        libraries = grown;
+        library_size = index + 1;
+    }
+
+    SampleLibrary *library = &libraries[index];
+    const CF_Library *source = cf_runtime_library(machine->runtime, index);
+    if (library->program != source->program) {
+        cf_free_functions(&library->functions);
+        library->program = source->program;
+        library->functions = cf_collect_functions(source);
+    }
+    return &library->functions;
+}
+
+// Start of the function the location lies in, or UINT64_MAX if the location does not belong to a loaded library.
+// Return locations point behind a CALL or VCALL, anything else is a frame without a return address, e.g. one whose
+// prologue did not run yet.
+static uint64_t resolve(uint64_t location, int is_return) {
+    uint64_t index = LOCATION_LIBRARY(location);
+    uint64_t pc = LOCATION_PC(location);
+    if (index >= machine->runtime->library_size) {
+        return UINT64_MAX;
+    }
+    const CF_Library *library = cf_runtime_library(machine->runtime, index);
+    if (library->program == NULL) {
+        return UINT64_MAX;
+    }
+
+    if (is_return) {
+        if (pc == 0 || pc > library->program_size) {
+            return UINT64_MAX;
+        }
+        pc--;
+        uint8_t opcode = library->program[pc].opcode;
+        if (opcode != INST_CALL && opcode != INST_VCALL) {
+            return UINT64_MAX;
+        }
+    } else if (pc >= library->program_size) {
+        return UINT64_MAX;
+    }
+
+    const CF_Functions *functions = library_functions(index);
+    return LOCATION(index, functions != NULL ? cf_function_start(functions, pc) : pc);
+}
+
+static uint64_t hash_path(const uint64_t *functions, uint32_t depth) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ functions[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int grow_stacks(void) {
+    uint64_t capacity = stack_capacity == 0 ? 256 : stack_capacity * 2;
+    SampleStack *grown = calloc(capacity, sizeof(SampleStack));
+    if (grown == NULL) {
+        return 0;
+    }
+    for (uint64_t i = 0; i < stack_capacity; i++) {
+        if (stacks[i].functions == NULL) {
+            continue;
+        }
+        uint64_t slot = stacks[i].hash & (capacity - 1);
+        while (grown[slot].functions != NULL) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        grown[slot] = stacks[i];
+    }
+    free(stacks);
+    stacks = grown;
+    stack_capacity = capacity;
+    return 1;
+}
+
+static void add_path(const uint64_t *functions, uint32_t depth, uint8_t truncated) {
+    if ((stack_size + 1) * 4 > stack_capacity * 3 && !grow_stacks()) {
+        return;
+    }
+
+    uint64_t hash = hash_path(functions, depth) ^ truncated;
+    uint64_t slot = hash & (stack_capacity - 1);
+    for (; stacks[slot].functions != NULL; slot = (slot + 1) & (stack_capacity - 1)) {
+        SampleStack *stack = &stacks[slot];
+        if (stack->hash == hash && stack->depth == depth && stack->truncated == truncated &&
+            memcmp(stack->functions, functions, depth * sizeof(uint64_t)) == 0) {
+            stack->count++;
+            return;
+        }
+    }
+
+    uint64_t *copy = malloc(depth * sizeof(uint64_t));
+    if (copy == NULL) {
+        return;
+    }
+    memcpy(copy, functions, depth * sizeof(uint64_t));
+    stacks[slot] = (SampleStack) {.hash = hash, .functions = copy, .depth = depth, .truncated = truncated, .count = 1};
+    stack_size++;
+}
+
+void cf_sample_drain(void) {
+    uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    uint64_t path[SAMPLE_DEPTH + 1];
+    uint64_t root = resolve(entry, 0);
+
+    for (; tail != head; tail++) {
+        const Sample *sample = &ring[tail & (SAMPLE_RING_SIZE - 1)];
+        // Oldest frame first, the active location closes the path. The frame of the entry function holds no return
+        // address and neither does a frame while its prologue runs, so the root is added where it is missing.
+        uint32_t depth = 0;
+        if (root != UINT64_MAX && !sample->truncated) {
+            path[depth++] = root;
+        }
+        int oldest = 1;
+        for (uint32_t i = sample->depth; i-- > 0;) {
+            uint64_t function = resolve(sample->locations[i], i != 0);
+            if (function == UINT64_MAX) {
+                continue;
+            }
+            if (!oldest || depth != 1 || function != root) {
+                path[depth++] = function;
+            }
+            oldest = 0;
+        }
+        if (depth != 0) {
+            add_path(path, depth, sample->truncated);
+            sample_count++;
+        }
+        atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+    }
+}
+
+static void write_samples(void) {
+    struct itimerval stop = {0};
+    setitimer(ITIMER_PROF, &stop, NULL);
+    cf_sample_drain();
+
+    const char *path = getenv(SAMPLE_PATH_ENV);
+    if (path == NULL) {
+        path = SAMPLE_PATH_DEFAULT;
+    }
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to write samples: %s\n", path);
+        return;
+    }
+
+    // One line per call path: "entry;caller;callee count"
+    for (uint64_t i = 0; i < stack_capacity; i++) {
+        const SampleStack *stack = &stacks[i];
+        if (stack->functions == NULL) {
+            continue;
+        }
+        if (stack->truncated) {
+            fputs("[truncated];", file);
+        }
+        for (uint32_t depth = 0; depth < stack->depth; depth++) {
+            uint64_t index = LOCATION_LIBRARY(stack->functions[depth]);
+            const CF_Library *library =
+                    index < machine->runtime->library_size ? cf_runtime_library(machine->runtime, index) : NULL;
+            cf_write_function_name(file, library, LOCATION_PC(stack->functions[depth]));
+            fputc(depth + 1 == stack->depth ? ' ' : ';', file);
+        }
+        fprintf(file, "%"PRIu64"\n", stack->count);
+    }
+    fclose(file);
+
+    uint64_t lost = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (lost != 0) {
+        fprintf(stderr, "Sampling dropped %"PRIu64" of %"PRIu64" samples, the ring was full\n", lost,
+                lost + sample_count);
+    }
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CF_SAMPLE_H
+#define CF_SAMPLE_H
+
+#include "machine.h"
+
+// Environment variables of the sampling profiler: the file the collapsed stacks are written to when the process
+// exits and the number of samples per second of CPU time. The default rate is prime so the timer does not run in
+// lockstep with periodic work of the program.
+#define SAMPLE_PATH_ENV "CF_SAMPLE_PATH"
+#define SAMPLE_PATH_DEFAULT "cf-samples.folded"
+#define SAMPLE_RATE_ENV "CF_SAMPLE_RATE"
+#define SAMPLE_RATE_DEFAULT 997
+
+// Instructions cf_run executes between two drains of the sample ring, see cf_sample_drain
+#define SAMPLE_SLICE (1024 * 1024)
+
+#ifdef CF_SAMPLE
+
+// Starts a SIGPROF interval timer. Each tick records the program counter, the active library and the return chain of
+// the machine into a lock-free ring. The samples are written as collapsed stacks by an exit handler.
+void cf_sample_start(CF_Machine *cf);
+
+// Moves the samples out of the ring into the aggregated stacks. Called between slices of cf_run, samples that do not
+// fit into the ring until then are dropped.
+void cf_sample_drain(void);
+
+// The threaded engine keeps the program counter in a local, it publishes the counter at every dispatch so the signal
+// handler sees where the machine is
+#define SAMPLE_POINT(cf, pc) (*(volatile uint64_t *) &(cf)->program_counter = (pc))
+
+#else
+
+#define SAMPLE_POINT(cf, pc)
+
+#endif
+
+#endif
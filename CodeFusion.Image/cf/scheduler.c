@@ -0,0 +1,603 @@
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "output.h"
+#include "reactor.h"
+
+_Static_assert(LIBRARY_CAPACITY <= TASK_RETURN_LIBRARY, "TASK_RETURN_LIBRARY must not be a valid library index");
+
+#define DEQUE_CAPACITY 64
+// A worker takes from the shared queue before its own deque every this many tasks, so preempted tasks and tasks
+// spawned by the entry point are not starved by a worker whose tasks keep spawning
+#define SHARED_QUEUE_INTERVAL 61
+// Machines of ended tasks kept for the next spawn, mapping the stacks is the most expensive part of a spawn
+#define MACHINE_CACHE_CAPACITY 64
+
+struct CF_Task {
+    CF_Machine *machine;
+    // Set by cf_join when the task has to wait, the worker parks the task once cf_run returned
+    CF_Task *waiting_for;
+    // Set by cf_wait_fd, the worker hands the task to the reactor once cf_run returned
+    int waiting_fd;
+    uint32_t waiting_events;
+    // Task parked until this one ends, guarded by the lock of the scheduler
+    CF_Task *joiner;
+    // Link in the shared queue
+    CF_Task *next;
+    // Links in the list of tasks not joined yet
+    CF_Task *previous_task;
+    CF_Task *next_task;
+
+    atomic_int done;
+    Status status;
+    Word result;
+};
+
+// Growable array of a deque. Thieves may still read an array after it was replaced, so replaced arrays are kept
+// until the scheduler is destroyed.
+typedef struct DequeArray {
+    int64_t capacity;
+    struct DequeArray *replaced;
+    _Atomic(CF_Task *) items[];
+} DequeArray;
+
+// Work-stealing deque of Chase and Lev in the C11 formulation of Lê et al. The owning worker pushes and pops at the
+// bottom, other workers steal from the top.
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(DequeArray *) array;
+} Deque;
+
+typedef struct {
+    CF_Scheduler *scheduler;
+    pthread_t thread;
+    Deque deque;
+    uint64_t seed;
+    uint64_t ticks;
+} Worker;
+
+struct CF_Scheduler {
+    CF_Runtime *runtime;
+    Worker *workers;
+    uint32_t worker_size;
+    uint32_t started;
+    // NULL if the platform has no reactor, waiting tasks are retried like yielded ones then
+    CF_Reactor *reactor;
+
+    pthread_mutex_t lock;
+    // Signalled when a task is queued while workers are idle and broadcast when the scheduler stops
+    pthread_cond_t work;
+    // Broadcast when a task ends, the machine of the entry point waits on it in cf_join
+    pthread_cond_t finished;
+    atomic_uint idle;
+    atomic_int stopping;
+
+    // Preempted and yielded tasks and tasks spawned outside of the workers, oldest first. Guarded by the lock, the
+    // size is read without it to skip an empty queue.
+    CF_Task *shared_head;
+    CF_Task *shared_tail;
+    atomic_uint_fast64_t shared_size;
+
+    // Guarded by the lock
+    CF_Task *tasks;
+    CF_Machine *machines[MACHINE_CACHE_CAPACITY];
+    uint32_t machine_size;
+};
+
+static _Thread_local Worker *current_worker = NULL;
+
+static DequeArray *create_deque_array(int64_t capacity) {
+    DequeArray *array = calloc(1, sizeof(DequeArray) + (size_t) capacity * sizeof(array->items[0]));
+    if (array != NULL) {
+        array->capacity = capacity;
+    }
+    return array;
+}
+
+static int deque_push(Deque *deque, CF_Task *task) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    if (bottom - top > array->capacity - 1) {
+        DequeArray *grown = create_deque_array(array->capacity * 2);
+        if (grown == NULL) {
+            return 0;
+        }
+        for (int64_t i = top; i < bottom; i++) {
+            CF_Task *item = atomic_load_explicit(&array->items[i & (array->capacity - 1)], memory_order_relaxed);
+            atomic_store_explicit(&grown->items[i & (grown->capacity - 1)], item, memory_order_relaxed);
+        }
+        grown->replaced = array;
+        atomic_store_explicit(&deque->array, grown, memory_order_release);
+        array = grown;
+    }
+    atomic_store_explicit(&array->items[bottom & (array->capacity - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return 1;
+}
+
+static CF_Task *deque_pop(Deque *deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    CF_Task *task = atomic_load_explicit(&array->items[bottom & (array->capacity - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // Last entry, a thief may take it at the same time
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static CF_Task *deque_steal(Deque *deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    CF_Task *task = atomic_load_explicit(&array->items[top & (array->capacity - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+static int deque_empty(Deque *deque) {
+    return atomic_load_explicit(&deque->top, memory_order_relaxed) >=
+           atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+}
+
+// Wakes an idle worker after a task was pushed to a deque. Pairs with the fence in wait_for_work: either the pusher
+// sees the idle worker or the worker sees the task.
+static void notify(CF_Scheduler *scheduler) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&scheduler->idle, memory_order_relaxed) != 0) {
+        pthread_mutex_lock(&scheduler->lock);
+        pthread_cond_signal(&scheduler->work);
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+}
+
+static void shared_push(CF_Scheduler *scheduler, CF_Task *task) {
+    task->next = NULL;
+    pthread_mutex_lock(&scheduler->lock);
+    if (scheduler->shared_tail != NULL) {
+        scheduler->shared_tail->next = task;
+    } else {
+        scheduler->shared_head = task;
+    }
+    scheduler->shared_tail = task;
+    atomic_fetch_add_explicit(&scheduler->shared_size, 1, memory_order_relaxed);
+    pthread_cond_signal(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+static CF_Task *shared_pop(CF_Scheduler *scheduler) {
+    if (atomic_load_explicit(&scheduler->shared_size, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&scheduler->lock);
+    CF_Task *task = scheduler->shared_head;
+    if (task != NULL) {
+        scheduler->shared_head = task->next;
+        if (scheduler->shared_head == NULL) {
+            scheduler->shared_tail = NULL;
+        }
+        atomic_fetch_sub_explicit(&scheduler->shared_size, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return task;
+}
+
+// Queues a task that is ready to run, on the deque of the current worker if there is one
+static void make_ready(CF_Scheduler *scheduler, CF_Task *task) {
+    Worker *worker = current_worker;
+    if (worker != NULL && worker->scheduler == scheduler && deque_push(&worker->deque, task)) {
+        notify(scheduler);
+        return;
+    }
+    shared_push(scheduler, task);
+}
+
+static CF_Task *steal(Worker *worker) {
+    CF_Scheduler *scheduler = worker->scheduler;
+    // xorshift, the victim to start with is picked at random so thieves do not all go for the same deque
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 7;
+    worker->seed ^= worker->seed << 17;
+    uint32_t start = (uint32_t) (worker->seed % scheduler->worker_size);
+    for (uint32_t i = 0; i < scheduler->worker_size; i++) {
+        Worker *victim = &scheduler->workers[(start + i) % scheduler->worker_size];
+        if (victim == worker) {
+            continue;
+        }
+        CF_Task *task = deque_steal(&victim->deque);
+        if (task != NULL) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static int has_work(CF_Scheduler *scheduler) {
+    if (scheduler->shared_head != NULL) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < scheduler->worker_size; i++) {
+        if (!deque_empty(&scheduler->workers[i].deque)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Sleeps until a task is queued, returns 0 if the scheduler stops
+static int wait_for_work(CF_Scheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    atomic_fetch_add(&scheduler->idle, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!atomic_load(&scheduler->stopping) && !has_work(scheduler)) {
+        pthread_cond_wait(&scheduler->work, &scheduler->lock);
+    }
+    atomic_fetch_sub(&scheduler->idle, 1);
+    pthread_mutex_unlock(&scheduler->lock);
+    return !atomic_load(&scheduler->stopping);
+}
+
+static CF_Task *find_task(Worker *worker) {
+    CF_Scheduler *scheduler = worker->scheduler;
+    while (!atomic_load_explicit(&scheduler->stopping, memory_order_relaxed)) {
+        CF_Task *task = NULL;
+        if (++worker->ticks % SHARED_QUEUE_INTERVAL == 0) {
+            task = shared_pop(scheduler);
+        }
+        if (task == NULL) {
+            task = deque_pop(&worker->deque);
+        }
+        if (task == NULL) {
+            task = shared_pop(scheduler);
+        }
+        if (task == NULL) {
+            task = steal(worker);
+        }
+        if (task != NULL) {
+            return task;
+        }
+        if (!wait_for_work(scheduler)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void finish(CF_Scheduler *scheduler, CF_Task *task, Status status, Word result) {
+    CF_Machine *cf = task->machine;
+    task->machine = NULL;
+    // Written before a joiner can see the end of the task
+    cf_output_flush(cf);
+
+    pthread_mutex_lock(&scheduler->lock);
+    task->status = status;
+    task->result = result;
+    atomic_store_explicit(&task->done, 1, memory_order_release);
+    CF_Task *joiner = task->joiner;
+    task->joiner = NULL;
+    // Only a machine whose function returned has its pool frames released
+    if (status == STATUS_OK && cf->pool_stack_size == 0 && scheduler->machine_size < MACHINE_CACHE_CAPACITY) {
+        scheduler->machines[scheduler->machine_size++] = cf;
+        cf = NULL;
+    }
+    pthread_cond_broadcast(&scheduler->finished);
+    pthread_mutex_unlock(&scheduler->lock);
+
+    cf_machine_destroy(cf);
+    if (joiner != NULL) {
+        make_ready(scheduler, joiner);
+    }
+}
+
+static void run_task(CF_Scheduler *scheduler, CF_Task *task) {
+    CF_Machine *cf = task->machine;
+    Status status = cf_run(cf, TASK_SLICE);
+    if (status == STATUS_OK) {
+        // The budget is used up, the task goes behind the others
+        shared_push(scheduler, task);
+        return;
+    }
+
+    if (status == STATUS_YIELD) {
+        if (task->waiting_events != 0) {
+            int fd = task->waiting_fd;
+            uint32_t events = task->waiting_events;
+            task->waiting_events = 0;
+            if (!cf_reactor_watch(scheduler->reactor, fd, events, task)) {
+                shared_push(scheduler, task);
+            }
+            return;
+        }
+        CF_Task *target = task->waiting_for;
+        if (target == NULL) {
+            shared_push(scheduler, task);
+            return;
+        }
+        task->waiting_for = NULL;
+        // The machine is no longer running, so the task can be handed to the finishing worker from here on
+        pthread_mutex_lock(&scheduler->lock);
+        int done = atomic_load_explicit(&target->done, memory_order_relaxed);
+        if (!done) {
+            target->joiner = task;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        if (done) {
+            make_ready(scheduler, task);
+        }
+        return;
+    }
+
+    if (status == STATUS_ILLEGAL_LIBRARY_INDEX && cf->stack_size >= 2 &&
+        cf->stack[cf->stack_size - 2].as_u64 == TASK_RETURN_LIBRARY) {
+        finish(scheduler, task, STATUS_OK, cf->stack_size >= 3 ? cf->stack[cf->stack_size - 3] : WORD_U64(0));
+    } else {
+        finish(scheduler, task, status, WORD_U64(0));
+    }
+}
+
+static void resume(void *context, void *item) {
+    make_ready(context, item);
+}
+
+static void *run_worker(void *argument) {
+    Worker *worker = argument;
+    current_worker = worker;
+    CF_Task *task;
+    while ((task = find_task(worker)) != NULL) {
+        run_task(worker->scheduler, task);
+    }
+    return NULL;
+}
+
+static uint32_t worker_count(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    long count = 1;
+#endif
+    const char *value = getenv(WORKERS_ENV);
+    if (value != NULL) {
+        char *end;
+        long parsed = strtol(value, &end, 10);
+        if (end != value && *end == '\0') {
+            count = parsed;
+        }
+    }
+    if (count < 1) {
+        return 1;
+    }
+    return count > WORKER_CAPACITY ? WORKER_CAPACITY : (uint32_t) count;
+}
+
+static void free_scheduler(CF_Scheduler *scheduler) {
+    for (CF_Task *task = scheduler->tasks; task != NULL;) {
+        CF_Task *next = task->next_task;
+        cf_machine_destroy(task->machine);
+        free(task);
+        task = next;
+    }
+    for (uint32_t i = 0; i < scheduler->machine_size; i++) {
+        cf_machine_destroy(scheduler->machines[i]);
+    }
+    for (uint32_t i = 0; i < scheduler->worker_size; i++) {
+        DequeArray *array = atomic_load(&scheduler->workers[i].deque.array);
+        while (array != NULL) {
+            DequeArray *replaced = array->replaced;
+            free(array);
+            array = replaced;
+        }
+    }
+    pthread_cond_destroy(&scheduler->finished);
+    pthread_cond_destroy(&scheduler->work);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler->workers);
+    free(scheduler);
+}
+
+static CF_Scheduler *create_scheduler(CF_Runtime *runtime) {
+    CF_Scheduler *scheduler = calloc(1, sizeof(CF_Scheduler));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+    scheduler->runtime = runtime;
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->work, NULL);
+    pthread_cond_init(&scheduler->finished, NULL);
+
+    uint32_t count = worker_count();
+    scheduler->workers = calloc(count, sizeof(Worker));
+    if (scheduler->workers == NULL) {
+        free_scheduler(scheduler);
+        return NULL;
+    }
+    scheduler->worker_size = count;
+    for (uint32_t i = 0; i < count; i++) {
+        Worker *worker = &scheduler->workers[i];
+        worker->scheduler = scheduler;
+        worker->seed = UINT64_C(0x9e3779b97f4a7c15) * (i + 1);
+        DequeArray *array = create_deque_array(DEQUE_CAPACITY);
+        if (array == NULL) {
+            free_scheduler(scheduler);
+            return NULL;
+        }
+        atomic_store(&worker->deque.array, array);
+    }
+    return scheduler;
+}
+
+// Returns the scheduler of the runtime, creating it and starting its workers on the first call
+static CF_Scheduler *scheduler_of(CF_Runtime *runtime) {
+    CF_Scheduler *scheduler = atomic_load_explicit(&runtime->scheduler, memory_order_acquire);
+    if (scheduler != NULL) {
+        return scheduler;
+    }
+
+    CF_Scheduler *created = create_scheduler(runtime);
+    if (created == NULL) {
+        return NULL;
+    }
+    if (!atomic_compare_exchange_strong(&runtime->scheduler, &scheduler, created)) {
+        // Another thread spawned at the same time
+        free_scheduler(created);
+        return scheduler;
+    }
+    created->reactor = cf_reactor_create(resume, created);
+    for (; created->started < created->worker_size; created->started++) {
+        Worker *worker = &created->workers[created->started];
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+            break;
+        }
+    }
+    if (created->started == 0) {
+        fprintf(stderr, "Failed to start the workers of the scheduler\n");
+    }
+    return created;
+}
+
+Status cf_spawn(CF_Machine *cf, uint64_t library, uint64_t address, Word argument, CF_Task **handle) {
+    CF_Runtime *runtime = cf->runtime;
+    if (library >= atomic_load_explicit(&runtime->library_size, memory_order_acquire)) {
+        return STATUS_ILLEGAL_LIBRARY_INDEX;
+    }
+    if (address >= cf_runtime_library(runtime, library)->program_size) {
+        return STATUS_ILLEGAL_ACCESS;
+    }
+    CF_Scheduler *scheduler = scheduler_of(runtime);
+    CF_Task *task = scheduler != NULL ? calloc(1, sizeof(CF_Task)) : NULL;
+    if (task == NULL) {
+        return STATUS_STACK_OVERFLOW;
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+    CF_Machine *machine = scheduler->machine_size != 0 ? scheduler->machines[--scheduler->machine_size] : NULL;
+    pthread_mutex_unlock(&scheduler->lock);
+    if (machine == NULL) {
+        Status status = cf_machine_create(runtime, TASK_STACK_CAPACITY, TASK_CALLSTACK_CAPACITY, &machine);
+        if (status != STATUS_OK) {
+            free(task);
+            return status;
+        }
+    }
+
+    // The stack looks like the one after `push argument; call function`
+    machine->task = task;
+    // Statistics of a cached machine start over with every task
+    machine->heap = (CF_HeapStats) {0};
+    machine->program_pool = (uint16_t) library;
+    machine->program_counter = address;
+    machine->stack[0] = argument;
+    machine->stack[1] = WORD_U64(TASK_RETURN_LIBRARY);
+    machine->stack[2] = WORD_U64(0);
+    machine->stack_size = 3;
+    task->machine = machine;
+
+    pthread_mutex_lock(&scheduler->lock);
+    task->next_task = scheduler->tasks;
+    if (scheduler->tasks != NULL) {
+        scheduler->tasks->previous_task = task;
+    }
+    scheduler->tasks = task;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    *handle = task;
+    make_ready(scheduler, task);
+    return STATUS_OK;
+}
+
+Status cf_yield(CF_Machine *cf) {
+    if (cf->task == NULL) {
+        sched_yield();
+        return STATUS_OK;
+    }
+    return STATUS_YIELD;
+}
+
+Status cf_join(CF_Machine *cf, CF_Task *task, Word *result) {
+    CF_Scheduler *scheduler = atomic_load_explicit(&cf->runtime->scheduler, memory_order_acquire);
+    if (scheduler == NULL || task == NULL || task == cf->task) {
+        return STATUS_ILLEGAL_ACCESS;
+    }
+
+    if (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+        if (cf->task != NULL) {
+            cf->task->waiting_for = task;
+            cf->program_counter--;
+            return STATUS_YIELD;
+        }
+        pthread_mutex_lock(&scheduler->lock);
+        while (!atomic_load_explicit(&task->done, memory_order_relaxed)) {
+            pthread_cond_wait(&scheduler->finished, &scheduler->lock);
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+
+    Status status = task->status;
+    *result = task->result;
+    pthread_mutex_lock(&scheduler->lock);
+    if (task->previous_task != NULL) {
+        task->previous_task->next_task = task->next_task;
+    } else {
+        scheduler->tasks = task->next_task;
+    }
+    if (task->next_task != NULL) {
+        task->next_task->previous_task = task->previous_task;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    free(task);
+    return status;
+}
+
+Status cf_wait_fd(CF_Machine *cf, int fd, uint32_t events) {
+    if (cf->task == NULL) {
+        if (fd >= 0) {
+            cf_reactor_block(fd, events);
+        } else {
+            sched_yield();
+        }
+        return STATUS_OK;
+    }
+    cf->task->waiting_fd = fd;
+    cf->task->waiting_events = fd >= 0 ? events : 0;
+    cf->program_counter--;
+    return STATUS_YIELD;
+}
+
+void cf_scheduler_destroy(CF_Scheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    atomic_store(&scheduler->stopping, 1);
+    pthread_cond_broadcast(&scheduler->work);
+    pthread_mutex_unlock(&scheduler->lock);
+    for (uint32_t i = 0; i < scheduler->started; i++) {
+        pthread_join(scheduler->workers[i].thread, NULL);
+    }
+    // Tasks the reactor resumes from here on only end up in the shared queue
+    cf_reactor_destroy(scheduler->reactor);
+    free_scheduler(scheduler);
+}
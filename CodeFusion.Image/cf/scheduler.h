@@ -0,0 +1,57 @@
+#ifndef CF_SCHEDULER_H
+#define CF_SCHEDULER_H
+
+#include "machine.h"
+
+// Green threads. A task is a CF function running on a machine of its own with small stacks. Tasks are multiplexed
+// over a fixed pool of worker threads: every worker runs the tasks of its own deque and steals from the others when it
+// runs dry. A task runs for at most TASK_SLICE instructions before it is preempted and queued behind the other tasks.
+//
+// The scheduler of a runtime is created by the first spawn. The machine that runs the entry point is no task, it keeps
+// its own thread and blocks the thread when it joins.
+
+// Environment variable with the number of worker threads, defaults to the number of online processors
+#define WORKERS_ENV "CF_WORKERS"
+// Upper bound of worker threads
+#define WORKER_CAPACITY 256
+
+// Instruction budget of a task before it is preempted
+#define TASK_SLICE (64 * 1024)
+// Default number of entries of the operand stack and the pool stack of a task
+#define TASK_STACK_CAPACITY (4 * 1024)
+#define TASK_CALLSTACK_CAPACITY (1024)
+
+// The return address pushed for the function of a task. No library has this index, so the final RET of the function
+// fails with STATUS_ILLEGAL_LIBRARY_INDEX and the scheduler takes that as the end of the task. The index is stored
+// with 2 bytes by the prologue, like every other library index.
+#define TASK_RETURN_LIBRARY UINT16_MAX
+
+typedef struct CF_Task CF_Task;
+typedef struct CF_Scheduler CF_Scheduler;
+
+// Starts a task running the function at address in library, with argument pushed before the return address like
+// the argument of a CALL. The handle is valid until the task is joined.
+Status cf_spawn(CF_Machine *cf, uint64_t library, uint64_t address, Word argument, CF_Task **task);
+
+// Stops the task of the machine for now, it is queued behind the other tasks. Returns STATUS_YIELD for tasks, which
+// ends cf_run, and STATUS_OK for the machine of the entry point.
+Status cf_yield(CF_Machine *cf);
+
+// Waits for the task and releases it, result is the entry the function of the task left below its return address or
+// 0 if there was none. A task is joined once. Returns the status the task failed with, if any.
+//
+// A task that has to wait gets STATUS_YIELD with its program counter moved back to the INT, so the join runs again
+// once the task is resumed. The machine of the entry point blocks its thread instead.
+Status cf_join(CF_Machine *cf, CF_Task *task, Word *result);
+
+// Suspends the machine until fd is ready for events (REACTOR_READ and REACTOR_WRITE of reactor.h), for interrupts
+// whose call would block. A task gets STATUS_YIELD with its program counter moved back to the INT and is resumed by the
+// reactor, the interrupt then runs again and retries the call. The machine of the entry point blocks its thread and
+// gets STATUS_OK, the interrupt retries right away. A negative fd waits for nothing, the retry happens once the other
+// ready tasks ran.
+Status cf_wait_fd(CF_Machine *cf, int fd, uint32_t events);
+
+// Stops the workers and releases every task that was not joined, called by cf_runtime_destroy
+void cf_scheduler_destroy(CF_Scheduler *scheduler);
+
+#endif
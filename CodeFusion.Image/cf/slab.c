@@ -0,0 +1,258 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "slab.h"
+
+// A block as it lies in memory. The payload starts after size, next and next_batch overlay it while the block is free.
+typedef struct SlabBlock {
+    // Payload size, for the first block of a batch in the depot the number of blocks in the batch
+    uint64_t size;
+    struct SlabBlock *next;
+    struct SlabBlock *next_batch;
+} SlabBlock;
+
+#define BLOCK_HEADER sizeof(uint64_t)
+
+// Start of every chunk, all chunks are linked so cf_slab_visit can find them
+typedef struct SlabChunk {
+    struct SlabChunk *next;
+} SlabChunk;
+
+// A block larger than SLAB_MAX_SIZE, size lies right before the payload as in SlabBlock
+typedef struct LargeBlock {
+    struct LargeBlock *prev;
+    struct LargeBlock *next;
+    uint64_t size;
+} LargeBlock;
+
+typedef struct SlabHeap {
+    SlabBlock *free[SLAB_CLASSES];
+    uint64_t free_size[SLAB_CLASSES];
+    // Rest of the chunk blocks are carved from
+    uint8_t *top;
+    uint8_t *end;
+    int registered;
+} SlabHeap;
+
+static const uint64_t class_sizes[SLAB_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024};
+
+// Size class of a size, indexed by the size in units of 16 bytes rounded up
+static const uint8_t size_classes[SLAB_MAX_SIZE / 16 + 1] = {
+        0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+};
+
+static _Thread_local SlabHeap heap;
+
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+// Batches of free blocks per size class, chained by next_batch. Read without the lock to skip empty classes.
+static _Atomic(SlabBlock *) depot[SLAB_CLASSES];
+
+// Chunks of all threads, guarded by the depot lock
+static SlabChunk *chunks = NULL;
+
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER;
+static LargeBlock *large_blocks = NULL;
+
+// Blocks of a restored snapshot lie in its mapping and are never given to free
+static uintptr_t adopted_start = 0;
+static uintptr_t adopted_end = 0;
+
+static pthread_once_t heap_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t heap_key;
+
+static void give_to_depot(uint8_t size_class, SlabBlock *batch, uint64_t size) {
+    batch->size = size;
+    pthread_mutex_lock(&depot_lock);
+    batch->next_batch = atomic_load_explicit(&depot[size_class], memory_order_relaxed);
+    atomic_store_explicit(&depot[size_class], batch, memory_order_relaxed);
+    pthread_mutex_unlock(&depot_lock);
+}
+
+// Runs when a thread that allocated or freed blocks ends, its free lists go to the depot in batches
+static void release_heap(void *value) {
+    SlabHeap *ending = value;
+    for (uint8_t size_class = 0; size_class < SLAB_CLASSES; size_class++) {
+        SlabBlock *block = ending->free[size_class];
+        while (block != NULL) {
+            SlabBlock *batch = block;
+            uint64_t size = 1;
+            while (size < SLAB_BATCH && block->next != NULL) {
+                block = block->next;
+                size++;
+            }
+            SlabBlock *rest = block->next;
+            block->next = NULL;
+            give_to_depot(size_class, batch, size);
+            block = rest;
+        }
+        ending->free[size_class] = NULL;
+        ending->free_size[size_class] = 0;
+    }
+}
+
+static void create_heap_key(void) {
+    pthread_key_create(&heap_key, release_heap);
+}
+
+static void register_heap(void) {
+    pthread_once(&heap_key_once, create_heap_key);
+    pthread_setspecific(heap_key, &heap);
+    heap.registered = 1;
+}
+
+static SlabBlock *take_from_depot(uint8_t size_class) {
+    if (atomic_load_explicit(&depot[size_class], memory_order_relaxed) == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&depot_lock);
+    SlabBlock *batch = atomic_load_explicit(&depot[size_class], memory_order_relaxed);
+    if (batch != NULL) {
+        atomic_store_explicit(&depot[size_class], batch->next_batch, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&depot_lock);
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    heap.free[size_class] = batch->next;
+    heap.free_size[size_class] = batch->size - 1;
+    return batch;
+}
+
+static SlabBlock *carve(uint8_t size_class) {
+    size_t size = BLOCK_HEADER + class_sizes[size_class];
+    if (heap.top == NULL || size > (size_t) (heap.end - heap.top)) {
+        // The rest of the old chunk is smaller than the block and stays unused
+        SlabChunk *chunk = malloc(SLAB_CHUNK_SIZE);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&depot_lock);
+        chunk->next = chunks;
+        chunks = chunk;
+        pthread_mutex_unlock(&depot_lock);
+        heap.top = (uint8_t *) chunk + sizeof(SlabChunk);
+        heap.end = (uint8_t *) chunk + SLAB_CHUNK_SIZE;
+        if (!heap.registered) {
+            register_heap();
+        }
+    }
+
+    SlabBlock *block = (SlabBlock *) heap.top;
+    heap.top += size;
+    return block;
+}
+
+uint64_t cf_slab_class_size(uint64_t size_class) {
+    return size_class < SLAB_CLASSES ? class_sizes[size_class] : 0;
+}
+
+void *cf_slab_alloc(CF_HeapStats *stats, uint64_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        LargeBlock *block = size <= SIZE_MAX - sizeof(LargeBlock) ? malloc(sizeof(LargeBlock) + size) : NULL;
+        if (block == NULL) {
+            return NULL;
+        }
+        block->size = size;
+        block->prev = NULL;
+        pthread_mutex_lock(&large_lock);
+        block->next = large_blocks;
+        if (large_blocks != NULL) {
+            large_blocks->prev = block;
+        }
+        large_blocks = block;
+        pthread_mutex_unlock(&large_lock);
+        stats->live_bytes += (int64_t) size;
+        stats->allocations[SLAB_CLASSES]++;
+        return (uint8_t *) block + sizeof(LargeBlock);
+    }
+
+    uint8_t size_class = size_classes[(size + 15) / 16];
+    SlabBlock *block = heap.free[size_class];
+    if (block != NULL) {
+        heap.free[size_class] = block->next;
+        heap.free_size[size_class]--;
+    } else {
+        block = take_from_depot(size_class);
+        if (block == NULL) {
+            block = carve(size_class);
+            if (block == NULL) {
+                return NULL;
+            }
+        }
+    }
+
+    block->size = class_sizes[size_class];
+    stats->live_bytes += (int64_t) block->size;
+    stats->allocations[size_class]++;
+    return (uint8_t *) block + BLOCK_HEADER;
+}
+
+void cf_slab_free(CF_HeapStats *stats, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    SlabBlock *block = (SlabBlock *) ((uint8_t *) ptr - BLOCK_HEADER);
+    stats->live_bytes -= (int64_t) block->size;
+    if (block->size > SLAB_MAX_SIZE) {
+        LargeBlock *large = (LargeBlock *) ((uint8_t *) ptr - sizeof(LargeBlock));
+        if ((uintptr_t) large >= adopted_start && (uintptr_t) large < adopted_end) {
+            return;
+        }
+        pthread_mutex_lock(&large_lock);
+        if (large->prev != NULL) {
+            large->prev->next = large->next;
+        } else {
+            large_blocks = large->next;
+        }
+        if (large->next != NULL) {
+            large->next->prev = large->prev;
+        }
+        pthread_mutex_unlock(&large_lock);
+        free(large);
+        return;
+    }
+
+    uint8_t size_class = size_classes[block->size / 16];
+    if (!heap.registered) {
+        register_heap();
+    }
+    block->next = heap.free[size_class];
+    heap.free[size_class] = block;
+    if (++heap.free_size[size_class] < 2 * SLAB_BATCH) {
+        return;
+    }
+
+    // The newest blocks stay with the thread, they are the most likely ones to be in its cache
+    SlabBlock *last = block;
+    for (uint64_t i = 1; i < SLAB_BATCH; i++) {
+        last = last->next;
+    }
+    SlabBlock *batch = last->next;
+    last->next = NULL;
+    heap.free_size[size_class] = SLAB_BATCH;
+    give_to_depot(size_class, batch, SLAB_BATCH);
+}
+
+void cf_slab_visit(void (*visit)(void *context, void *start, uint64_t size), void *context) {
+    pthread_mutex_lock(&depot_lock);
+    for (SlabChunk *chunk = chunks; chunk != NULL; chunk = chunk->next) {
+        visit(context, chunk, SLAB_CHUNK_SIZE);
+    }
+    pthread_mutex_unlock(&depot_lock);
+
+    pthread_mutex_lock(&large_lock);
+    for (LargeBlock *block = large_blocks; block != NULL; block = block->next) {
+        visit(context, block, sizeof(LargeBlock) + block->size);
+    }
+    pthread_mutex_unlock(&large_lock);
+}
+
+void cf_slab_adopt(void *start, uint64_t size) {
+    adopted_start = (uintptr_t) start;
+    adopted_end = (uintptr_t) start + size;
+}
@@ -0,0 +1,47 @@
+#ifndef CF_SLAB_H
+#define CF_SLAB_H
+
+#include <inttypes.h>
+
+// Allocator of PUSHARRAY and the malloc interrupt. Blocks up to SLAB_MAX_SIZE bytes are rounded up to a size class and
+// carved from chunks of SLAB_CHUNK_SIZE bytes; freed blocks go to a free list of the freeing thread and are handed out
+// again by the next allocation of the same class, without a lock. Larger blocks are taken from malloc.
+//
+// Free lists that grow past 2 * SLAB_BATCH blocks give SLAB_BATCH of them to a shared depot, which refills the lists
+// of threads that run dry, so a thread that only frees does not hoard the blocks of a thread that only allocates. The
+// lists of a thread that ends go to the depot as well. Chunks are never returned to the system.
+//
+// Every block starts with one Word holding its size, so blocks are aligned to 8 bytes. Chunks and large blocks are
+// linked, so a snapshot can copy every block that may still be in use.
+
+#define SLAB_CLASSES 12
+#define SLAB_MAX_SIZE 1024
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_BATCH 64
+
+// Allocation statistics of a machine, counted by the machine that allocates or frees a block. A block allocated by
+// one machine and freed by another therefore moves live bytes from the first machine to the second.
+typedef struct CF_HeapStats {
+    // Bytes of the blocks allocated and not yet freed, rounded up to the size class
+    int64_t live_bytes;
+    // Allocations per size class, the last entry counts the blocks larger than SLAB_MAX_SIZE
+    uint64_t allocations[SLAB_CLASSES + 1];
+} CF_HeapStats;
+
+// Payload size of a size class, class SLAB_CLASSES stands for the large blocks and has no fixed size
+uint64_t cf_slab_class_size(uint64_t size_class);
+
+// Returns a block of at least size bytes or NULL if no memory is left
+void *cf_slab_alloc(CF_HeapStats *stats, uint64_t size);
+
+// Releases a block of cf_slab_alloc, on any thread. NULL is ignored.
+void cf_slab_free(CF_HeapStats *stats, void *ptr);
+
+// Calls visit with the range of every chunk and every large block, including the headers
+void cf_slab_visit(void (*visit)(void *context, void *start, uint64_t size), void *context);
+
+// Marks a mapped snapshot image, large blocks inside it are counted as freed but not given back to the system. Chunks
+// and blocks of the image are not visited by cf_slab_visit.
+void cf_slab_adopt(void *start, uint64_t size);
+
+#endif
@@ -0,0 +1,554 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+#define FNV_OFFSET UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t fnv_hash(uint64_t hash, const void *data, uint64_t size) {
+    const uint8_t *bytes = data;
+    for (uint64_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t cf_snapshot_key(const void *data, uint64_t size) {
+    // Superinstructions and the layout of the image change between builds of the VM, so the build takes part
+    static const char build[] = __DATE__ " " __TIME__;
+    return fnv_hash(fnv_hash(FNV_OFFSET, data, size), build, sizeof(build));
+}
+
+#ifdef CF_SNAPSHOT
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_MAGIC "CFSI"
+#define IMAGE_VERSION 1
+// Copied ranges keep their address modulo this, so every aligned word stays aligned in the image
+#define IMAGE_ALIGNMENT 16
+
+// Library as stored in the image, ranges are given by their offset in the image and 0 stands for none
+typedef struct {
+    uint64_t program;
+    uint64_t program_size;
+    uint64_t call_cache_size;
+    uint64_t address_pool;
+    uint64_t symbols;
+    uint64_t symbol_size;
+    uint64_t symbol_index;
+    uint64_t symbol_index_size;
+    uint64_t memory;
+    uint64_t memory_size;
+    uint64_t path;
+    uint64_t verified;
+} ImageLibrary;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    // Sizes of the structures copied as they are, a cheap guard against images of other builds
+    uint64_t layout;
+    uint64_t key;
+    // Address the pointers of the image were written for
+    uint64_t base;
+    uint64_t size;
+    uint64_t fixups;
+    uint64_t fixup_size;
+    uint64_t libraries;
+    uint64_t library_size;
+
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t stack_capacity;
+    uint64_t pool_stack;
+    uint64_t pool_stack_size;
+    uint64_t pool_stack_capacity;
+    // Single chunk holding all pool frames and the offset its top points to, both 0 without frames
+    uint64_t arena;
+    uint64_t arena_top;
+
+    uint64_t program_counter;
+    uint64_t program_pool;
+    CF_HeapStats heap;
+} ImageHeader;
+
+#define IMAGE_LAYOUT ((uint64_t) sizeof(Inst) | (uint64_t) sizeof(HashEntry) << 8 | \
+                      (uint64_t) sizeof(CF_Symbol) << 16 | (uint64_t) sizeof(CF_ArenaChunk) << 24 | \
+                      (uint64_t) SLAB_CLASSES << 32 | (uint64_t) sizeof(ImageHeader) << 40)
+
+// Range of the machine copied into the image, words pointing into it are moved along
+typedef struct {
+    uint64_t start;
+    uint64_t size;
+    uint64_t offset;
+} Range;
+
+// Part of the image holding words of the program, every one of them that points into a range is moved
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} Area;
+
+typedef struct {
+    uint8_t *image;
+    uint64_t size;
+    uint64_t capacity;
+
+    Range *ranges;
+    uint64_t range_size;
+    uint64_t range_capacity;
+
+    Area *areas;
+    uint64_t area_size;
+    uint64_t area_capacity;
+
+    uint64_t *fixups;
+    uint64_t fixup_size;
+    uint64_t fixup_capacity;
+
+    int failed;
+} Writer;
+
+// Grows an array of the writer to hold one more element, returns 0 and marks the writer failed if that is impossible
+static int reserve(Writer *writer, void **items, uint64_t *capacity, uint64_t size, size_t item) {
+    if (size < *capacity) {
+        return 1;
+    }
+    uint64_t grown = *capacity == 0 ? 64 : *capacity * 2;
+    void *resized = realloc(*items, grown * item);
+    if (resized == NULL) {
+        writer->failed = 1;
+        return 0;
+    }
+    *items = resized;
+    *capacity = grown;
+    return 1;
+}
+
+// Appends size bytes to the image at an offset congruent to address, zeros for data NULL. Returns the offset.
+static uint64_t append(Writer *writer, const void *data, uint64_t size, uint64_t address) {
+    uint64_t offset = writer->size + ((address - writer->size) & (IMAGE_ALIGNMENT - 1));
+    if (writer->failed) {
+        return 0;
+    }
+    if (offset + size > writer->capacity) {
+        uint64_t capacity = writer->capacity == 0 ? 64 * 1024 : writer->capacity;
+        while (capacity < offset + size) {
+            capacity *= 2;
+        }
+        uint8_t *image = realloc(writer->image, capacity);
+        if (image == NULL) {
+            writer->failed = 1;
+            return 0;
+        }
+        writer->image = image;
+        writer->capacity = capacity;
+    }
+    memset(writer->image + writer->size, 0, offset - writer->size);
+    if (data == NULL) {
+        memset(writer->image + offset, 0, size);
+    } else if (size != 0) {
+        memcpy(writer->image + offset, data, size);
+    }
+    writer->size = offset + size;
+    return offset;
+}
+
+static void add_area(Writer *writer, uint64_t offset, uint64_t size) {
+    if (reserve(writer, (void **) &writer->areas, &writer->area_capacity, writer->area_size, sizeof(Area))) {
+        writer->areas[writer->area_size++] = (Area) {offset, size};
+    }
+}
+
+// Copies a range of the machine into the image, words of the program inside it are moved if scan is set. Returns
+// the offset of the copy or 0 for an empty range.
+static uint64_t copy_range(Writer *writer, const void *start, uint64_t size, int scan) {
+    if (start == NULL || size == 0) {
+        return 0;
+    }
+    uint64_t offset = append(writer, start, size, (uint64_t) start);
+    if (writer->failed ||
+        !reserve(writer, (void **) &writer->ranges, &writer->range_capacity, writer->range_size, sizeof(Range))) {
+        return 0;
+    }
+    writer->ranges[writer->range_size++] = (Range) {(uint64_t) start, size, offset};
+    if (scan) {
+        add_area(writer, offset, size);
+    }
+    return offset;
+}
+
+static void add_fixup(Writer *writer, uint64_t offset) {
+    if (reserve(writer, (void **) &writer->fixups, &writer->fixup_capacity, writer->fixup_size, sizeof(uint64_t))) {
+        writer->fixups[writer->fixup_size++] = offset;
+    }
+}
+
+// Stores the address the image will have for offset into the word at position and records the fix-up
+static void write_pointer(Writer *writer, uint64_t position, uint64_t offset) {
+    uint64_t address = SNAPSHOT_BASE + offset;
+    memcpy(writer->image + position, &address, sizeof(address));
+    add_fixup(writer, position);
+}
+
+static void copy_heap_range(void *context, void *start, uint64_t size) {
+    copy_range(context, start, size, 1);
+}
+
+static int compare_ranges(const void *a, const void *b) {
+    uint64_t left = ((const Range *) a)->start;
+    uint64_t right = ((const Range *) b)->start;
+    return left < right ? -1 : left > right;
+}
+
+static const Range *find_range(const Writer *writer, uint64_t address) {
+    uint64_t low = 0;
+    uint64_t high = writer->range_size;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        const Range *range = &writer->ranges[middle];
+        if (address < range->start) {
+            high = middle;
+        } else if (address - range->start >= range->size) {
+            low = middle + 1;
+        } else {
+            return range;
+        }
+    }
+    return NULL;
+}
+
+// Moves every word of the areas that points into a copied range to its place in the image
+static void move_pointers(Writer *writer) {
+    qsort(writer->ranges, writer->range_size, sizeof(Range), compare_ranges);
+    for (uint64_t i = 1; i < writer->range_size; i++) {
+        if (writer->ranges[i - 1].start + writer->ranges[i - 1].size > writer->ranges[i].start) {
+            // A word inside both ranges could not be moved to a single place
+            writer->failed = 1;
+            return;
+        }
+    }
+
+    for (uint64_t i = 0; i < writer->area_size; i++) {
+        const Area *area = &writer->areas[i];
+        // Words are counted from the start of the area: blocks and frames are aligned anyway, and the memory of a
+        // library lies wherever the loader found it while the program places its words relative to its start
+        for (uint64_t position = area->offset; position + sizeof(Word) <= area->offset + area->size;
+             position += sizeof(Word)) {
+            uint64_t value;
+            memcpy(&value, writer->image + position, sizeof(value));
+            const Range *range = find_range(writer, value);
+            if (range != NULL) {
+                write_pointer(writer, position, range->offset + (value - range->start));
+            }
+        }
+    }
+}
+
+static uint64_t copy_string(Writer *writer, const char *string) {
+    return string == NULL ? 0 : copy_range(writer, string, strlen(string) + 1, 0);
+}
+
+static void copy_library(Writer *writer, const CF_Library *library, uint64_t position) {
+    ImageLibrary stored = {0};
+    stored.program = copy_range(writer, library->program, library->program_size * sizeof(Inst), 0);
+    stored.program_size = library->program_size;
+    stored.call_cache_size = library->call_cache_size;
+    if (library->address_pool != NULL) {
+        stored.address_pool = copy_range(writer, library->address_pool,
+                                         sizeof(HashMap) + library->address_pool->size * sizeof(HashEntry), 0);
+    }
+    stored.symbols = copy_range(writer, library->symbols, library->symbol_size * sizeof(CF_Symbol), 0);
+    stored.symbol_size = library->symbol_size;
+    for (uint32_t i = 0; i < library->symbol_size && !writer->failed; i++) {
+        uint64_t name = copy_string(writer, library->symbols[i].name);
+        uint64_t field = stored.symbols + i * sizeof(CF_Symbol) + offsetof(CF_Symbol, name);
+        if (name != 0) {
+            write_pointer(writer, field, name);
+        }
+    }
+    stored.symbol_index = copy_range(writer, library->symbol_index, library->symbol_index_size * sizeof(uint32_t), 0);
+    stored.symbol_index_size = library->symbol_index_size;
+    stored.memory = copy_range(writer, library->memory, library->memory_size, 1);
+    stored.memory_size = library->memory_size;
+    stored.path = copy_string(writer, library->path);
+    stored.verified = library->verified;
+    if (!writer->failed) {
+        memcpy(writer->image + position, &stored, sizeof(stored));
+    }
+}
+
+// Copies the pool frames into one chunk, oldest chunk first. Fills in arena and arena_top of the header.
+static void copy_arena(Writer *writer, const CF_Arena *arena, ImageHeader *header) {
+    if (arena->chunk == NULL) {
+        return;
+    }
+    CF_ArenaChunk *first = arena->chunk;
+    while (first->prev != NULL) {
+        first = first->prev;
+    }
+
+    CF_ArenaChunk stored = {0};
+    stored.mapped = 1;
+    uint64_t offset = append(writer, &stored, sizeof(stored), 0);
+    // Frames are aligned to ARENA_ALIGNMENT and fill the chunks up to a multiple of it, so the copies line up
+    uint64_t end = offset + offsetof(CF_ArenaChunk, data);
+    for (CF_ArenaChunk *chunk = first;; chunk = chunk->next) {
+        const uint8_t *top = chunk == arena->chunk ? arena->top : chunk->end;
+        uint64_t size = (uint64_t) (top - chunk->data);
+        uint64_t start = copy_range(writer, chunk->data, size, 1);
+        if (size != 0 && start != end) {
+            writer->failed = 1;
+        }
+        end += size;
+        if (chunk == arena->chunk) {
+            break;
+        }
+    }
+    if (writer->failed) {
+        return;
+    }
+    header->arena = offset;
+    header->arena_top = end;
+    write_pointer(writer, offset + offsetof(CF_ArenaChunk, end), end);
+}
+
+static int write_file(const char *path, const uint8_t *data, uint64_t size) {
+    size_t length = strlen(path);
+    char *temporary = malloc(length + 8);
+    if (temporary == NULL) {
+        return 0;
+    }
+    // Written beside the image and renamed, so a process starting meanwhile never maps half an image
+    snprintf(temporary, length + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(temporary);
+    int written = fd >= 0;
+    for (uint64_t done = 0; written && done < size;) {
+        ssize_t result = write(fd, data + done, size - done);
+        if (result > 0) {
+            done += (uint64_t) result;
+        } else {
+            written = 0;
+        }
+    }
+    if (fd >= 0 && close(fd) != 0) {
+        written = 0;
+    }
+    if (written && rename(temporary, path) != 0) {
+        written = 0;
+    }
+    if (!written && fd >= 0) {
+        unlink(temporary);
+    }
+    free(temporary);
+    return written;
+}
+
+int cf_snapshot(const CF_Machine *cf, const char *path) {
+    const CF_Runtime *runtime = cf->runtime;
+    if (atomic_load(&runtime->scheduler) != NULL || cf->task != NULL) {
+        return 0;
+    }
+    uint64_t library_size = atomic_load(&runtime->library_size);
+    for (uint64_t i = 0; i < library_size; i++) {
+        if (cf_runtime_library(runtime, i)->mapped) {
+            // The allocator does not know the blocks of the first image
+            return 0;
+        }
+    }
+
+    Writer writer = {0};
+    ImageHeader header = {0};
+    append(&writer, &header, sizeof(header), 0);
+    header.libraries = append(&writer, NULL, library_size * sizeof(ImageLibrary), 0);
+    header.library_size = library_size;
+    for (uint64_t i = 0; i < library_size && !writer.failed; i++) {
+        copy_library(&writer, cf_runtime_library(runtime, i), header.libraries + i * sizeof(ImageLibrary));
+    }
+
+    header.stack = append(&writer, cf->stack, cf->stack_size * sizeof(Word), 0);
+    add_area(&writer, header.stack, cf->stack_size * sizeof(Word));
+    header.stack_size = cf->stack_size;
+    header.stack_capacity = cf->stack_capacity;
+    header.pool_stack = append(&writer, cf->pool_stack, cf->pool_stack_size * sizeof(Word), 0);
+    add_area(&writer, header.pool_stack, cf->pool_stack_size * sizeof(Word));
+    header.pool_stack_size = cf->pool_stack_size;
+    header.pool_stack_capacity = cf->pool_stack_capacity;
+    copy_arena(&writer, &cf->pool_arena, &header);
+    cf_slab_visit(copy_heap_range, &writer);
+    move_pointers(&writer);
+
+    header.fixups = append(&writer, writer.fixups, writer.fixup_size * sizeof(uint64_t), 0);
+    header.fixup_size = writer.fixup_size;
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.layout = IMAGE_LAYOUT;
+    header.key = runtime->snapshot_key;
+    header.base = SNAPSHOT_BASE;
+    header.size = writer.size;
+    header.program_counter = cf->program_counter;
+    header.program_pool = cf->program_pool;
+    header.heap = cf->heap;
+
+    int written = 0;
+    if (!writer.failed) {
+        memcpy(writer.image, &header, sizeof(header));
+        written = write_file(path, writer.image, writer.size);
+    }
+    free(writer.image);
+    free(writer.ranges);
+    free(writer.areas);
+    free(writer.fixups);
+    return written;
+}
+
+// Checks that size bytes at offset lie inside the image
+static int inside(const ImageHeader *header, uint64_t offset, uint64_t size) {
+    return offset <= header->size && size <= header->size - offset;
+}
+
+static int check_image(const ImageHeader *header, uint64_t size, uint64_t key) {
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != IMAGE_VERSION ||
+        header->layout != IMAGE_LAYOUT || header->key != key || header->size != size ||
+        header->library_size == 0 || header->library_size > LIBRARY_CAPACITY ||
+        header->program_pool >= header->library_size ||
+        !inside(header, header->fixups, header->fixup_size * sizeof(uint64_t)) ||
+        !inside(header, header->libraries, header->library_size * sizeof(ImageLibrary)) ||
+        !inside(header, header->stack, header->stack_size * sizeof(Word)) ||
+        !inside(header, header->pool_stack, header->pool_stack_size * sizeof(Word)) ||
+        !inside(header, header->arena, sizeof(CF_ArenaChunk)) || header->arena_top > header->size) {
+        return 0;
+    }
+
+    const ImageLibrary *libraries = (const ImageLibrary *) ((const uint8_t *) header + header->libraries);
+    for (uint64_t i = 0; i < header->library_size; i++) {
+        const ImageLibrary *library = &libraries[i];
+        if (library->program_size > header->size / sizeof(Inst) ||
+            !inside(header, library->program, library->program_size * sizeof(Inst)) ||
+            !inside(header, library->address_pool, sizeof(HashMap)) ||
+            library->symbol_size > header->size / sizeof(CF_Symbol) ||
+            !inside(header, library->symbols, library->symbol_size * sizeof(CF_Symbol)) ||
+            library->symbol_index_size > header->size / sizeof(uint32_t) ||
+            !inside(header, library->symbol_index, library->symbol_index_size * sizeof(uint32_t)) ||
+            !inside(header, library->memory, library->memory_size) || library->path > header->size) {
+            return 0;
+        }
+    }
+
+    const uint64_t *fixups = (const uint64_t *) ((const uint8_t *) header + header->fixups);
+    for (uint64_t i = 0; i < header->fixup_size; i++) {
+        if (!inside(header, fixups[i], sizeof(uint64_t))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *image_at(uint8_t *image, uint64_t offset) {
+    return offset == 0 ? NULL : image + offset;
+}
+
+CF_Machine *cf_restore(CF_Runtime *runtime, const char *path) {
+    if (atomic_load(&runtime->library_size) != 0) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(ImageHeader)) {
+        close(fd);
+        return NULL;
+    }
+    uint64_t size = (uint64_t) info.st_size;
+    // Private and writable: the memory of the libraries and the heap blocks are written by the program, and the
+    // pages stay with this process
+    uint8_t *image = mmap((void *) SNAPSHOT_BASE, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+    ImageHeader *header = (ImageHeader *) image;
+    if (!check_image(header, size, runtime->snapshot_key)) {
+        munmap(image, size);
+        return NULL;
+    }
+
+    uint64_t distance = (uint64_t) image - header->base;
+    if (distance != 0) {
+        const uint64_t *fixups = (const uint64_t *) (image + header->fixups);
+        for (uint64_t i = 0; i < header->fixup_size; i++) {
+            uint64_t value;
+            memcpy(&value, image + fixups[i], sizeof(value));
+            value += distance;
+            memcpy(image + fixups[i], &value, sizeof(value));
+        }
+    }
+    cf_slab_adopt(image, size);
+
+    const ImageLibrary *libraries = (const ImageLibrary *) (image + header->libraries);
+    for (uint64_t i = 0; i < header->library_size; i++) {
+        const ImageLibrary *stored = &libraries[i];
+        CF_Library library = {0};
+        library.program = image_at(image, stored->program);
+        library.program_size = stored->program_size;
+        library.verified = (uint8_t) stored->verified;
+        library.call_cache_size = stored->call_cache_size;
+        library.address_pool = image_at(image, stored->address_pool);
+        library.symbols = image_at(image, stored->symbols);
+        library.symbol_size = (uint32_t) stored->symbol_size;
+        library.symbol_index = image_at(image, stored->symbol_index);
+        library.symbol_index_size = (uint32_t) stored->symbol_index_size;
+        library.memory = image_at(image, stored->memory);
+        library.memory_size = stored->memory_size;
+        library.path = image_at(image, stored->path);
+        library.mapped = 1;
+        uint64_t index;
+        if (cf_runtime_add_library(runtime, library, &index) != STATUS_OK) {
+            return NULL;
+        }
+    }
+
+    CF_Machine *cf;
+    if (cf_machine_create(runtime, header->stack_capacity, header->pool_stack_capacity, &cf) != STATUS_OK) {
+        return NULL;
+    }
+    if (header->stack_size > cf->stack_capacity || header->pool_stack_size > cf->pool_stack_capacity) {
+        cf_machine_destroy(cf);
+        return NULL;
+    }
+    memcpy(cf->stack, image + header->stack, header->stack_size * sizeof(Word));
+    cf->stack_size = header->stack_size;
+    memcpy(cf->pool_stack, image + header->pool_stack, header->pool_stack_size * sizeof(Word));
+    cf->pool_stack_size = header->pool_stack_size;
+    if (header->arena != 0) {
+        cf->pool_arena.chunk = (CF_ArenaChunk *) (image + header->arena);
+        cf->pool_arena.top = image + header->arena_top;
+    }
+    cf->program_counter = header->program_counter;
+    cf->program_pool = (uint16_t) header->program_pool;
+    cf->heap = header->heap;
+    return cf;
+}
+
+#else
+
+int cf_snapshot(const CF_Machine *cf, const char *path) {
+    (void) cf;
+    (void) path;
+    return 0;
+}
+
+CF_Machine *cf_restore(CF_Runtime *runtime, const char *path) {
+    (void) runtime;
+    (void) path;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef CF_SNAPSHOT_H
+#define CF_SNAPSHOT_H
+
+#include "machine.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+// Snapshots are written as files and restored with mmap, without it cf_snapshot and cf_restore always fail
+#define CF_SNAPSHOT
+#endif
+
+// Environment variable naming the snapshot image. The executable restores the image at start if it exists and was
+// taken of the same program, otherwise the snapshot interrupt writes it.
+#define SNAPSHOT_ENV "CF_SNAPSHOT"
+
+// Address images are laid out for. An image mapped there is used as it is, anywhere else its pointers are moved
+// by the distance first.
+#define SNAPSHOT_BASE UINT64_C(0x6c0000000000)
+
+// Pushed by the snapshot interrupt for a machine that was restored from the image written by it
+#define SNAPSHOT_RESUMED 2
+
+// A snapshot image holds a stopped machine together with everything it may point to: the libraries of the runtime
+// with their programs, address pools, symbols and memory, the operand and pool stacks, the pool frames and every
+// block of the allocator of PUSHARRAY and the malloc interrupt, see slab.h. The image is read with a single mmap,
+// its programs are verified and fused already, so a restored machine skips loading and whatever the program ran
+// before the snapshot.
+//
+// Words are untyped, so the image takes every word on the stacks, in the pool frames, in the memory of the
+// libraries and in the allocated blocks that holds an address inside one of the copied ranges for a pointer and
+// records it in a fix-up table. Anything else the machine pointed to, like open files, mapped files or the standard
+// streams, is not part of the image and has to be fetched again after the snapshot.
+
+// Hash of the program image, stored as runtime->snapshot_key before taking or restoring a snapshot
+uint64_t cf_snapshot_key(const void *data, uint64_t size);
+
+// Writes the machine and its runtime to path, the program continues at the current program counter of the machine
+// after a restore. Fails and returns 0 if other machines run on the runtime, if the runtime was restored itself or
+// if the file could not be written, returns 1 otherwise. The file is replaced atomically.
+int cf_snapshot(const CF_Machine *cf, const char *path);
+
+// Maps the image at path and adds its libraries to runtime, which has to be empty. The interrupt table and the JIT
+// flag of the runtime are kept, the image is released only with the process. Returns NULL if there is no image at
+// path or it was taken with another snapshot key or build.
+CF_Machine *cf_restore(CF_Runtime *runtime, const char *path);
+
+#endif
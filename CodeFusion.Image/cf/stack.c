@@ -0,0 +1,165 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include "stack.h"
+
+#ifdef CF_GUARD_PAGES
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static uint64_t stack_capacity_from_env(const char *name, uint64_t fallback) {
+    const char *value = getenv(name);
+    if (value == NULL) {
+        return fallback;
+    }
+
+    char *end;
+    unsigned long long capacity = strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || capacity == 0) {
+        return fallback;
+    }
+    return (uint64_t) capacity;
+}
+
+#ifdef CF_GUARD_PAGES
+
+static _Thread_local CF_GuardScope *current_scope = NULL;
+static atomic_int handler_installed = 0;
+static struct sigaction previous_segv;
+static struct sigaction previous_bus;
+
+static size_t page_size(void) {
+    // Cached by the first allocation so the fault handler does not have to ask the system
+    static size_t size = 0;
+    if (size == 0) {
+        size = (size_t) sysconf(_SC_PAGESIZE);
+    }
+    return size;
+}
+
+static size_t region_size(uint64_t capacity) {
+    size_t page = page_size();
+    return ((size_t) capacity * sizeof(Word) + page - 1) / page * page;
+}
+
+static int in_guard(const Word *stack, uint64_t capacity, const void *address) {
+    const uint8_t *guard = (const uint8_t *) (stack + capacity);
+    return stack != NULL && (const uint8_t *) address >= guard && (const uint8_t *) address < guard + page_size();
+}
+
+static void on_fault(int signal, siginfo_t *info, void *context) {
+    (void) context;
+    CF_GuardScope *scope = current_scope;
+    if (scope != NULL) {
+        CF_Machine *cf = scope->machine;
+        if (in_guard(cf->stack, cf->stack_capacity, info->si_addr)) {
+            scope->status = STATUS_STACK_OVERFLOW;
+            longjmp(scope->jump, 1);
+        }
+        if (in_guard(cf->pool_stack, cf->pool_stack_capacity, info->si_addr)) {
+            scope->status = STATUS_CALL_STACK_OVERFLOW;
+            longjmp(scope->jump, 1);
+        }
+    }
+
+    // Not one of our guard pages, returning with the previous handler in place repeats the fault there
+    sigaction(signal, signal == SIGSEGV ? &previous_segv : &previous_bus, NULL);
+}
+
+static void install_handler(void) {
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&handler_installed, &expected, 1)) {
+        return;
+    }
+
+    struct sigaction action = {0};
+    action.sa_sigaction = on_fault;
+    // SA_NODEFER keeps the signal mask untouched so the handler can leave with a plain longjmp
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_segv);
+    sigaction(SIGBUS, &action, &previous_bus);
+}
+
+static Word *map_stack(uint64_t *capacity) {
+    size_t size = region_size(*capacity + 1);
+    uint8_t *region = mmap(NULL, size + page_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                           -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(region + size, page_size(), PROT_NONE) != 0) {
+        munmap(region, size + page_size());
+        return NULL;
+    }
+
+    *capacity = size / sizeof(Word) - 1;
+    return (Word *) region + 1;
+}
+
+static void unmap_stack(Word *stack, uint64_t capacity) {
+    if (stack != NULL) {
+        munmap(stack - 1, region_size(capacity + 1) + page_size());
+    }
+}
+
+void cf_guard_enter(CF_GuardScope *scope, CF_Machine *cf) {
+    install_handler();
+    scope->machine = cf;
+    scope->previous = current_scope;
+    current_scope = scope;
+}
+
+void cf_guard_leave(CF_GuardScope *scope) {
+    current_scope = scope->previous;
+}
+
+#else
+
+static Word *map_stack(uint64_t *capacity) {
+    Word *region = malloc((*capacity + 1) * sizeof(Word));
+    return region == NULL ? NULL : region + 1;
+}
+
+static void unmap_stack(Word *stack, uint64_t capacity) {
+    (void) capacity;
+    if (stack != NULL) {
+        free(stack - 1);
+    }
+}
+
+#endif
+
+Status cf_create_stacks(CF_Machine *cf, uint64_t stack_capacity, uint64_t pool_stack_capacity) {
+    if (stack_capacity == 0) {
+        stack_capacity = stack_capacity_from_env(STACK_SIZE_ENV, STACK_CAPACITY);
+    }
+    if (pool_stack_capacity == 0) {
+        pool_stack_capacity = stack_capacity_from_env(CALLSTACK_SIZE_ENV, CALLSTACK_CAPACITY);
+    }
+
+    cf->stack = map_stack(&stack_capacity);
+    if (cf->stack == NULL) {
+        return STATUS_STACK_OVERFLOW;
+    }
+    cf->stack_capacity = stack_capacity;
+
+    cf->pool_stack = map_stack(&pool_stack_capacity);
+    if (cf->pool_stack == NULL) {
+        cf_destroy_stacks(cf);
+        return STATUS_CALL_STACK_OVERFLOW;
+    }
+    cf->pool_stack_capacity = pool_stack_capacity;
+    return STATUS_OK;
+}
+
+void cf_destroy_stacks(CF_Machine *cf) {
+    unmap_stack(cf->stack, cf->stack_capacity);
+    unmap_stack(cf->pool_stack, cf->pool_stack_capacity);
+    cf->stack = NULL;
+    cf->stack_capacity = 0;
+    cf->pool_stack = NULL;
+    cf->pool_stack_capacity = 0;
+}
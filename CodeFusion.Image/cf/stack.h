@@ -0,0 +1,42 @@
+#ifndef CF_STACK_H
+#define CF_STACK_H
+
+#include <setjmp.h>
+#include "machine.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+// The operand stack and the pool stack are followed by an inaccessible guard page. Running past their end faults
+// and the fault is turned into a status, so the engine does not compare the stack size on every push.
+#define CF_GUARD_PAGES
+#endif
+
+// Environment variables overriding the default number of entries of the stacks
+#define STACK_SIZE_ENV "CF_STACK_SIZE"
+#define CALLSTACK_SIZE_ENV "CF_CALLSTACK_SIZE"
+
+// Allocates the operand stack and the pool stack of the machine. A capacity of 0 takes the value from the
+// environment or falls back to STACK_CAPACITY and CALLSTACK_CAPACITY, capacities are rounded up to whole pages.
+// Each stack has one scratch entry before its start, so stack[-1] can be written and read without checks.
+Status cf_create_stacks(CF_Machine *cf, uint64_t stack_capacity, uint64_t pool_stack_capacity);
+
+void cf_destroy_stacks(CF_Machine *cf);
+
+#ifdef CF_GUARD_PAGES
+
+typedef struct CF_GuardScope {
+    jmp_buf jump;
+    volatile Status status;
+    CF_Machine *machine;
+    struct CF_GuardScope *previous;
+} CF_GuardScope;
+
+// While the scope is active on the current thread, a fault on a guard page of the machine sets scope->status to
+// STATUS_STACK_OVERFLOW or STATUS_CALL_STACK_OVERFLOW and jumps back to scope->jump. The registers of the machine are
+// not written back in that case.
+void cf_guard_enter(CF_GuardScope *scope, CF_Machine *cf);
+
+void cf_guard_leave(CF_GuardScope *scope);
+
+#endif
+
+#endif
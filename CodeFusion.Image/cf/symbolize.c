@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symbolize.h"
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+CF_Functions cf_collect_functions(const CF_Library *library) {
+    CF_Functions functions = {0};
+    size_t capacity = 1 + library->symbol_size + (library->address_pool != NULL ? library->address_pool->size : 0);
+    functions.starts = malloc(capacity * sizeof(uint64_t));
+    if (functions.starts == NULL) {
+        return functions;
+    }
+
+    functions.starts[functions.size++] = 0;
+    for (uint32_t i = 0; i < library->symbol_size; i++) {
+        functions.starts[functions.size++] = library->symbols[i].address;
+    }
+    if (library->address_pool != NULL) {
+        for (size_t i = 0; i < library->address_pool->size; i++) {
+            if (library->address_pool->entries[i].used) {
+                functions.starts[functions.size++] = library->address_pool->entries[i].key;
+            }
+        }
+    }
+
+    qsort(functions.starts, functions.size, sizeof(uint64_t), compare_u64);
+    uint64_t unique = 0;
+    for (uint64_t i = 0; i < functions.size; i++) {
+        if (unique == 0 || functions.starts[unique - 1] != functions.starts[i]) {
+            functions.starts[unique++] = functions.starts[i];
+        }
+    }
+    functions.size = unique;
+    return functions;
+}
+
+void cf_free_functions(CF_Functions *functions) {
+    free(functions->starts);
+    functions->starts = NULL;
+    functions->size = 0;
+}
+
+uint64_t cf_function_start(const CF_Functions *functions, uint64_t pc) {
+    if (functions->size == 0) {
+        return pc;
+    }
+
+    // The starts always contain 0
+    uint64_t low = 0;
+    uint64_t high = functions->size;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (functions->starts[middle] <= pc) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return functions->starts[low];
+}
+
+void cf_write_function_name(FILE *file, const CF_Library *library, uint64_t start) {
+    if (library != NULL && library->path != NULL) {
+        const char *slash = strrchr(library->path, '/');
+        fprintf(file, "%s:", slash != NULL ? slash + 1 : library->path);
+    }
+    for (uint32_t i = 0; library != NULL && i < library->symbol_size; i++) {
+        if (library->symbols[i].address == start) {
+            fputs(library->symbols[i].name, file);
+            return;
+        }
+    }
+    fprintf(file, "pc_%"PRIu64, start);
+}
@@ -0,0 +1,25 @@
+#ifndef CF_SYMBOLIZE_H
+#define CF_SYMBOLIZE_H
+
+#include "machine.h"
+
+// Sorted start addresses of the functions of a library, used by the profilers to attribute program counters
+typedef struct {
+    uint64_t *starts;
+    uint64_t size;
+} CF_Functions;
+
+// A function starts at every label with a pool frame (the keys of the address pool), at every exported symbol and at
+// the start of the program. The result is empty if it could not be allocated.
+CF_Functions cf_collect_functions(const CF_Library *library);
+
+void cf_free_functions(CF_Functions *functions);
+
+// Start of the function containing pc, pc itself if the functions are empty
+uint64_t cf_function_start(const CF_Functions *functions, uint64_t pc);
+
+// Writes "library:symbol" or "library:pc_start", the library is left out for the main program. A NULL library only
+// writes the program counter.
+void cf_write_function_name(FILE *file, const CF_Library *library, uint64_t start);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+#include "opcode.h"
+
+#ifdef CF_VECTOR_SIMD
+#include <immintrin.h>
+#endif
+
+#define VECTOR_MAPS (INST_VMAX - INST_VADD + 1)
+
+typedef void (*MapKernel)(void *out, const void *a, const void *b, uint64_t length);
+typedef Word (*ReduceKernel)(const void *a, const void *b, uint64_t length);
+
+// Kernels of one instruction set. Rows of map follow the opcodes from VADD to VMAX, columns the element types.
+typedef struct VectorKernels {
+    MapKernel map[VECTOR_MAPS][VECTOR_TYPES];
+    ReduceKernel sum[VECTOR_TYPES];
+    ReduceKernel dot[VECTOR_TYPES];
+} VectorKernels;
+
+#define SCALAR_MAP(name, T, expr)                                                                \
+static void name(void *out_data, const void *a_data, const void *b_data, uint64_t length) {      \
+    T *out = out_data;                                                                           \
+    const T *a = a_data;                                                                         \
+    const T *b = b_data;                                                                         \
+    for (uint64_t i = 0; i < length; i++) {                                                      \
+        out[i] = (expr);                                                                         \
+    }                                                                                            \
+}
+
+#define SCALAR_REDUCE(name, T, expr, result)                                                     \
+static Word name(const void *a_data, const void *b_data, uint64_t length) {                      \
+    const T *a = a_data;                                                                         \
+    const T *b = b_data;                                                                         \
+    (void) b;                                                                                    \
+    T sum = 0;                                                                                   \
+    for (uint64_t i = 0; i < length; i++) {                                                      \
+        sum += (expr);                                                                           \
+    }                                                                                            \
+    return (result);                                                                             \
+}
+
+// Signed and unsigned integers only differ in their order, everything else runs on the unsigned kernels
+SCALAR_MAP(add_u64, uint64_t, a[i] + b[i])
+SCALAR_MAP(sub_u64, uint64_t, a[i] - b[i])
+SCALAR_MAP(mul_u64, uint64_t, a[i] * b[i])
+SCALAR_MAP(fma_u64, uint64_t, out[i] + a[i] * b[i])
+SCALAR_MAP(min_u64, uint64_t, a[i] < b[i] ? a[i] : b[i])
+SCALAR_MAP(max_u64, uint64_t, a[i] > b[i] ? a[i] : b[i])
+SCALAR_MAP(min_i64, int64_t, a[i] < b[i] ? a[i] : b[i])
+SCALAR_MAP(max_i64, int64_t, a[i] > b[i] ? a[i] : b[i])
+SCALAR_REDUCE(sum_u64, uint64_t, a[i], WORD_U64(sum))
+SCALAR_REDUCE(dot_u64, uint64_t, a[i] * b[i], WORD_U64(sum))
+
+// Minimum and maximum are written the way MINPD and MAXPD behave, the second operand wins if either one is NaN
+SCALAR_MAP(add_f64, double, a[i] + b[i])
+SCALAR_MAP(sub_f64, double, a[i] - b[i])
+SCALAR_MAP(mul_f64, double, a[i] * b[i])
+SCALAR_MAP(fma_f64, double, out[i] + a[i] * b[i])
+SCALAR_MAP(min_f64, double, a[i] < b[i] ? a[i] : b[i])
+SCALAR_MAP(max_f64, double, a[i] > b[i] ? a[i] : b[i])
+SCALAR_REDUCE(sum_f64, double, a[i], WORD_F64(sum))
+SCALAR_REDUCE(dot_f64, double, a[i] * b[i], WORD_F64(sum))
+
+SCALAR_MAP(add_f32, float, a[i] + b[i])
+SCALAR_MAP(sub_f32, float, a[i] - b[i])
+SCALAR_MAP(mul_f32, float, a[i] * b[i])
+SCALAR_MAP(fma_f32, float, out[i] + a[i] * b[i])
+SCALAR_MAP(min_f32, float, a[i] < b[i] ? a[i] : b[i])
+SCALAR_MAP(max_f32, float, a[i] > b[i] ? a[i] : b[i])
+SCALAR_REDUCE(sum_f32, float, a[i], WORD_F64((double) sum))
+SCALAR_REDUCE(dot_f32, float, a[i] * b[i], WORD_F64((double) sum))
+
+static const VectorKernels scalar_kernels = {
+        .map = {
+                {add_u64, add_u64, add_f64, add_f32},
+                {sub_u64, sub_u64, sub_f64, sub_f32},
+                {mul_u64, mul_u64, mul_f64, mul_f32},
+                {fma_u64, fma_u64, fma_f64, fma_f32},
+                {min_i64, min_u64, min_f64, min_f32},
+                {max_i64, max_u64, max_f64, max_f32},
+        },
+        .sum = {sum_u64, sum_u64, sum_f64, sum_f32},
+        .dot = {dot_u64, dot_u64, dot_f64, dot_f32},
+};
+
+#ifdef CF_VECTOR_SIMD
+
+// The SIMD kernels work on whole vectors of width elements and leave the rest to the scalar kernel. expr combines the
+// vectors x and y, the output vector is loaded by the expression itself if it needs it.
+#define SIMD_MAP(name, target, T, V, width, load, store, expr, rest)                             \
+target static void name(void *out_data, const void *a_data, const void *b_data, uint64_t length) { \
+    T *out = out_data;                                                                           \
+    const T *a = a_data;                                                                         \
+    const T *b = b_data;                                                                         \
+    uint64_t i = 0;                                                                              \
+    for (; i + (width) <= length; i += (width)) {                                                \
+        V x = load(a + i);                                                                       \
+        V y = load(b + i);                                                                       \
+        store(out + i, expr);                                                                    \
+    }                                                                                            \
+    rest(out + i, a + i, b + i, length - i);                                                     \
+}
+
+#define SIMD_REDUCE(name, target, T, V, width, store, zero, step, expr, result)                  \
+target static Word name(const void *a_data, const void *b_data, uint64_t length) {               \
+    const T *a = a_data;                                                                         \
+    const T *b = b_data;                                                                         \
+    (void) b;                                                                                    \
+    V acc = zero();                                                                              \
+    uint64_t i = 0;                                                                              \
+    for (; i + (width) <= length; i += (width)) {                                                \
+        acc = (step);                                                                            \
+    }                                                                                            \
+    T lanes[width];                                                                              \
+    store(lanes, acc);                                                                           \
+    T sum = 0;                                                                                   \
+    for (uint64_t lane = 0; lane < (width); lane++) {                                            \
+        sum += lanes[lane];                                                                      \
+    }                                                                                            \
+    for (; i < length; i++) {                                                                    \
+        sum += (expr);                                                                           \
+    }                                                                                            \
+    return (result);                                                                             \
+}
+
+#define SSE2
+#define AVX2 __attribute__((target("avx2,fma")))
+
+SIMD_MAP(add_f64_sse2, SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd(x, y), add_f64)
+SIMD_MAP(sub_f64_sse2, SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd(x, y), sub_f64)
+SIMD_MAP(mul_f64_sse2, SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd(x, y), mul_f64)
+SIMD_MAP(fma_f64_sse2, SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd,
+         _mm_add_pd(_mm_loadu_pd(out + i), _mm_mul_pd(x, y)), fma_f64)
+SIMD_MAP(min_f64_sse2, SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_min_pd(x, y), min_f64)
+SIMD_MAP(max_f64_sse2, SSE2, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_max_pd(x, y), max_f64)
+SIMD_REDUCE(sum_f64_sse2, SSE2, double, __m128d, 2, _mm_storeu_pd, _mm_setzero_pd,
+            _mm_add_pd(acc, _mm_loadu_pd(a + i)), a[i], WORD_F64(sum))
+SIMD_REDUCE(dot_f64_sse2, SSE2, double, __m128d, 2, _mm_storeu_pd, _mm_setzero_pd,
+            _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))), a[i] * b[i], WORD_F64(sum))
+
+SIMD_MAP(add_f32_sse2, SSE2, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps(x, y), add_f32)
+SIMD_MAP(sub_f32_sse2, SSE2, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_sub_ps(x, y), sub_f32)
+SIMD_MAP(mul_f32_sse2, SSE2, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_mul_ps(x, y), mul_f32)
+SIMD_MAP(fma_f32_sse2, SSE2, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+         _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(x, y)), fma_f32)
+SIMD_MAP(min_f32_sse2, SSE2, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_min_ps(x, y), min_f32)
+SIMD_MAP(max_f32_sse2, SSE2, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_max_ps(x, y), max_f32)
+SIMD_REDUCE(sum_f32_sse2, SSE2, float, __m128, 4, _mm_storeu_ps, _mm_setzero_ps,
+            _mm_add_ps(acc, _mm_loadu_ps(a + i)), a[i], WORD_F64((double) sum))
+SIMD_REDUCE(dot_f32_sse2, SSE2, float, __m128, 4, _mm_storeu_ps, _mm_setzero_ps,
+            _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))), a[i] * b[i],
+            WORD_F64((double) sum))
+
+SIMD_MAP(add_f64_avx2, AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd(x, y), add_f64)
+SIMD_MAP(sub_f64_avx2, AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd(x, y), sub_f64)
+SIMD_MAP(mul_f64_avx2, AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd(x, y), mul_f64)
+SIMD_MAP(fma_f64_avx2, AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd,
+         _mm256_fmadd_pd(x, y, _mm256_loadu_pd(out + i)), fma_f64)
+SIMD_MAP(min_f64_avx2, AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_min_pd(x, y), min_f64)
+SIMD_MAP(max_f64_avx2, AVX2, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_max_pd(x, y), max_f64)
+SIMD_REDUCE(sum_f64_avx2, AVX2, double, __m256d, 4, _mm256_storeu_pd, _mm256_setzero_pd,
+            _mm256_add_pd(acc, _mm256_loadu_pd(a + i)), a[i], WORD_F64(sum))
+SIMD_REDUCE(dot_f64_avx2, AVX2, double, __m256d, 4, _mm256_storeu_pd, _mm256_setzero_pd,
+            _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc), a[i] * b[i], WORD_F64(sum))
+
+SIMD_MAP(add_f32_avx2, AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps(x, y), add_f32)
+SIMD_MAP(sub_f32_avx2, AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_sub_ps(x, y), sub_f32)
+SIMD_MAP(mul_f32_avx2, AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps(x, y), mul_f32)
+SIMD_MAP(fma_f32_avx2, AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+         _mm256_fmadd_ps(x, y, _mm256_loadu_ps(out + i)), fma_f32)
+SIMD_MAP(min_f32_avx2, AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_min_ps(x, y), min_f32)
+SIMD_MAP(max_f32_avx2, AVX2, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_max_ps(x, y), max_f32)
+SIMD_REDUCE(sum_f32_avx2, AVX2, float, __m256, 8, _mm256_storeu_ps, _mm256_setzero_ps,
+            _mm256_add_ps(acc, _mm256_loadu_ps(a + i)), a[i], WORD_F64((double) sum))
+SIMD_REDUCE(dot_f32_avx2, AVX2, float, __m256, 8, _mm256_storeu_ps, _mm256_setzero_ps,
+            _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc), a[i] * b[i],
+            WORD_F64((double) sum))
+
+static const VectorKernels sse2_kernels = {
+        .map = {
+                {add_u64, add_u64, add_f64_sse2, add_f32_sse2},
+                {sub_u64, sub_u64, sub_f64_sse2, sub_f32_sse2},
+                {mul_u64, mul_u64, mul_f64_sse2, mul_f32_sse2},
+                {fma_u64, fma_u64, fma_f64_sse2, fma_f32_sse2},
+                {min_i64, min_u64, min_f64_sse2, min_f32_sse2},
+                {max_i64, max_u64, max_f64_sse2, max_f32_sse2},
+        },
+        .sum = {sum_u64, sum_u64, sum_f64_sse2, sum_f32_sse2},
+        .dot = {dot_u64, dot_u64, dot_f64_sse2, dot_f32_sse2},
+};
+
+static const VectorKernels avx2_kernels = {
+        .map = {
+                {add_u64, add_u64, add_f64_avx2, add_f32_avx2},
+                {sub_u64, sub_u64, sub_f64_avx2, sub_f32_avx2},
+                {mul_u64, mul_u64, mul_f64_avx2, mul_f32_avx2},
+                {fma_u64, fma_u64, fma_f64_avx2, fma_f32_avx2},
+                {min_i64, min_u64, min_f64_avx2, min_f32_avx2},
+                {max_i64, max_u64, max_f64_avx2, max_f32_avx2},
+        },
+        .sum = {sum_u64, sum_u64, sum_f64_avx2, sum_f32_avx2},
+        .dot = {dot_u64, dot_u64, dot_f64_avx2, dot_f32_avx2},
+};
+
+// Set by the first call, threads racing on it store the same table
+static _Atomic(const VectorKernels *) selected_kernels = NULL;
+
+static const VectorKernels *kernels(void) {
+    const VectorKernels *selected = atomic_load_explicit(&selected_kernels, memory_order_relaxed);
+    if (selected == NULL) {
+        const char *limit = getenv(VECTOR_ENV);
+        __builtin_cpu_init();
+        if (limit != NULL && strcmp(limit, "scalar") == 0) {
+            selected = &scalar_kernels;
+        } else if ((limit != NULL && strcmp(limit, "sse2") == 0) || !__builtin_cpu_supports("avx2") ||
+                   !__builtin_cpu_supports("fma")) {
+            selected = &sse2_kernels;
+        } else {
+            selected = &avx2_kernels;
+        }
+        atomic_store_explicit(&selected_kernels, selected, memory_order_relaxed);
+    }
+    return selected;
+}
+
+#else
+
+static const VectorKernels *kernels(void) {
+    return &scalar_kernels;
+}
+
+#endif
+
+void cf_vector_map(uint8_t opcode, uint8_t type, void *out, const void *a, const void *b, uint64_t length) {
+    kernels()->map[opcode - INST_VADD][type](out, a, b, length);
+}
+
+Word cf_vector_sum(uint8_t type, const void *a, uint64_t length) {
+    return kernels()->sum[type](a, NULL, length);
+}
+
+Word cf_vector_dot(uint8_t type, const void *a, const void *b, uint64_t length) {
+    return kernels()->dot[type](a, b, length);
+}
@@ -0,0 +1,36 @@
+#ifndef CF_VECTOR_H
+#define CF_VECTOR_H
+
+#include "machine.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// Floating point arrays are processed with SSE2 or AVX2 and FMA kernels, picked by the first call after asking the
+// processor. Integer arrays always use the scalar kernels, which the compiler vectorizes where it can.
+#define CF_VECTOR_SIMD
+#endif
+
+// Environment variable limiting the kernels to "sse2" or "scalar", to compare their results with the faster ones
+#define VECTOR_ENV "CF_VECTOR"
+
+// Element types of the array instructions VADD to VDOT, given as their operand
+#define VECTOR_I64 0
+#define VECTOR_U64 1
+#define VECTOR_F64 2
+#define VECTOR_F32 3
+#define VECTOR_TYPES 4
+
+// Kernels of the array instructions. Arrays are given by their first element and need no alignment.
+
+// out[i] = a[i] op b[i] for VADD, VSUB, VMUL, VMIN and VMAX, out[i] += a[i] * b[i] for VFMA. out may be a or b.
+// Integer arithmetic wraps around. Minimum and maximum of floats take b[i] if either element is NaN. The
+// multiply-add is rounded once where the processor has FMA and twice otherwise.
+void cf_vector_map(uint8_t opcode, uint8_t type, void *out, const void *a, const void *b, uint64_t length);
+
+// Sum of the elements of a, as i64 or u64 for integers and as f64 for floats. f32 arrays are summed in single
+// precision. The order of the additions is unspecified, so float sums may differ in the last bits between machines.
+Word cf_vector_sum(uint8_t type, const void *a, uint64_t length);
+
+// Sum of a[i] * b[i], with the same result types and order as cf_vector_sum
+Word cf_vector_dot(uint8_t type, const void *a, const void *b, uint64_t length);
+
+#endif
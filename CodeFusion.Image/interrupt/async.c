@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include "../bridge/interrupt.h"
+#include "../cf/reactor.h"
+#include "../cf/scheduler.h"
+
+#ifdef CF_REACTOR
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Non-blocking counterparts of the stdio interrupts, working on file descriptors. A call that would block suspends the
+// machine through cf_wait_fd and runs again once the descriptor is ready, so the arguments stay on the stack until the
+// call went through. Failures push -1.
+
+static Status cf_async_open(CF_Machine *cf) {
+    if (cf->stack_size < 2) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Path
+    // 2 Mode, as for fopen: "r", "w" or "a", optionally followed by "+"
+
+    const char *mode = cf->stack[cf->stack_size - 1].as_ptr;
+    int flags = strchr(mode, '+') != NULL ? O_RDWR : mode[0] == 'r' ? O_RDONLY : O_WRONLY;
+    if (mode[0] == 'w') {
+        flags |= O_CREAT | O_TRUNC;
+    } else if (mode[0] == 'a') {
+        flags |= O_CREAT | O_APPEND;
+    }
+    int fd = open(cf->stack[cf->stack_size - 2].as_ptr, flags | O_NONBLOCK | O_CLOEXEC, 0666);
+    cf->stack[cf->stack_size - 2] = WORD_I64(fd);
+    cf->stack_size--;
+    return STATUS_OK;
+}
+
+static Status cf_async_transfer(CF_Machine *cf, int write_data) {
+    if (cf->stack_size < 3) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 File descriptor
+    // 2 Buff
+    // 3 Length
+
+    int fd = (int) cf->stack[cf->stack_size - 3].as_i64;
+    void *buff = cf->stack[cf->stack_size - 2].as_ptr;
+    size_t length = cf->stack[cf->stack_size - 1].as_u64;
+    for (;;) {
+        ssize_t done = write_data ? write(fd, buff, length) : read(fd, buff, length);
+        if (done >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            cf->stack[cf->stack_size - 3] = WORD_I64(done);
+            cf->stack_size -= 2;
+            return STATUS_OK;
+        }
+        if (errno != EINTR) {
+            Status status = cf_wait_fd(cf, fd, write_data ? REACTOR_WRITE : REACTOR_READ);
+            if (status != STATUS_OK) {
+                return status;
+            }
+        }
+    }
+}
+
+static Status cf_async_read(CF_Machine *cf) {
+    return cf_async_transfer(cf, 0);
+}
+
+static Status cf_async_write(CF_Machine *cf) {
+    return cf_async_transfer(cf, 1);
+}
+
+static Status cf_async_close(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    close((int) cf->stack[cf->stack_size - 1].as_i64);
+    cf->stack_size--;
+    return STATUS_OK;
+}
+
+// Fills the address of a local socket, returns 0 if the path does not fit
+static int socket_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        return 0;
+    }
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+static Status cf_async_listen(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Path of the local socket
+
+    struct sockaddr_un address;
+    int fd = -1;
+    if (socket_address(cf->stack[cf->stack_size - 1].as_ptr, &address)) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    }
+    if (fd >= 0 && (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    cf->stack[cf->stack_size - 1] = WORD_I64(fd);
+    return STATUS_OK;
+}
+
+static Status cf_async_accept(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Listening file descriptor
+
+    int listener = (int) cf->stack[cf->stack_size - 1].as_i64;
+    for (;;) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            cf->stack[cf->stack_size - 1] = WORD_I64(fd);
+            return STATUS_OK;
+        }
+        if (errno != EINTR) {
+            Status status = cf_wait_fd(cf, listener, REACTOR_READ);
+            if (status != STATUS_OK) {
+                return status;
+            }
+        }
+    }
+}
+
+static Status cf_async_connect(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Path of the local socket
+
+    struct sockaddr_un address;
+    if (!socket_address(cf->stack[cf->stack_size - 1].as_ptr, &address)) {
+        cf->stack[cf->stack_size - 1] = WORD_I64(-1);
+        return STATUS_OK;
+    }
+    for (;;) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) {
+            cf->stack[cf->stack_size - 1] = WORD_I64(fd);
+            return STATUS_OK;
+        }
+        int error = errno;
+        close(fd);
+        // Local sockets fail with EAGAIN while the backlog of the listener is full, there is no descriptor to wait on
+        if (error != EAGAIN && error != EINTR) {
+            cf->stack[cf->stack_size - 1] = WORD_I64(-1);
+            return STATUS_OK;
+        }
+        if (error == EAGAIN) {
+            Status status = cf_wait_fd(cf, -1, 0);
+            if (status != STATUS_OK) {
+                return status;
+            }
+        }
+    }
+}
+
+void cf_install_async_interrupts(CF_Runtime *runtime) {
+    runtime->interrupts[15] = cf_async_open;
+    runtime->interrupts[16] = cf_async_read;
+    runtime->interrupts[17] = cf_async_write;
+    runtime->interrupts[18] = cf_async_close;
+    runtime->interrupts[19] = cf_async_listen;
+    runtime->interrupts[20] = cf_async_accept;
+    runtime->interrupts[21] = cf_async_connect;
+}
+
+#else
+
+void cf_install_async_interrupts(CF_Runtime *runtime) {
+    (void) runtime;
+}
+
+#endif
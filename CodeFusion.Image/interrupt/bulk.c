@@ -0,0 +1,134 @@
+#define _DEFAULT_SOURCE
+#include "../bridge/interrupt.h"
+#include "../cf/output.h"
+#include "../cf/reactor.h"
+
+#ifdef CF_OUTPUT
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Interrupts for bulk I/O on file descriptors. Writes are collected in the output buffer of the machine, so printing
+// in a loop costs a copy instead of a system call per fragment.
+
+static Status cf_buffered_write(CF_Machine *cf) {
+    if (cf->stack_size < 3) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 File descriptor
+    // 2 Buff
+    // 3 Length
+
+    // Pushes the length, or -1 if the bytes or the ones buffered before them could not be written
+    uint64_t length = cf->stack[cf->stack_size - 1].as_u64;
+    int written = cf_output_write(cf, (int) cf->stack[cf->stack_size - 3].as_i64, cf->stack[cf->stack_size - 2].as_ptr,
+                                  length);
+    cf->stack[cf->stack_size - 3] = written ? WORD_U64(length) : WORD_I64(-1);
+    cf->stack_size -= 2;
+    return STATUS_OK;
+}
+
+static Status cf_flush(CF_Machine *cf) {
+    cf_output_flush(cf);
+    return STATUS_OK;
+}
+
+static Status cf_read_full(CF_Machine *cf) {
+    if (cf->stack_size < 3) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 File descriptor
+    // 2 Buff
+    // 3 Length
+
+    // Reads until the buffer is full or the end of the file is reached, less than length bytes only at the end
+    int fd = (int) cf->stack[cf->stack_size - 3].as_i64;
+    uint8_t *buff = cf->stack[cf->stack_size - 2].as_ptr;
+    uint64_t length = cf->stack[cf->stack_size - 1].as_u64;
+    uint64_t done = 0;
+    while (done < length) {
+        ssize_t result = read(fd, buff + done, length - done);
+        if (result > 0) {
+            done += (uint64_t) result;
+        } else if (result == 0) {
+            break;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Part of the buffer is filled already, so the machine cannot be suspended and retried
+            cf_reactor_block(fd, REACTOR_READ);
+        } else if (errno != EINTR) {
+            done = UINT64_MAX;
+            break;
+        }
+    }
+    cf->stack[cf->stack_size - 3] = done == UINT64_MAX ? WORD_I64(-1) : WORD_U64(done);
+    cf->stack_size -= 2;
+    return STATUS_OK;
+}
+
+static Status cf_map_file(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+    if (cf->stack_size >= cf->stack_capacity) {
+        return STATUS_STACK_OVERFLOW;
+    }
+
+    // 1 Path
+    // Pushes the address and the length of the read-only mapping, NULL and 0 if the file could not be mapped
+
+    void *data = NULL;
+    uint64_t length = 0;
+    int fd = open(cf->stack[cf->stack_size - 1].as_ptr, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            length = (uint64_t) info.st_size;
+            // The file is read front to back by almost every program
+            madvise(data, (size_t) length, MADV_SEQUENTIAL);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    cf->stack[cf->stack_size - 1] = WORD_PTR(data);
+    cf->stack[cf->stack_size++] = WORD_U64(length);
+    return STATUS_OK;
+}
+
+static Status cf_unmap_file(CF_Machine *cf) {
+    if (cf->stack_size < 2) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Address
+    // 2 Length
+
+    if (cf->stack[cf->stack_size - 2].as_ptr != NULL) {
+        munmap(cf->stack[cf->stack_size - 2].as_ptr, cf->stack[cf->stack_size - 1].as_u64);
+    }
+    cf->stack_size -= 2;
+    return STATUS_OK;
+}
+
+void cf_install_bulk_interrupts(CF_Runtime *runtime) {
+    runtime->interrupts[22] = cf_buffered_write;
+    runtime->interrupts[23] = cf_flush;
+    runtime->interrupts[24] = cf_read_full;
+    runtime->interrupts[25] = cf_map_file;
+    runtime->interrupts[26] = cf_unmap_file;
+}
+
+#else
+
+void cf_install_bulk_interrupts(CF_Runtime *runtime) {
+    (void) runtime;
+}
+
+#endif
@@ -1,17 +1,13 @@
 #include "../bridge/interrupt.h"
 #include "../bridge/dll.h"
+#include "../cf/loader.h"
+#include "../cf/output.h"
+#include "../cf/scheduler.h"
+#include "../cf/snapshot.h"
 #include <stdlib.h>
 
-static int strcmp(const char *a, const char *b) {
-    while (*a && *b && *a == *b) {
-        a++;
-        b++;
-    }
-    return *a - *b;
-}
-
 static Status cf_get_stdout(CF_Machine *cf) {
-    if (cf->stack_size >= STACK_CAPACITY) {
+    if (cf->stack_size >= cf->stack_capacity) {
         return STATUS_CALL_STACK_OVERFLOW;
     }
 
@@ -20,7 +16,7 @@ static Status cf_get_stdout(CF_Machine *cf) {
 }
 
 static Status cf_get_stdin(CF_Machine *cf) {
-    if (cf->stack_size >= STACK_CAPACITY) {
+    if (cf->stack_size >= cf->stack_capacity) {
         return STATUS_CALL_STACK_OVERFLOW;
     }
 
@@ -29,7 +25,7 @@ static Status cf_get_stdin(CF_Machine *cf) {
 }
 
 static Status cf_get_stderr(CF_Machine *cf) {
-    if (cf->stack_size >= STACK_CAPACITY) {
+    if (cf->stack_size >= cf->stack_capacity) {
         return STATUS_CALL_STACK_OVERFLOW;
     }
 
@@ -57,6 +53,7 @@ static Status cf_write(CF_Machine *cf) {
     // 2 Buff
     // 3 Lenght
 
+    cf_output_sync(cf, cf->stack[cf->stack_size - 3].as_ptr);
     fwrite(cf->stack[cf->stack_size - 2].as_ptr, cf->stack[cf->stack_size - 1].as_u64,
            1, cf->stack[cf->stack_size - 3].as_ptr);
     cf->stack_size -= 3;
@@ -78,6 +75,7 @@ static Status cf_exit(CF_Machine *cf) {
         return STATUS_STACK_UNDERFLOW;
     }
 
+    cf_output_flush(cf);
     exit(cf->stack[cf->stack_size - 1].as_i64);
 }
 
@@ -86,7 +84,7 @@ static Status cf_malloc(CF_Machine *cf) {
         return STATUS_STACK_UNDERFLOW;
     }
 
-    cf->stack[cf->stack_size - 1] = WORD_PTR(malloc(cf->stack[cf->stack_size - 1].as_u64));
+    cf->stack[cf->stack_size - 1] = WORD_PTR(cf_slab_alloc(&cf->heap, cf->stack[cf->stack_size - 1].as_u64));
     return STATUS_OK;
 }
 
@@ -95,17 +93,39 @@ static Status cf_free(CF_Machine *cf) {
         return STATUS_STACK_UNDERFLOW;
     }
 
-    free(cf->stack[cf->stack_size - 1].as_ptr);
+    cf_slab_free(&cf->heap, cf->stack[cf->stack_size - 1].as_ptr);
     cf->stack_size--;
     return STATUS_OK;
 }
 
+static Status cf_heap_stat(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Selector
+    // 0 pushes the live bytes of the machine, 1 to SLAB_CLASSES the allocations of a size class and SLAB_CLASSES + 1
+    // the allocations larger than SLAB_MAX_SIZE. SLAB_CLASSES + 2 + n pushes the payload size of class n.
+
+    uint64_t selector = cf->stack[cf->stack_size - 1].as_u64;
+    Word result = WORD_U64(0);
+    if (selector == 0) {
+        result = WORD_I64(cf->heap.live_bytes);
+    } else if (selector <= SLAB_CLASSES + 1) {
+        result = WORD_U64(cf->heap.allocations[selector - 1]);
+    } else {
+        result = WORD_U64(cf_slab_class_size(selector - (SLAB_CLASSES + 2)));
+    }
+    cf->stack[cf->stack_size - 1] = result;
+    return STATUS_OK;
+}
+
 static Status cf_load_library(CF_Machine *cf) {
     printf("Load library\n");
     if (cf->stack_size < 1) {
         return STATUS_STACK_UNDERFLOW;
     }
-    if (cf->library_size >= LIBRARY_CAPACITY) {
+    if (cf->runtime->library_size >= LIBRARY_CAPACITY) {
         return STATUS_LIBRARY_OVERFLOW;
     }
 
@@ -115,9 +135,7 @@ static Status cf_load_library(CF_Machine *cf) {
         printf("Symbol %s: %"PRIu64"\n", lib.symbols[i].name, lib.symbols[i].address);
     }
 
-    cf->stack[cf->stack_size - 1].as_u64 = cf->library_size;
-    cf->libraries[cf->library_size++] = lib;
-    return STATUS_OK;
+    return cf_runtime_add_library(cf->runtime, lib, &cf->stack[cf->stack_size - 1].as_u64);
 }
 
 static Status cf_unload_library(CF_Machine *cf) {
@@ -125,11 +143,15 @@ static Status cf_unload_library(CF_Machine *cf) {
         return STATUS_STACK_UNDERFLOW;
     }
 
-    if (cf->stack[cf->stack_size - 1].as_u64 >= cf->library_size || cf->stack[cf->stack_size - 1].as_u64 == 0) {
+    if (cf->stack[cf->stack_size - 1].as_u64 == 0) {
         return STATUS_ILLEGAL_LIBRARY_INDEX;
     }
 
-    cf_free_dll(&cf->libraries[cf->stack[cf->stack_size - 1].as_u64]);
+    // Machines on other threads may still run the library, its image lives until the runtime is destroyed
+    Status status = cf_runtime_unload_library(cf->runtime, cf->stack[cf->stack_size - 1].as_u64);
+    if (status != STATUS_OK) {
+        return status;
+    }
     cf->stack_size--;
     return STATUS_OK;
 }
@@ -139,34 +161,92 @@ static Status cf_retrieve_symbol(CF_Machine *cf) {
         return STATUS_STACK_UNDERFLOW;
     }
 
-    if (cf->stack[cf->stack_size - 2].as_u64 >= cf->library_size || cf->stack[cf->stack_size - 2].as_u64 == 0) {
+    if (cf->stack[cf->stack_size - 2].as_u64 >= cf->runtime->library_size ||
+        cf->stack[cf->stack_size - 2].as_u64 == 0) {
         return STATUS_ILLEGAL_LIBRARY_INDEX;
     }
 
-    CF_Library *lib = &cf->libraries[cf->stack[cf->stack_size - 2].as_u64];
-    for (size_t i = 0; i < lib->symbol_size; i++) {
-        if (strcmp(lib->symbols[i].name, cf->stack[cf->stack_size - 1].as_ptr) == 0) {
-            cf->stack[cf->stack_size - 2] = WORD_U64(lib->symbols[i].address);
-            cf->stack_size--;
-            return STATUS_OK;
-        }
-    }
-    return STATUS_SYMBOL_NOT_FOUND;
-}
-
-static void init() __attribute__((constructor));
-
-static void init() {
-    interrupts[0] = cf_get_stdout;
-    interrupts[1] = cf_get_stdin;
-    interrupts[2] = cf_get_stderr;
-    interrupts[3] = cf_open;
-    interrupts[4] = cf_write;
-    interrupts[5] = cf_close;
-    interrupts[6] = cf_exit;
-    interrupts[7] = cf_malloc;
-    interrupts[8] = cf_free;
-    interrupts[9] = cf_load_library;
-    interrupts[10] = cf_unload_library;
-    interrupts[11] = cf_retrieve_symbol;
-}
\ No newline at end of file
+    const CF_Symbol *symbol = cf_find_symbol(cf_runtime_library(cf->runtime, cf->stack[cf->stack_size - 2].as_u64),
+                                             cf->stack[cf->stack_size - 1].as_ptr);
+    if (symbol == NULL) {
+        return STATUS_SYMBOL_NOT_FOUND;
+    }
+    cf->stack[cf->stack_size - 2] = WORD_U64(symbol->address);
+    cf->stack_size--;
+    return STATUS_OK;
+}
+
+static Status cf_spawn_task(CF_Machine *cf) {
+    if (cf->stack_size < 3) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // 1 Argument
+    // 2 Library
+    // 3 Address
+
+    CF_Task *task;
+    Status status = cf_spawn(cf, cf->stack[cf->stack_size - 2].as_u64, cf->stack[cf->stack_size - 1].as_u64,
+                             cf->stack[cf->stack_size - 3], &task);
+    if (status != STATUS_OK) {
+        return status;
+    }
+    cf->stack[cf->stack_size - 3] = WORD_PTR(task);
+    cf->stack_size -= 2;
+    return STATUS_OK;
+}
+
+static Status cf_yield_task(CF_Machine *cf) {
+    return cf_yield(cf);
+}
+
+static Status cf_join_task(CF_Machine *cf) {
+    if (cf->stack_size < 1) {
+        return STATUS_STACK_UNDERFLOW;
+    }
+
+    // The handle stays on the stack while the task waits, the INT runs again when it is resumed
+    Word result;
+    Status status = cf_join(cf, cf->stack[cf->stack_size - 1].as_ptr, &result);
+    if (status != STATUS_OK) {
+        return status;
+    }
+    cf->stack[cf->stack_size - 1] = result;
+    return STATUS_OK;
+}
+
+static Status cf_snapshot_point(CF_Machine *cf) {
+    if (cf->stack_size >= cf->stack_capacity) {
+        return STATUS_STACK_OVERFLOW;
+    }
+
+    // Writes the image named by SNAPSHOT_ENV and pushes 1, or 0 if the variable is not set or the image could not be
+    // written. The image holds SNAPSHOT_RESUMED instead, which a restored machine finds here.
+    const char *path = getenv(SNAPSHOT_ENV);
+    cf->stack[cf->stack_size++] = WORD_U64(SNAPSHOT_RESUMED);
+    int written = path != NULL && cf_snapshot(cf, path);
+    cf->stack[cf->stack_size - 1] = WORD_U64(written ? 1 : 0);
+    return STATUS_OK;
+}
+
+void cf_install_interrupts(CF_Runtime *runtime) {
+    runtime->interrupts[0] = cf_get_stdout;
+    runtime->interrupts[1] = cf_get_stdin;
+    runtime->interrupts[2] = cf_get_stderr;
+    runtime->interrupts[3] = cf_open;
+    runtime->interrupts[4] = cf_write;
+    runtime->interrupts[5] = cf_close;
+    runtime->interrupts[6] = cf_exit;
+    runtime->interrupts[7] = cf_malloc;
+    runtime->interrupts[8] = cf_free;
+    runtime->interrupts[9] = cf_load_library;
+    runtime->interrupts[10] = cf_unload_library;
+    runtime->interrupts[11] = cf_retrieve_symbol;
+    runtime->interrupts[12] = cf_spawn_task;
+    runtime->interrupts[13] = cf_yield_task;
+    runtime->interrupts[14] = cf_join_task;
+    cf_install_async_interrupts(runtime);
+    cf_install_bulk_interrupts(runtime);
+    runtime->interrupts[27] = cf_heap_stat;
+    runtime->interrupts[28] = cf_snapshot_point;
+}
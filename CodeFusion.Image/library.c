@@ -1,7 +1,11 @@
 #include <stdlib.h>
 #include "cf/CodeFusion.h"
 
+#ifdef _WIN32
 #define OBJECT_EXPORT __declspec(dllexport)
+#else
+#define OBJECT_EXPORT __attribute__((visibility("default")))
+#endif
 
 extern char _binary_cf_code_bin_start[];
 extern char _binary_cf_code_bin_end[];
@@ -24,4 +28,6 @@ OBJECT_EXPORT void init(CF_Library *lib) {
     cf_load_program(&buff, &metadata, lib);
     cf_load_symbols(&buff, &metadata, lib);
     cf_load_memory(&buff, &metadata, lib);
+    cf_verify_program(lib);
+    cf_fuse_program(lib);
 }
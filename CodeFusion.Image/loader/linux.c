@@ -0,0 +1,55 @@
+#define _DEFAULT_SOURCE
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../bridge/dll.h"
+
+// Colon separated list of libraries that are opened once at startup. Loading one of them later only runs its init
+// function, the mapping and relocation already happened.
+#define PRELOAD_ENV "CF_PRELOAD"
+
+CF_Library cf_load_dll(const char *path) {
+    // RTLD_NOW resolves everything up front so a broken library fails here and not in the middle of a call
+    void *dll = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (dll == NULL) {
+        printf("Failed to load DLL: %s\n", path);
+        printf("%s\n", dlerror());
+        exit(1);
+    }
+    CF_Library lib = {0};
+
+    void (*init)(CF_Library *);
+    *(void **) &init = dlsym(dll, "init");
+    if (init == NULL) {
+        printf("Failed to load init function from DLL: %s\n", path);
+        exit(1);
+    }
+    init(&lib);
+    lib.path = path;
+    lib.handler = dll;
+    lib.release = cf_free_dll;
+    return lib;
+}
+
+void cf_free_dll(CF_Library *lib) {
+    dlclose(lib->handler);
+}
+
+static void preload(void) __attribute__((constructor));
+
+static void preload(void) {
+    const char *value = getenv(PRELOAD_ENV);
+    if (value == NULL) {
+        return;
+    }
+
+    char *paths = strdup(value);
+    char *state = NULL;
+    for (char *path = strtok_r(paths, ":", &state); path != NULL; path = strtok_r(NULL, ":", &state)) {
+        // The handle is kept open for the lifetime of the process
+        if (dlopen(path, RTLD_NOW | RTLD_LOCAL) == NULL) {
+            fprintf(stderr, "Failed to preload DLL: %s\n%s\n", path, dlerror());
+        }
+    }
+    free(paths);
+}
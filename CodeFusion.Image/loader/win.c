@@ -30,6 +30,7 @@ CF_Library cf_load_dll(const char *path) {
     init(&lib);
     lib.path = path;
     lib.handler = dll;
+    lib.release = cf_free_dll;
     return lib;
 }
 
@@ -1,9 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cf/CodeFusion.h"
+#include "cf/jit.h"
+#include "cf/output.h"
+#include "cf/profile.h"
+#include "cf/sample.h"
+#include "cf/snapshot.h"
 #include "cf/debug.h"
+#include "bridge/interrupt.h"
 
-CF_Machine cf = {0};
+#ifdef CF_JIT
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 extern char _binary_cf_code_bin_start[];
 extern char _binary_cf_code_bin_end[];
@@ -13,8 +23,197 @@ static void exit_with(Status status) {
     exit(status == STATUS_OK ? 0 : 1);
 }
 
+static Status add_main_program(CF_Runtime *runtime, CF_Library *main_program) {
+    PRINT_DEBUG("Load main program into library stack\n");
+    uint64_t index;
+    return cf_runtime_add_library(runtime, *main_program, &index);
+}
+
+static Status run(CF_Machine *cf) {
+    Status status = STATUS_OK;
+    PRINT_DEBUG("Start execution\n");
+#ifdef CF_PROFILE
+    cf_profile_start(cf);
+#endif
+#ifdef SLOW
+    do {
+        status = cf_execute_inst(cf);
+        for (size_t i = 0; i < cf->stack_size; i++) {
+            printf("%"PRIu64"\n", cf->stack[i].as_u64);
+        }
+        getchar();
+    } while (status == STATUS_OK);
+#elif defined(CF_SAMPLE)
+    cf_sample_start(cf);
+    do {
+        status = cf_run(cf, SAMPLE_SLICE);
+        cf_sample_drain();
+    } while (status == STATUS_OK);
+#else
+    status = cf_run(cf, 0);
+#endif
+    cf_output_flush(cf);
+    return status;
+}
+
+#ifdef CF_JIT
+
+// Differential mode: the program runs once per engine in a child process, each child reports the state of its
+// machine when it ends, including an end through the exit interrupt, and the parent compares the reports. Forking
+// after loading gives both runs the same address space, so pointers on the stacks compare equal as well.
+
+typedef struct {
+    uint64_t status;
+    uint64_t program_counter;
+    uint64_t program_pool;
+    uint64_t stack_size;
+} Report;
+
+// Programs that end through the exit interrupt never see the final status
+#define STATUS_EXITED UINT64_MAX
+
+static int report_fd = -1;
+static uint64_t report_status = STATUS_EXITED;
+static const CF_Machine *report_machine = NULL;
+
+static void write_report(void) {
+    const CF_Machine *cf = report_machine;
+    Report report = {report_status, cf->program_counter, cf->program_pool, cf->stack_size};
+    const uint8_t *parts[] = {(const uint8_t *) &report, (const uint8_t *) cf->stack};
+    size_t sizes[] = {sizeof(report), cf->stack_size * sizeof(Word)};
+    for (size_t i = 0; i < 2; i++) {
+        size_t done = 0;
+        while (done < sizes[i]) {
+            ssize_t written = write(report_fd, parts[i] + done, sizes[i] - done);
+            if (written <= 0) {
+                return;
+            }
+            done += (size_t) written;
+        }
+    }
+    close(report_fd);
+}
+
+static int read_all(int fd, void *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = read(fd, (uint8_t *) data + done, size - done);
+        if (result <= 0) {
+            return 0;
+        }
+        done += (size_t) result;
+    }
+    return 1;
+}
+
+// Runs the program in a child process with or without the JIT, returns 0 if the child ended without a report
+static int run_child(CF_Runtime *runtime, CF_Library *main_program, CF_Machine *cf, int jit, Report *report,
+                     Word **stack) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return 0;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        report_fd = fds[1];
+        report_machine = cf;
+        atexit(write_report);
+        runtime->jit = (uint8_t) jit;
+        if (!jit) {
+            main_program->jit = NULL;
+        }
+        Status status = add_main_program(runtime, main_program);
+        if (status == STATUS_OK) {
+            status = run(cf);
+        }
+        report_status = status;
+        exit_with(status);
+    }
+
+    close(fds[1]);
+    int complete = read_all(fds[0], report, sizeof(Report));
+    *stack = complete ? calloc(report->stack_size + 1, sizeof(Word)) : NULL;
+    complete = complete && *stack != NULL && read_all(fds[0], *stack, report->stack_size * sizeof(Word));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return complete;
+}
+
+static int run_differential(CF_Runtime *runtime, CF_Library *main_program, CF_Machine *cf) {
+    static const char *engines[] = {"interpreter", "jit"};
+    Report reports[2];
+    Word *stacks[2] = {NULL, NULL};
+
+    // Translated before forking so the mapping does not shift the address space of one of the runs
+    main_program->jit = cf_jit_compile(main_program);
+    for (int i = 0; i < 2; i++) {
+        if (!run_child(runtime, main_program, cf, i, &reports[i], &stacks[i])) {
+            printf("Differential run: the %s did not report its machine\n", engines[i]);
+            return 1;
+        }
+    }
+
+    const Report *a = &reports[0];
+    const Report *b = &reports[1];
+    if (a->status != b->status || a->program_counter != b->program_counter || a->program_pool != b->program_pool ||
+        a->stack_size != b->stack_size) {
+        printf("Differential run: engines differ\n");
+        for (int i = 0; i < 2; i++) {
+            printf("  %-11s status %"PRIx64" pc %"PRIu64" library %"PRIu64" stack size %"PRIu64"\n", engines[i],
+                   reports[i].status, reports[i].program_counter, reports[i].program_pool, reports[i].stack_size);
+        }
+        return 1;
+    }
+    for (uint64_t i = 0; i < a->stack_size; i++) {
+        if (stacks[0][i].as_u64 != stacks[1][i].as_u64) {
+            printf("Differential run: engines differ at stack entry %"PRIu64": %"PRIu64" != %"PRIu64"\n", i,
+                   stacks[0][i].as_u64, stacks[1][i].as_u64);
+            return 1;
+        }
+    }
+    printf("Differential run: engines agree on %"PRIu64" stack entries\n", a->stack_size);
+    return 0;
+}
+
+#endif
+
 int main(void) {
     PRINT_DEBUG("Start VM Program\n");
+    CF_Runtime *runtime = cf_runtime_create();
+    if (runtime == NULL) {
+        exit_with(STATUS_LIBRARY_OVERFLOW);
+    }
+    cf_install_interrupts(runtime);
+    const char *jit = getenv(JIT_ENV);
+    runtime->jit = jit != NULL && strcmp(jit, "1") == 0;
+    runtime->snapshot_key = cf_snapshot_key(_binary_cf_code_bin_start,
+                                            (uint64_t) (_binary_cf_code_bin_end - _binary_cf_code_bin_start));
+
+    const char *snapshot = getenv(SNAPSHOT_ENV);
+    if (snapshot != NULL) {
+        // A warm start continues behind the snapshot interrupt of the run that wrote the image
+        CF_Machine *restored = cf_restore(runtime, snapshot);
+        if (restored != NULL) {
+            exit_with(run(restored));
+        }
+        if (atomic_load(&runtime->library_size) != 0) {
+            exit_with(STATUS_LIBRARY_OVERFLOW);
+        }
+    }
+
+    CF_Machine *cf;
+    Status status = cf_machine_create(runtime, 0, 0, &cf);
+    if (status != STATUS_OK) {
+        exit_with(status);
+    }
     Metadata metadata = {0};
     void *buff = (void *) _binary_cf_code_bin_start;
     PRINT_DEBUG("Binary content start: %p\n", buff);
@@ -25,27 +224,25 @@ int main(void) {
     cf_load_program(&buff, &metadata, &main_program);
     PRINT_DEBUG("Some step");
     cf_load_memory(&buff, &metadata, &main_program);
+    cf_verify_program(&main_program);
+    cf_fuse_program(&main_program);
 
     if (metadata.entry_point >= main_program.program_size) {
         exit_with(STATUS_ILLEGAL_ENTRY_POINT);
     }
     PRINT_DEBUG("Set entry point\n");
-    cf.program_counter = metadata.entry_point;
-    PRINT_DEBUG("Load main program into library stack\n");
-    cf.libraries[cf.library_size++] = main_program;
-
+    cf->program_counter = metadata.entry_point;
 
-    PRINT_DEBUG("Start execution\n");
-    Status status;
-    do {
-        status = cf_execute_inst(&cf);
-#ifdef SLOW
-        for (size_t i = 0; i < cf.stack_size; i++) {
-            printf("%"PRIu64"\n", cf.stack[i].as_u64);
-        }
-        getchar();
+#ifdef CF_JIT
+    if (jit != NULL && strcmp(jit, "diff") == 0) {
+        return run_differential(runtime, &main_program, cf);
+    }
 #endif
-    } while (status == STATUS_OK);
-    exit_with(status);
+    status = add_main_program(runtime, &main_program);
+    if (status != STATUS_OK) {
+        exit_with(status);
+    }
+    // The machine and the runtime live until the process exits, the profilers read them in their exit handlers
+    exit_with(run(cf));
 }
 
@@ -87,6 +87,13 @@ public class FinFile
                     }
                 }
             }
+            else if (section.type == Section.TYPE_PREDECODED)
+            {
+                PredecodedProgramSection programSection = (PredecodedProgramSection)section;
+                programCount += (ulong)programSection.program.Count;
+                programStream.Write(programSection.RecordBytes());
+                flags |= Metadata.PREDECODED;
+            }
             else if (section.type == Section.TYPE_SYMBOL)
             {
                 SymbolSection symbolSection = (SymbolSection)section;
@@ -0,0 +1,49 @@
+﻿using System;
+using System.Collections.Generic;
+using CodeFusion.VM;
+
+namespace CodeFusion.Format;
+
+public class PredecodedProgramSection : Section
+{
+    public const int RECORD_SIZE = 16;
+    public const int OPERAND_OFFSET = 8;
+
+    public List<Inst> program = new List<Inst>();
+
+    public PredecodedProgramSection()
+    {
+        type = TYPE_PREDECODED;
+        lenght = 0;
+    }
+
+    public PredecodedProgramSection(ProgramSection section) : this()
+    {
+        program.AddRange(section.program);
+    }
+
+    public byte[] RecordBytes()
+    {
+        byte[] bytes = new byte[program.Count * RECORD_SIZE];
+        for (int i = 0; i < program.Count; i++)
+        {
+            bytes[i * RECORD_SIZE] = program[i].opcode;
+            BitConverter.GetBytes(program[i].operand.asU64).CopyTo(bytes, i * RECORD_SIZE + OPERAND_OFFSET);
+        }
+
+        return bytes;
+    }
+
+    public override byte[] ToBytes()
+    {
+        List<byte> bytes = new List<byte>();
+
+        bytes.Add(type);
+
+        lenght = (uint)(program.Count * RECORD_SIZE);
+        bytes.AddRange(BitConverter.GetBytes(lenght));
+        bytes.AddRange(RecordBytes());
+
+        return bytes.ToArray();
+    }
+}
@@ -17,6 +17,7 @@ public abstract class Section
     public const byte TYPE_MEMORY = 5;
     public const byte TYPE_MEMORY_SYMBOL = 6;
     public const byte TYPE_MEMORY_ADDRESS = 7;
+    public const byte TYPE_PREDECODED = 8;
 
     #endregion
 }
\ No newline at end of file
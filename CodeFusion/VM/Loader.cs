@@ -82,6 +82,19 @@ public static class Loader
                 }
                 return programSection;
             }
+            case Section.TYPE_PREDECODED:
+            {
+                PredecodedProgramSection programSection = new PredecodedProgramSection();
+                programSection.lenght = lenght;
+                int i = 0;
+                while (i < lenght)
+                {
+                    programSection.program.Add(new Inst(content[i],
+                        new Word(BitConverter.ToUInt64(content, i + PredecodedProgramSection.OPERAND_OFFSET))));
+                    i += PredecodedProgramSection.RECORD_SIZE;
+                }
+                return programSection;
+            }
             case Section.TYPE_SYMBOL:
             {
                 SymbolSection symbolSection = new SymbolSection();
@@ -21,6 +21,7 @@ public struct Metadata
     public const byte EXECUTABLE = 0b10;
     public const byte CONTAINS_ERRORS = 0b100;
     public const byte LIBRARY = 0b1000;
+    public const byte PREDECODED = 0b10000;
 
     #endregion
 }
\ No newline at end of file
@@ -245,6 +245,116 @@ public static class Opcode
 
     public const byte LOAD_MEMORY = 67;
 
+    /// <summary>
+    /// memcopy<br /><br />
+    /// Copies a number of bytes from one pointer to another, the ranges may overlap
+    ///
+    /// <code>
+    ///     push 0 ; destination
+    ///     push 0 ; source
+    ///     push 4096 ; length
+    ///     memcopy
+    /// </code>
+    /// </summary>
+    public const byte MEM_COPY = 68;
+
+    /// <summary>
+    /// memfill<br /><br />
+    /// Sets a number of bytes at a pointer to the same value
+    ///
+    /// <code>
+    ///     push 0 ; destination
+    ///     push 4096 ; length
+    ///     push 32 ; byte
+    ///     memfill
+    /// </code>
+    /// </summary>
+    public const byte MEM_FILL = 69;
+
+    /// <summary>
+    /// memcompare<br /><br />
+    /// Compares a number of bytes at two pointers and pushes -1, 0 or 1 as the first range is less than, equal to or
+    /// greater than the second one
+    ///
+    /// <code>
+    ///     push 0 ; first
+    ///     push 0 ; second
+    ///     push 16 ; length
+    ///     memcompare
+    /// </code>
+    /// </summary>
+    public const byte MEM_COMPARE = 70;
+
+    /// <summary>
+    /// memfind<br /><br />
+    /// Pushes the index of the first byte with a value within a number of bytes at a pointer or -1 if there is none
+    ///
+    /// <code>
+    ///     push 0 ; data
+    ///     push 4096 ; length
+    ///     push 10 ; byte
+    ///     memfind
+    /// </code>
+    /// </summary>
+    public const byte MEM_FIND = 71;
+
+    /// <summary>
+    /// vadd &lt;type><br /><br />
+    /// Adds two arrays of a element type element by element into a third array. The type is one of the VECTOR_
+    /// constants, vsub, vmul, vmin and vmax work the same way
+    ///
+    /// <code>
+    ///     push 0 ; output
+    ///     push 0 ; first input
+    ///     push 0 ; second input
+    ///     push 512 ; number of elements
+    ///     vadd 2 ; f64
+    /// </code>
+    /// </summary>
+    public const byte VADD = 72;
+    public const byte VSUB = 73;
+    public const byte VMUL = 74;
+
+    /// <summary>
+    /// vfma &lt;type><br /><br />
+    /// Adds the products of the elements of two arrays to the elements of the output array, with the same operands as
+    /// vadd
+    /// </summary>
+    public const byte VFMA = 75;
+    public const byte VMIN = 76;
+    public const byte VMAX = 77;
+
+    /// <summary>
+    /// vsum &lt;type><br /><br />
+    /// Pushes the sum of the elements of an array, floats are pushed as f64
+    ///
+    /// <code>
+    ///     push 0 ; array
+    ///     push 512 ; number of elements
+    ///     vsum 0 ; i64
+    /// </code>
+    /// </summary>
+    public const byte VSUM = 78;
+
+    /// <summary>
+    /// vdot &lt;type><br /><br />
+    /// Pushes the dot product of two arrays, floats are pushed as f64
+    ///
+    /// <code>
+    ///     push 0 ; first array
+    ///     push 0 ; second array
+    ///     push 512 ; number of elements
+    ///     vdot 3 ; f32
+    /// </code>
+    /// </summary>
+    public const byte VDOT = 79;
+
+    // Element types of the array instructions vadd to vdot
+    public const byte VECTOR_I64 = 0;
+    public const byte VECTOR_U64 = 1;
+    public const byte VECTOR_F64 = 2;
+    public const byte VECTOR_F32 = 3;
+
     public static bool HasOperand(byte opcode)
     {
         switch (opcode)
@@ -265,6 +375,14 @@ public static class Opcode
             case JMP_NOT_ZERO:
             case CALL:
             case LOAD_MEMORY:
+            case VADD:
+            case VSUB:
+            case VMUL:
+            case VFMA:
+            case VMIN:
+            case VMAX:
+            case VSUM:
+            case VDOT:
                 return true;
             default:
                 return false;
@@ -18,6 +18,7 @@ internal static class Program
         List<string> references = new List<string>();
         List<string> sourcePaths = new List<string>();
         string outputPath = null;
+        bool optimize = false;
         bool helpRequested = false;
         OptionSet options = new OptionSet()
         {
@@ -28,6 +29,9 @@ internal static class Program
             {
                 "o=", "The {path} of the output file", v => outputPath = v
             },
+            {
+                "O", "Optimize the generated code", v => optimize = v != null
+            },
             {
                 "<>", v => sourcePaths.Add(v)
             },
@@ -89,7 +93,7 @@ internal static class Program
         }
 
         Compilation compilation = Compilation.Create(syntaxTrees.ToArray());
-        ImmutableArray<Diagnostic> diagnostics = compilation.Emit(outputPath);
+        ImmutableArray<Diagnostic> diagnostics = compilation.Emit(outputPath, optimize);
 
         if (diagnostics.Any())
         {
@@ -0,0 +1,303 @@
+﻿using System.Linq;
+using IllusionScript.Runtime.Binding;
+using IllusionScript.Runtime.Emitting;
+using IllusionScript.Runtime.Memory.Symbols;
+using IllusionScript.Runtime.Parsing;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace IllusionScript.Runtime.Test.Emitting;
+
+public class EmitterTest
+{
+    private readonly ITestOutputHelper testOutputHelper;
+
+    public EmitterTest(ITestOutputHelper testOutputHelper)
+    {
+        this.testOutputHelper = testOutputHelper;
+    }
+
+    [Fact]
+    public void EmitterDuplicatesLocalReadTwice()
+    {
+        string text = @"
+                define sink(x: i64): void {
+                }
+
+                define test(p: i64): i64 {
+                    let a: i64 = p + 1;
+                    sink(a * a);
+                    return 0;
+                }
+            ";
+
+        string emitted = @"
+                [18] test:
+                    mallocpool test
+                    push 8
+                    store 0
+                    push 2
+                    store 8
+                    push 8
+                    store 10
+                    push 8
+                    load 10
+                    push 1
+                    iadd
+                    dup 0
+                    dup 1
+                    imul
+                    call sink
+                    pop
+                    push 0
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+            ";
+
+        AssertEmitted(text, emitted);
+    }
+
+    [Fact]
+    public void EmitterCountsCallArgumentsAboveLocal()
+    {
+        string text = @"
+                define g(x: i64, y: i64, z: i64): void {
+                }
+
+                define test(p: i64): i64 {
+                    let a: i64 = p + 1;
+                    g(1, a, 2);
+                    return 0;
+                }
+            ";
+
+        string emitted = @"
+                [18] test:
+                    mallocpool test
+                    push 8
+                    store 0
+                    push 2
+                    store 8
+                    push 8
+                    store 10
+                    push 8
+                    load 10
+                    push 1
+                    iadd
+                    push 1
+                    dup 1
+                    push 2
+                    call g
+                    pop
+                    push 0
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+            ";
+
+        AssertEmitted(text, emitted);
+    }
+
+    [Fact]
+    public void EmitterMovesLocalBelowConditionToPool()
+    {
+        string text = @"
+                define test(p: i64): i64 {
+                    let a: i64 = p + 1;
+                    if (3 < a) {
+                        return 1;
+                    }
+                    return 2;
+                }
+            ";
+
+        string emitted = @"
+                [26] test:
+                    mallocpool test
+                    push 8
+                    store 0
+                    push 2
+                    store 8
+                    push 8
+                    store 10
+                    push 8
+                    load 10
+                    push 1
+                    iadd
+                    push 8
+                    store 18
+                    push 3
+                    push 8
+                    load 18
+                    ule
+                    jmpz l0
+                    push 1
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+                l0:
+                    push 2
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+            ";
+
+        AssertEmitted(text, emitted);
+    }
+
+    [Fact]
+    public void EmitterKeepsValueOfAssignmentExpression()
+    {
+        string text = @"
+                define sink(x: i64): void {
+                }
+
+                define test(p: i64): i64 {
+                    let a: i64 = 0;
+                    sink((a = p + 1) * 2);
+                    return a;
+                }
+            ";
+
+        string emitted = @"
+                [26] test:
+                    mallocpool test
+                    push 8
+                    store 0
+                    push 2
+                    store 8
+                    push 8
+                    store 10
+                    push 0
+                    push 8
+                    store 18
+                    push 8
+                    load 10
+                    push 1
+                    iadd
+                    dup 0
+                    push 8
+                    store 18
+                    push 2
+                    imul
+                    call sink
+                    push 8
+                    load 18
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+            ";
+
+        AssertEmitted(text, emitted);
+    }
+
+    [Fact]
+    public void EmitterDropsNothingAfterAssignmentStatement()
+    {
+        string text = @"
+                define test(p: i64): i64 {
+                    let a: i64 = 0;
+                    a = p + 1;
+                    return a;
+                }
+            ";
+
+        string emitted = @"
+                [26] test:
+                    mallocpool test
+                    push 8
+                    store 0
+                    push 2
+                    store 8
+                    push 8
+                    store 10
+                    push 0
+                    push 8
+                    store 18
+                    push 8
+                    load 10
+                    push 1
+                    iadd
+                    push 8
+                    store 18
+                    push 8
+                    load 18
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+            ";
+
+        AssertEmitted(text, emitted);
+    }
+
+    [Fact]
+    public void EmitterNegatesFoldedNegativeConstant()
+    {
+        string text = @"
+                define test(p: i64): i64 {
+                    return p * (0 - 5);
+                }
+            ";
+
+        string emitted = @"
+                [18] test:
+                    mallocpool test
+                    push 8
+                    store 0
+                    push 2
+                    store 8
+                    push 8
+                    store 10
+                    push 8
+                    load 10
+                    push 5
+                    ineg
+                    imul
+                    push 2
+                    load 8
+                    push 8
+                    load 0
+                    freepool
+                    ret
+            ";
+
+        AssertEmitted(text, emitted, true);
+    }
+
+    private void AssertEmitted(string text, string expectedEmitted, bool optimize = false)
+    {
+        testOutputHelper.WriteLine(text);
+        SyntaxTree syntaxTree = SyntaxTree.Parse(text);
+        Compilation compilation = Compilation.Create(syntaxTree);
+        Assert.Empty(compilation.Check());
+
+        BoundProgram program = Binder.BindProgram(compilation.GlobalScope, optimize);
+        FunctionSymbol function = compilation.functions.Single(f => f.name == "test");
+        string actualEmitted = Emitter.EmitFunction(program, function);
+        testOutputHelper.WriteLine(actualEmitted);
+
+        Assert.Equal(
+            string.Join("\n", AnnotatedText.UnindentLines(expectedEmitted)),
+            string.Join("\n", AnnotatedText.UnindentLines(actualEmitted))
+        );
+    }
+}
@@ -0,0 +1,198 @@
+﻿using System.Linq;
+using IllusionScript.Runtime.Binding;
+using IllusionScript.Runtime.Emitting;
+using IllusionScript.Runtime.Memory.Symbols;
+using IllusionScript.Runtime.Parsing;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace IllusionScript.Runtime.Test.Lowering;
+
+public class OptimizerTest
+{
+    private readonly ITestOutputHelper testOutputHelper;
+
+    public OptimizerTest(ITestOutputHelper testOutputHelper)
+    {
+        this.testOutputHelper = testOutputHelper;
+    }
+
+    [Theory]
+    [InlineData("i64", "2 + 3 * 4", "push 14")]
+    [InlineData("boolean", "1 < 2", "push 1")]
+    [InlineData("i64", "0 - 5", "push 5; ineg")]
+    [InlineData("i64", "~0", "push 1; ineg")]
+    [InlineData("i64", "10 / 0", "push 10; push 0; idiv")]
+    [InlineData("i64", "10 % 0", "push 10; push 0; imod")]
+    [InlineData("i64", "2147483647 + 1", "push 2147483647; push 1; iadd")]
+    [InlineData("i64", "-2147483647 - 2", "push 2147483647; ineg; push 2; isub")]
+    [InlineData("boolean", "-1 < 2", "push 1; ineg; push 2; ule")]
+    [InlineData("boolean", "2 >= -1", "push 2; push 1; ineg; ugeq")]
+    [InlineData("i64", "-8 >> 1", "push 8; ineg; push 1; rshift")]
+    public void OptimizerFoldsOnlySafeConstants(string type, string expression, string expectedInstructions)
+    {
+        string text = $@"
+                define test(): {type} {{
+                    return {expression};
+                }}
+            ";
+
+        BoundProgram program = Bind(text, out FunctionSymbol function);
+        string[] emitted = AnnotatedText.UnindentLines(Emitter.EmitFunction(program, function));
+        testOutputHelper.WriteLine(string.Join("\n", emitted));
+
+        // Leaves out the label, the prologue and the epilogue
+        string actualInstructions = string.Join("; ", emitted.Skip(6).SkipLast(6).Select(line => line.Trim()));
+        Assert.Equal(expectedInstructions, actualInstructions);
+    }
+
+    [Fact]
+    public void OptimizerKillsCopyAfterReassignment()
+    {
+        string text = @"
+                define test(p: i64): i64 {
+                    let a: i64 = p * 2;
+                    let b: i64 = a;
+                    a = a + 1;
+                    return b + a;
+                }
+            ";
+
+        string body = @"
+                {
+                    let a = p*2
+                    let b = a
+                    a = a+1
+                    return b+a
+                }
+            ";
+
+        AssertOptimized(text, body);
+    }
+
+    [Fact]
+    public void OptimizerKeepsLoopCarriedVariable()
+    {
+        string text = @"
+                define test(p: i64): i64 {
+                    let a: i64 = 1;
+                    let i: i64 = 0;
+                    while (i < p) {
+                        a = a * 2;
+                        i = i + 1;
+                    }
+                    return a;
+                }
+            ";
+
+        string body = @"
+                {
+                    let a = 1
+                    let i = 0
+                    goto c0
+                l0:
+                    a = a*2
+                    i = i+1
+                c0:
+                    goto l0 if i<p
+                    return a
+                }
+            ";
+
+        AssertOptimized(text, body);
+    }
+
+    [Fact]
+    public void OptimizerKeepsSideEffectsOfDeadStore()
+    {
+        string text = @"
+                define next(): i64 {
+                    return 1;
+                }
+
+                define test(): i64 {
+                    let a: i64 = 0;
+                    a = next();
+                    a = 5;
+                    return a;
+                }
+            ";
+
+        string body = @"
+                {
+                    next()
+                    return 5
+                }
+            ";
+
+        AssertOptimized(text, body);
+    }
+
+    [Fact]
+    public void OptimizerKeepsDeclarationOfAssignedVariable()
+    {
+        string text = @"
+                define test(p: i64): i64 {
+                    let a: i64 = p;
+                    let b: i64 = a + 1;
+                    a = b * 2;
+                    return a;
+                }
+            ";
+
+        string body = @"
+                {
+                    let a = p
+                    let b = p+1
+                    a = b*2
+                    return a
+                }
+            ";
+
+        AssertOptimized(text, body);
+    }
+
+    [Fact]
+    public void OptimizerRemovesFoldedBranch()
+    {
+        string text = @"
+                define test(): i64 {
+                    if (false) {
+                        return 1;
+                    }
+                    return 2;
+                }
+            ";
+
+        string body = @"
+                {
+                    return 2
+                }
+            ";
+
+        AssertOptimized(text, body);
+    }
+
+    private void AssertOptimized(string text, string expectedBody)
+    {
+        BoundProgram program = Bind(text, out FunctionSymbol function);
+        string actualBody = program.functionBodies[function].ToString();
+        testOutputHelper.WriteLine(actualBody);
+
+        Assert.Equal(
+            string.Join("\n", AnnotatedText.UnindentLines(expectedBody)),
+            string.Join("\n", AnnotatedText.UnindentLines(actualBody))
+        );
+    }
+
+    private BoundProgram Bind(string text, out FunctionSymbol function)
+    {
+        testOutputHelper.WriteLine(text);
+        SyntaxTree syntaxTree = SyntaxTree.Parse(text);
+        Compilation compilation = Compilation.Create(syntaxTree);
+        Assert.Empty(compilation.Check());
+
+        function = compilation.functions.Single(f => f.name == "test");
+        return Binder.BindProgram(compilation.GlobalScope, true);
+    }
+}
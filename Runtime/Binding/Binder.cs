@@ -517,7 +517,7 @@ internal sealed class Binder
     }
 
 
-    public static BoundProgram BindProgram(GlobalScope globalScope)
+    public static BoundProgram BindProgram(GlobalScope globalScope, bool optimize)
     {
         Scope parentScope = CreateBaseScope(globalScope);
         ImmutableDictionary<FunctionSymbol, BoundBlockStatement>.Builder functionBodies =
@@ -540,6 +540,11 @@ internal sealed class Binder
                 binder.diagnostics.ReportAllPathsMustReturn(function.declaration.identifier.location);
             }
 
+            if (optimize && !binder.diagnostics.Any())
+            {
+                loweredBody = Lowerer.Optimize(loweredBody);
+            }
+
             functionBodies.Add(function, loweredBody);
 
             diagnostics.AddRange(binder.diagnostics);
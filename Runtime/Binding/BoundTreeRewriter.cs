@@ -134,12 +134,18 @@ internal abstract class BoundTreeRewriter
             return node;
         }
 
-        return new BoundVariableDeclarationStatement(node.variable, node.initializer);
+        return new BoundVariableDeclarationStatement(node.variable, initializer);
     }
 
     protected virtual BoundStatement RewriteExpressionStatement(BoundExpressionStatement node)
     {
-        return node;
+        BoundExpression expression = RewriteExpression(node.expression);
+        if (expression == node.expression)
+        {
+            return node;
+        }
+
+        return new BoundExpressionStatement(expression);
     }
 
     protected virtual BoundStatement RewriteBlockStatement(BoundBlockStatement node)
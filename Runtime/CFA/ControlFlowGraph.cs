@@ -4,6 +4,7 @@ using System.IO;
 using System.Linq;
 using IllusionScript.Runtime.Binding;
 using IllusionScript.Runtime.Binding.Nodes.Statements;
+using IllusionScript.Runtime.Memory.Symbols;
 
 namespace IllusionScript.Runtime.CFA;
 
@@ -67,6 +68,12 @@ internal partial class ControlFlowGraph
         return graphBuilder.Build(blocks);
     }
 
+    public static Dictionary<VariableSymbol, int> FindStackLocals(BoundBlockStatement body)
+    {
+        StackLocalFinder stackLocalFinder = new StackLocalFinder();
+        return stackLocalFinder.Find(body, Create(body));
+    }
+
     public static bool AllPathsReturn(BoundBlockStatement body)
     {
         ControlFlowGraph graph = Create(body);
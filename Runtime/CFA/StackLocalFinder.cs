@@ -0,0 +1,113 @@
+﻿using System.Collections.Generic;
+using System.Linq;
+using IllusionScript.Runtime.Binding.Nodes;
+using IllusionScript.Runtime.Binding.Nodes.Expressions;
+using IllusionScript.Runtime.Binding.Nodes.Statements;
+using IllusionScript.Runtime.Memory.Symbols;
+
+namespace IllusionScript.Runtime.CFA;
+
+internal partial class ControlFlowGraph
+{
+    /*
+     * Finds the locals that can stay on the operand stack instead of the frame pool: declared in a basic block, read
+     * only by later statements of the same block and never assigned to. Such a value is dead once its block ends,
+     * so the emitter never has to keep it across a jump, and since it never changes a copy made with dup is as good
+     * as a load. Locals smaller than a Word stay in the pool as well, the store there truncates them.
+     */
+    public sealed class StackLocalFinder
+    {
+        private readonly Dictionary<VariableSymbol, BasicBlock> declaredIn;
+        private readonly Dictionary<VariableSymbol, int> reads;
+        private readonly HashSet<VariableSymbol> rejected;
+
+        public StackLocalFinder()
+        {
+            declaredIn = new Dictionary<VariableSymbol, BasicBlock>();
+            reads = new Dictionary<VariableSymbol, int>();
+            rejected = new HashSet<VariableSymbol>();
+        }
+
+        // Returns the locals together with the number of times they are read
+        public Dictionary<VariableSymbol, int> Find(BoundBlockStatement body, ControlFlowGraph graph)
+        {
+            Dictionary<BoundStatement, BasicBlock> blockFromStatement = new Dictionary<BoundStatement, BasicBlock>();
+            foreach (BasicBlock block in graph.blocks)
+            {
+                foreach (BoundStatement statement in block.statements)
+                {
+                    blockFromStatement.Add(statement, block);
+                }
+            }
+
+            // Statements of unreachable blocks are still emitted, they belong to no block and keep their locals in the
+            // pool
+            foreach (BoundStatement statement in body.statements)
+            {
+                BasicBlock block = blockFromStatement.GetValueOrDefault(statement);
+                switch (statement)
+                {
+                    case BoundVariableDeclarationStatement declaration:
+                        Visit(block, declaration.initializer);
+                        if (block != null && declaration.variable.type.size == TypeSymbol.i64.size)
+                        {
+                            declaredIn.Add(declaration.variable, block);
+                            reads.Add(declaration.variable, 0);
+                        }
+                        break;
+                    case BoundExpressionStatement expressionStatement:
+                        Visit(block, expressionStatement.expression);
+                        break;
+                    case BoundConditionalGotoStatement conditionalGotoStatement:
+                        Visit(block, conditionalGotoStatement.condition);
+                        break;
+                    case BoundReturnStatement returnStatement when returnStatement.expression != null:
+                        Visit(block, returnStatement.expression);
+                        break;
+                }
+            }
+
+            return reads.Where(pair => !rejected.Contains(pair.Key))
+                .ToDictionary(pair => pair.Key, pair => pair.Value);
+        }
+
+        private void Visit(BasicBlock block, BoundExpression expression)
+        {
+            switch (expression)
+            {
+                case BoundVariableExpression variableExpression:
+                    VariableSymbol variable = variableExpression.variableSymbol;
+                    // A read in another block or ahead of the declaration needs the value after a jump
+                    if (block == null || declaredIn.GetValueOrDefault(variable) != block)
+                    {
+                        rejected.Add(variable);
+                    }
+                    else
+                    {
+                        reads[variable]++;
+                    }
+                    break;
+                case BoundAssignmentExpression assignmentExpression:
+                    Visit(block, assignmentExpression.expression);
+                    rejected.Add(assignmentExpression.variableSymbol);
+                    break;
+                case BoundUnaryExpression unaryExpression:
+                    Visit(block, unaryExpression.right);
+                    break;
+                case BoundBinaryExpression binaryExpression:
+                    Visit(block, binaryExpression.left);
+                    Visit(block, binaryExpression.right);
+                    break;
+                case BoundCallExpression callExpression:
+                    foreach (BoundExpression argument in callExpression.arguments)
+                    {
+                        Visit(block, argument);
+                    }
+                    break;
+                case BoundConversionExpression conversionExpression:
+                    Visit(block, conversionExpression.expression);
+                    break;
+            }
+        }
+    }
+}
\ No newline at end of file
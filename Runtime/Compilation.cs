@@ -45,20 +45,20 @@ public sealed class Compilation
         }
     }
 
-    private BoundProgram GetProgram()
+    private BoundProgram GetProgram(bool optimize)
     {
-        return Binder.BindProgram(GlobalScope);
+        return Binder.BindProgram(GlobalScope, optimize);
     }
 
     public ImmutableArray<Diagnostic> Check()
     {
-        BoundProgram program = GetProgram();
+        BoundProgram program = GetProgram(false);
         return syntaxTrees.SelectMany(syntaxTree => syntaxTree.diagnostics).Concat(program.diagnostics).ToImmutableArray();
     }
 
-    public ImmutableArray<Diagnostic> Emit(string outputPath)
+    public ImmutableArray<Diagnostic> Emit(string outputPath, bool optimize = false)
     {
-        BoundProgram program = GetProgram();
+        BoundProgram program = GetProgram(optimize);
         return Emitter.Emit(program, outputPath);
     }
 }
\ No newline at end of file
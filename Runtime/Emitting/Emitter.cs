@@ -9,7 +9,9 @@ using IllusionScript.Runtime.Binding;
 using IllusionScript.Runtime.Binding.Nodes.Expressions;
 using IllusionScript.Runtime.Binding.Nodes.Statements;
 using IllusionScript.Runtime.Binding.Operators;
+using IllusionScript.Runtime.CFA;
 using IllusionScript.Runtime.Diagnostics;
+using IllusionScript.Runtime.Memory;
 using IllusionScript.Runtime.Memory.Symbols;
 
 namespace IllusionScript.Runtime.Emitting;
@@ -25,6 +27,14 @@ internal class Emitter
     private Dictionary<VariableSymbol, int> pool;
     private static Dictionary<string, string> stringMemory = new Dictionary<string, string>();
 
+    // Locals kept on the operand stack instead of the pool, see ControlFlowGraph.StackLocalFinder. The stack list
+    // holds the ones currently on the stack from the bottom up, reads their remaining reads and temporaries the
+    // number of values of the current expression above them.
+    private readonly Dictionary<VariableSymbol, int> stackLocals;
+    private List<VariableSymbol> stack;
+    private Dictionary<VariableSymbol, int> reads;
+    private int temporaries;
+
     private Emitter(FunctionSymbol function, BoundBlockStatement body)
     {
         this.poolSize = 10; // 10 cause of the return and program-pool address
@@ -32,12 +42,42 @@ internal class Emitter
         this.function = function;
         this.body = body;
         this.pool = new Dictionary<VariableSymbol, int>();
+        this.stackLocals = ControlFlowGraph.FindStackLocals(body);
     }
 
-
     private string Emit()
+    {
+        // A jump or return with locals still below its operand gives them up, they are moved to the pool and the
+        // function is emitted again
+        int strings = stringMemory.Count;
+        while (!TryEmit(out List<VariableSymbol> leftOver))
+        {
+            foreach (VariableSymbol variable in leftOver)
+            {
+                stackLocals.Remove(variable);
+            }
+            for (int i = stringMemory.Count - 1; i >= strings; i--)
+            {
+                stringMemory.Remove($"__string_{functionLabel}_{i}");
+            }
+        }
+
+        string emitted =
+            "[" + poolSize + "] " + functionLabel + ":\n" +
+            writer;
+
+        return emitted;
+    }
+
+    private bool TryEmit(out List<VariableSymbol> leftOver)
     {
         writer = new StringWriter();
+        poolSize = 10;
+        pool = new Dictionary<VariableSymbol, int>();
+        stack = new List<VariableSymbol>();
+        reads = new Dictionary<VariableSymbol, int>(stackLocals);
+        temporaries = 0;
+        leftOver = null;
 
         WriteInst("mallocpool", functionLabel);
         WriteInst("push", 8);
@@ -65,19 +105,34 @@ internal class Emitter
             {
                 case BoundNodeType.ExpressionStatement:
                     BoundExpressionStatement expressionStatement = (BoundExpressionStatement)statement;
-                    EmitExpression(expressionStatement.expression);
-                    if (expressionStatement.expression.type != TypeSymbol.@void)
+                    if (expressionStatement.expression.boundType == BoundNodeType.AssignmentExpression)
+                    {
+                        EmitAssignment((BoundAssignmentExpression)expressionStatement.expression, false);
+                    }
+                    else
                     {
-                        WriteInst("pop");
+                        EmitExpression(expressionStatement.expression);
+                        if (expressionStatement.expression.type != TypeSymbol.@void)
+                        {
+                            WriteInst("pop");
+                        }
                     }
+                    DropDeadLocals();
                     break;
                 case BoundNodeType.VariableDeclarationStatement:
                     BoundVariableDeclarationStatement variableDeclarationStatement = (BoundVariableDeclarationStatement)statement;
+                    EmitExpression(variableDeclarationStatement.initializer);
+                    if (stackLocals.ContainsKey(variableDeclarationStatement.variable))
+                    {
+                        stack.Add(variableDeclarationStatement.variable);
+                        DropDeadLocals();
+                        break;
+                    }
                     pool.Add(variableDeclarationStatement.variable, poolSize);
                     poolSize += GetTypeSize(variableDeclarationStatement.variable.type);
-                    EmitExpression(variableDeclarationStatement.initializer);
                     WriteInst("push", GetTypeSize(variableDeclarationStatement.variable.type));
                     WriteInst("store", pool[variableDeclarationStatement.variable]);
+                    DropDeadLocals();
                     break;
                 case BoundNodeType.LabelStatement:
                     WriteLabel(((BoundLabelStatement)statement).BoundLabel.name);
@@ -85,6 +140,11 @@ internal class Emitter
                 case BoundNodeType.ConditionalGotoStatement:
                     BoundConditionalGotoStatement conditionalGotoStatement = (BoundConditionalGotoStatement)statement;
                     EmitExpression(conditionalGotoStatement.condition);
+                    if (stack.Count != 0)
+                    {
+                        leftOver = stack;
+                        return false;
+                    }
                     WriteInst(conditionalGotoStatement.jmpIfTrue ? "jmpnz" : "jmpz", conditionalGotoStatement.boundLabel.name);
                     break;
                 case BoundNodeType.GotoStatement:
@@ -96,6 +156,11 @@ internal class Emitter
                     {
                         EmitExpression(returnStatement.expression);
                     }
+                    if (stack.Count != 0)
+                    {
+                        leftOver = stack;
+                        return false;
+                    }
                     WriteInst("push", 2);
                     WriteInst("load", 8);
                     WriteInst("push", 8);
@@ -108,11 +173,27 @@ internal class Emitter
             }
         }
 
-        string emitted =
-            "[" + poolSize + "] " + functionLabel + ":\n" +
-            writer;
+        return true;
+    }
 
-        return emitted;
+    private void DropDeadLocals()
+    {
+        while (stack.Count != 0 && reads[stack[^1]] == 0)
+        {
+            stack.RemoveAt(stack.Count - 1);
+            WriteInst("pop");
+        }
+    }
+
+    private void EmitAssignment(BoundAssignmentExpression assignmentExpression, bool used)
+    {
+        EmitExpression(assignmentExpression.expression);
+        if (used)
+        {
+            WriteInst("dup", 0);
+        }
+        WriteInst("push", GetTypeSize(assignmentExpression.variableSymbol.type));
+        WriteInst("store", pool[assignmentExpression.variableSymbol]);
     }
 
     private void EmitExpression(BoundExpression expression)
@@ -129,6 +210,17 @@ internal class Emitter
                     stringMemory.Add(name, (string)literalExpression.value);
                     WriteInst("loadmemory", name);
                 }
+                else if (literalExpression.type == TypeSymbol.boolean)
+                {
+                    WriteInst("push", (bool)literalExpression.value ? 1 : 0);
+                }
+                else if (literalExpression.value is int value && value < 0)
+                {
+                    // Only the optimizer makes negative literals, the assembler takes digits so they are negated at
+                    // run time like the source they were folded from
+                    WriteInst("push", -(long)value);
+                    WriteInst(GetTypeChar(literalExpression.type) + "neg");
+                }
                 else
                 {
                     WriteInst("push", literalExpression.value);
@@ -161,7 +253,9 @@ internal class Emitter
             case BoundNodeType.BinaryExpression:
                 BoundBinaryExpression binaryExpression = (BoundBinaryExpression)expression;
                 EmitExpression(binaryExpression.left);
+                temporaries++;
                 EmitExpression(binaryExpression.right);
+                temporaries--;
 
                 type = GetTypeChar(binaryExpression.binaryOperator.resultType);
 
@@ -228,20 +322,39 @@ internal class Emitter
                 break;
             case BoundNodeType.VariableExpression:
                 BoundVariableExpression variableExpression = (BoundVariableExpression)expression;
-                WriteInst("push", GetTypeSize(variableExpression.variableSymbol.type));
-                WriteInst("load", pool[variableExpression.variableSymbol]);
+                int index = stack.IndexOf(variableExpression.variableSymbol);
+                if (index == -1)
+                {
+                    WriteInst("push", GetTypeSize(variableExpression.variableSymbol.type));
+                    WriteInst("load", pool[variableExpression.variableSymbol]);
+                    break;
+                }
+
+                // The last read of the local on top of the stack takes its value instead of copying it
+                int depth = temporaries + stack.Count - 1 - index;
+                reads[variableExpression.variableSymbol]--;
+                if (depth == 0 && reads[variableExpression.variableSymbol] == 0)
+                {
+                    stack.RemoveAt(index);
+                    break;
+                }
+                WriteInst("dup", depth);
                 break;
             case BoundNodeType.AssignmentExpression:
-                BoundAssignmentExpression assignmentExpression = (BoundAssignmentExpression)expression;
-                EmitExpression(assignmentExpression.expression);
-                WriteInst("push", GetTypeSize(assignmentExpression.variableSymbol.type));
-                WriteInst("store", pool[assignmentExpression.variableSymbol]);
+                EmitAssignment((BoundAssignmentExpression)expression, true);
                 break;
             case BoundNodeType.CallExpression:
                 BoundCallExpression callExpression = (BoundCallExpression)expression;
                 foreach (BoundExpression argument in callExpression.arguments)
                 {
                     EmitExpression(argument);
+                    temporaries++;
+                }
+                temporaries -= callExpression.arguments.Length;
+                if (BuiltInFunctions.TryGetInstruction(callExpression.function, out string inst, out byte vectorType))
+                {
+                    WriteInst(inst, vectorType);
+                    break;
                 }
                 WriteInst("call", callExpression.function.name);
                 break;
@@ -396,15 +509,19 @@ internal class Emitter
                 continue;
             }
 
-            Emitter emitter = new Emitter(function, program.functionBodies[function]);
-            string emitted = emitter.Emit();
-            writer.WriteLine(emitted);
+            writer.WriteLine(EmitFunction(program, function));
         }
         writer.Close();
         writer.Dispose();
         return packagePath;
     }
 
+    internal static string EmitFunction(BoundProgram program, FunctionSymbol function)
+    {
+        Emitter emitter = new Emitter(function, program.functionBodies[function]);
+        return emitter.Emit();
+    }
+
     private static string EmitStaticMemory(string outputPath)
     {
         string staticMemoryPath = Path.Combine(outputPath, ".cf", "__memory__.cf");
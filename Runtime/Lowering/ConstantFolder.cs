@@ -0,0 +1,157 @@
+﻿using IllusionScript.Runtime.Binding;
+using IllusionScript.Runtime.Binding.Nodes.Expressions;
+using IllusionScript.Runtime.Binding.Nodes.Statements;
+using IllusionScript.Runtime.Binding.Operators;
+using IllusionScript.Runtime.Memory.Symbols;
+
+namespace IllusionScript.Runtime.Lowering;
+
+internal sealed class ConstantFolder : BoundTreeRewriter
+{
+    private ConstantFolder()
+    {
+    }
+
+    public static BoundBlockStatement Fold(BoundBlockStatement body)
+    {
+        ConstantFolder constantFolder = new ConstantFolder();
+        return (BoundBlockStatement)constantFolder.RewriteStatement(body);
+    }
+
+    protected override BoundExpression RewriteUnaryExpression(BoundUnaryExpression node)
+    {
+        BoundExpression expression = base.RewriteUnaryExpression(node);
+        if (expression is BoundUnaryExpression { right: BoundLiteralExpression right } unaryExpression)
+        {
+            BoundConstant constant = ComputeConstant(unaryExpression.unaryOperator, right.value);
+            if (constant != null)
+            {
+                return new BoundLiteralExpression(constant.value);
+            }
+        }
+
+        return expression;
+    }
+
+    protected override BoundExpression RewriteBinaryExpression(BoundBinaryExpression node)
+    {
+        BoundExpression expression = base.RewriteBinaryExpression(node);
+        if (expression is BoundBinaryExpression
+            {
+                left: BoundLiteralExpression left, right: BoundLiteralExpression right
+            } binaryExpression)
+        {
+            BoundConstant constant = ComputeConstant(left.value, binaryExpression.binaryOperator, right.value);
+            if (constant != null)
+            {
+                return new BoundLiteralExpression(constant.value);
+            }
+        }
+
+        return expression;
+    }
+
+    // Literals are ints or bools, a result an int cannot hold is left to the machine
+    private static BoundConstant ComputeConstant(BoundUnaryOperator unaryOperator, object right)
+    {
+        switch (unaryOperator.operatorType)
+        {
+            case BoundUnaryOperatorType.Identity:
+                return new BoundConstant(right);
+            case BoundUnaryOperatorType.Negation when right is int value && value != int.MinValue:
+                return new BoundConstant(-value);
+            case BoundUnaryOperatorType.OnesComplement when right is int value:
+                return new BoundConstant(~value);
+            case BoundUnaryOperatorType.LogicalNegation when right is bool value:
+                return new BoundConstant(!value);
+            default:
+                return null;
+        }
+    }
+
+    private static BoundConstant ComputeConstant(object left, BoundBinaryOperator binaryOperator, object right)
+    {
+        if (left is bool leftBool && right is bool rightBool)
+        {
+            switch (binaryOperator.operatorType)
+            {
+                case BoundBinaryOperatorType.LogicalAnd:
+                case BoundBinaryOperatorType.BitwiseAnd:
+                    return new BoundConstant(leftBool & rightBool);
+                case BoundBinaryOperatorType.LogicalOr:
+                case BoundBinaryOperatorType.BitwiseOr:
+                    return new BoundConstant(leftBool | rightBool);
+                case BoundBinaryOperatorType.BitwiseXor:
+                case BoundBinaryOperatorType.NotEquals:
+                    return new BoundConstant(leftBool ^ rightBool);
+                case BoundBinaryOperatorType.Equals:
+                    return new BoundConstant(leftBool == rightBool);
+                default:
+                    return null;
+            }
+        }
+
+        if (left is not int leftInt || right is not int rightInt ||
+            binaryOperator.leftType != TypeSymbol.i64 || binaryOperator.rightType != TypeSymbol.i64)
+        {
+            return null;
+        }
+
+        long a = leftInt;
+        long b = rightInt;
+        switch (binaryOperator.operatorType)
+        {
+            case BoundBinaryOperatorType.Addition:
+                return Integer(a + b);
+            case BoundBinaryOperatorType.Subtraction:
+                return Integer(a - b);
+            case BoundBinaryOperatorType.Multiplication:
+                return Integer(a * b);
+            // Dividing by zero stops the machine, it has to happen at runtime
+            case BoundBinaryOperatorType.Division when b != 0:
+                return Integer(a / b);
+            case BoundBinaryOperatorType.Modulo when b != 0:
+                return Integer(a % b);
+            case BoundBinaryOperatorType.BitwiseAnd:
+                return Integer(a & b);
+            case BoundBinaryOperatorType.BitwiseOr:
+                return Integer(a | b);
+            case BoundBinaryOperatorType.BitwiseXor:
+                return Integer(a ^ b);
+            // The machine shifts unsigned Words
+            case BoundBinaryOperatorType.BitwiseShiftLeft when a >= 0 && b is >= 0 and < 64:
+                return a << (int)b >> (int)b == a ? Integer(a << (int)b) : null;
+            case BoundBinaryOperatorType.BitwiseShiftRight when a >= 0 && b is >= 0 and < 64:
+                return Integer(a >> (int)b);
+            case BoundBinaryOperatorType.Equals:
+                return new BoundConstant(a == b);
+            case BoundBinaryOperatorType.NotEquals:
+                return new BoundConstant(a != b);
+        }
+
+        // Comparisons are emitted unsigned, both orders only agree for positive operands
+        if (a < 0 || b < 0)
+        {
+            return null;
+        }
+
+        switch (binaryOperator.operatorType)
+        {
+            case BoundBinaryOperatorType.Less:
+                return new BoundConstant(a < b);
+            case BoundBinaryOperatorType.LessEquals:
+                return new BoundConstant(a <= b);
+            case BoundBinaryOperatorType.Greater:
+                return new BoundConstant(a > b);
+            case BoundBinaryOperatorType.GreaterEquals:
+                return new BoundConstant(a >= b);
+            default:
+                return null;
+        }
+    }
+
+    private static BoundConstant Integer(long value)
+    {
+        return value is >= int.MinValue and <= int.MaxValue ? new BoundConstant((int)value) : null;
+    }
+}
\ No newline at end of file
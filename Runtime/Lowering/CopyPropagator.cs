@@ -0,0 +1,193 @@
+﻿using System.Collections.Generic;
+using System.Collections.Immutable;
+using System.Linq;
+using IllusionScript.Runtime.Binding;
+using IllusionScript.Runtime.Binding.Nodes.Expressions;
+using IllusionScript.Runtime.Binding.Nodes.Statements;
+using IllusionScript.Runtime.CFA;
+using IllusionScript.Runtime.Memory.Symbols;
+
+namespace IllusionScript.Runtime.Lowering;
+
+/*
+ * Replaces reads of variables that hold a literal or a copy of another variable on every path to the read. The
+ * values are found by a forward dataflow over the control flow graph: a block starts with what all its
+ * predecessors agree on and every store updates the value of its variable and forgets the copies of it.
+ */
+internal sealed class CopyPropagator : BoundTreeRewriter
+{
+    // Value of each variable before the statement being rewritten. A variable that is missing was not stored on any
+    // path so far, null means its value is not known.
+    private Dictionary<VariableSymbol, BoundExpression> values;
+
+    private CopyPropagator()
+    {
+    }
+
+    public static BoundBlockStatement Propagate(BoundBlockStatement body)
+    {
+        ControlFlowGraph graph = ControlFlowGraph.Create(body);
+        Dictionary<ControlFlowGraph.BasicBlock, Dictionary<VariableSymbol, BoundExpression>> inputs =
+            new Dictionary<ControlFlowGraph.BasicBlock, Dictionary<VariableSymbol, BoundExpression>>();
+        Dictionary<ControlFlowGraph.BasicBlock, Dictionary<VariableSymbol, BoundExpression>> outputs =
+            new Dictionary<ControlFlowGraph.BasicBlock, Dictionary<VariableSymbol, BoundExpression>>();
+        outputs.Add(graph.start, new Dictionary<VariableSymbol, BoundExpression>());
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            foreach (ControlFlowGraph.BasicBlock block in graph.blocks)
+            {
+                List<Dictionary<VariableSymbol, BoundExpression>> predecessors = block.incoming
+                    .Where(branch => outputs.ContainsKey(branch.from))
+                    .Select(branch => outputs[branch.from])
+                    .ToList();
+                if (block == graph.start || predecessors.Count == 0)
+                {
+                    continue;
+                }
+
+                Dictionary<VariableSymbol, BoundExpression> input = Meet(predecessors);
+                Dictionary<VariableSymbol, BoundExpression> output =
+                    new Dictionary<VariableSymbol, BoundExpression>(input);
+                foreach (BoundStatement statement in block.statements)
+                {
+                    Transfer(output, statement);
+                }
+
+                inputs[block] = input;
+                if (!outputs.TryGetValue(block, out Dictionary<VariableSymbol, BoundExpression> previous) ||
+                    !Same(previous, output))
+                {
+                    outputs[block] = output;
+                    changed = true;
+                }
+            }
+        }
+
+        CopyPropagator copyPropagator = new CopyPropagator();
+        Dictionary<BoundStatement, BoundStatement> rewritten = new Dictionary<BoundStatement, BoundStatement>();
+        foreach ((ControlFlowGraph.BasicBlock block, Dictionary<VariableSymbol, BoundExpression> input) in inputs)
+        {
+            copyPropagator.values = new Dictionary<VariableSymbol, BoundExpression>(input);
+            foreach (BoundStatement statement in block.statements)
+            {
+                // The values may change halfway through an expression that assigns
+                if (!UsageCollector.Collect(UsageCollector.GetEvaluated(statement, out _)).assignments.Any())
+                {
+                    rewritten.Add(statement, copyPropagator.RewriteStatement(statement));
+                }
+
+                Transfer(copyPropagator.values, statement);
+            }
+        }
+
+        ImmutableArray<BoundStatement> statements = body.statements
+            .Select(statement => rewritten.GetValueOrDefault(statement, statement))
+            .ToImmutableArray();
+        if (statements.SequenceEqual(body.statements))
+        {
+            return body;
+        }
+
+        return new BoundBlockStatement(statements);
+    }
+
+    protected override BoundExpression RewriteVariableExpression(BoundVariableExpression node)
+    {
+        if (values.TryGetValue(node.variableSymbol, out BoundExpression value) && value != null)
+        {
+            return value;
+        }
+
+        return node;
+    }
+
+    private static void Transfer(Dictionary<VariableSymbol, BoundExpression> values, BoundStatement statement)
+    {
+        BoundExpression evaluated = UsageCollector.GetEvaluated(statement, out VariableSymbol target);
+        foreach (VariableSymbol variable in UsageCollector.Collect(evaluated).assignments)
+        {
+            Kill(values, variable);
+        }
+
+        if (target != null)
+        {
+            Kill(values, target);
+            values[target] = IsCopy(target, evaluated) ? evaluated : null;
+        }
+    }
+
+    private static void Kill(Dictionary<VariableSymbol, BoundExpression> values, VariableSymbol variable)
+    {
+        values[variable] = null;
+        foreach (VariableSymbol copy in values.Keys.ToList())
+        {
+            if (values[copy] is BoundVariableExpression copied && copied.variableSymbol == variable)
+            {
+                values[copy] = null;
+            }
+        }
+    }
+
+    // Strings are not copied, each literal gets its own memory
+    private static bool IsCopy(VariableSymbol target, BoundExpression expression)
+    {
+        switch (expression)
+        {
+            case BoundLiteralExpression literalExpression:
+                return literalExpression.type == target.type && literalExpression.type != TypeSymbol.@string;
+            case BoundVariableExpression variableExpression:
+                VariableSymbol variable = variableExpression.variableSymbol;
+                return variable != target && variable.type == target.type &&
+                       variable is LocalVariableSymbol or ParameterSymbol;
+            default:
+                return false;
+        }
+    }
+
+    private static Dictionary<VariableSymbol, BoundExpression> Meet(
+        List<Dictionary<VariableSymbol, BoundExpression>> predecessors)
+    {
+        Dictionary<VariableSymbol, BoundExpression> result =
+            new Dictionary<VariableSymbol, BoundExpression>(predecessors[0]);
+        foreach (Dictionary<VariableSymbol, BoundExpression> predecessor in predecessors.Skip(1))
+        {
+            foreach ((VariableSymbol variable, BoundExpression value) in predecessor)
+            {
+                if (!result.TryGetValue(variable, out BoundExpression current))
+                {
+                    result.Add(variable, value);
+                }
+                else if (!Equivalent(current, value))
+                {
+                    result[variable] = null;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    private static bool Same(Dictionary<VariableSymbol, BoundExpression> a, Dictionary<VariableSymbol, BoundExpression> b)
+    {
+        return a.Count == b.Count &&
+               a.All(pair => b.TryGetValue(pair.Key, out BoundExpression value) && Equivalent(pair.Value, value));
+    }
+
+    private static bool Equivalent(BoundExpression a, BoundExpression b)
+    {
+        switch (a)
+        {
+            case null:
+                return b == null;
+            case BoundLiteralExpression literalA when b is BoundLiteralExpression literalB:
+                return Equals(literalA.value, literalB.value);
+            case BoundVariableExpression variableA when b is BoundVariableExpression variableB:
+                return variableA.variableSymbol == variableB.variableSymbol;
+            default:
+                return false;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+﻿using System.Collections.Generic;
+using System.Collections.Immutable;
+using System.Linq;
+using IllusionScript.Runtime.Binding.Nodes.Expressions;
+using IllusionScript.Runtime.Binding.Nodes.Statements;
+using IllusionScript.Runtime.CFA;
+using IllusionScript.Runtime.Memory.Symbols;
+
+namespace IllusionScript.Runtime.Lowering;
+
+/*
+ * Removes stores to locals that are not read again on any path, found by a backward liveness dataflow over the
+ * control flow graph. A store whose value has side effects is turned into an expression statement. A declaration is
+ * only removed with the last reference to its variable, the emitter allocates the variable there.
+ */
+internal static class DeadStoreEliminator
+{
+    public static BoundBlockStatement Eliminate(BoundBlockStatement body)
+    {
+        ControlFlowGraph graph = ControlFlowGraph.Create(body);
+
+        HashSet<VariableSymbol> referenced = new HashSet<VariableSymbol>();
+        foreach (BoundStatement statement in body.statements)
+        {
+            UsageCollector usageCollector = UsageCollector.Collect(UsageCollector.GetEvaluated(statement, out VariableSymbol target));
+            referenced.UnionWith(usageCollector.reads);
+            referenced.UnionWith(usageCollector.assignments);
+            if (target != null && statement is BoundExpressionStatement)
+            {
+                referenced.Add(target);
+            }
+        }
+
+        Dictionary<ControlFlowGraph.BasicBlock, HashSet<VariableSymbol>> liveIn =
+            graph.blocks.ToDictionary(block => block, _ => new HashSet<VariableSymbol>());
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            foreach (ControlFlowGraph.BasicBlock block in Enumerable.Reverse(graph.blocks))
+            {
+                HashSet<VariableSymbol> live = LiveOut(block, liveIn);
+                foreach (BoundStatement statement in Enumerable.Reverse(block.statements))
+                {
+                    Step(live, statement);
+                }
+
+                if (!live.SetEquals(liveIn[block]))
+                {
+                    liveIn[block] = live;
+                    changed = true;
+                }
+            }
+        }
+
+        Dictionary<BoundStatement, BoundStatement> replaced = new Dictionary<BoundStatement, BoundStatement>();
+        foreach (ControlFlowGraph.BasicBlock block in graph.blocks)
+        {
+            HashSet<VariableSymbol> live = LiveOut(block, liveIn);
+            foreach (BoundStatement statement in Enumerable.Reverse(block.statements))
+            {
+                BoundExpression evaluated = UsageCollector.GetEvaluated(statement, out VariableSymbol target);
+                bool dead = statement switch
+                {
+                    BoundVariableDeclarationStatement => !live.Contains(target) && !referenced.Contains(target) &&
+                                                         target is LocalVariableSymbol,
+                    BoundExpressionStatement when target != null => !live.Contains(target) && target is LocalVariableSymbol,
+                    BoundExpressionStatement => true,
+                    _ => false
+                };
+
+                if (!dead)
+                {
+                    Step(live, statement);
+                    continue;
+                }
+
+                UsageCollector usageCollector = UsageCollector.Collect(evaluated);
+                if (usageCollector.hasSideEffects)
+                {
+                    BoundExpressionStatement expressionStatement = new BoundExpressionStatement(evaluated);
+                    if (target != null)
+                    {
+                        replaced.Add(statement, expressionStatement);
+                    }
+                    live.UnionWith(usageCollector.reads);
+                }
+                else
+                {
+                    replaced.Add(statement, null);
+                }
+            }
+        }
+
+        if (replaced.Count == 0)
+        {
+            return body;
+        }
+
+        return new BoundBlockStatement(body.statements
+            .Select(statement => replaced.GetValueOrDefault(statement, statement))
+            .Where(statement => statement != null)
+            .ToImmutableArray());
+    }
+
+    private static HashSet<VariableSymbol> LiveOut(ControlFlowGraph.BasicBlock block,
+        Dictionary<ControlFlowGraph.BasicBlock, HashSet<VariableSymbol>> liveIn)
+    {
+        HashSet<VariableSymbol> live = new HashSet<VariableSymbol>();
+        foreach (ControlFlowGraph.BasicBlockBranch branch in block.outgoing)
+        {
+            live.UnionWith(liveIn[branch.to]);
+        }
+
+        return live;
+    }
+
+    // Moves the live variables from after the statement to before it. Assignments inside the expression only add to
+    // them, the value may be read before.
+    private static void Step(HashSet<VariableSymbol> live, BoundStatement statement)
+    {
+        BoundExpression evaluated = UsageCollector.GetEvaluated(statement, out VariableSymbol target);
+        if (target != null)
+        {
+            live.Remove(target);
+        }
+
+        live.UnionWith(UsageCollector.Collect(evaluated).reads);
+    }
+}
\ No newline at end of file
@@ -6,6 +6,7 @@ using IllusionScript.Runtime.Binding.Nodes;
 using IllusionScript.Runtime.Binding.Nodes.Expressions;
 using IllusionScript.Runtime.Binding.Nodes.Statements;
 using IllusionScript.Runtime.Binding.Operators;
+using IllusionScript.Runtime.CFA;
 using IllusionScript.Runtime.Memory.Symbols;
 using IllusionScript.Runtime.Parsing;
 
@@ -34,6 +35,84 @@ internal sealed class Lowerer : BoundTreeRewriter
         return Flatten(result);
     }
 
+    // Runs the optimization passes over a lowered body until none of them changes it anymore
+    public static BoundBlockStatement Optimize(BoundBlockStatement body)
+    {
+        while (true)
+        {
+            BoundBlockStatement optimized = ConstantFolder.Fold(body);
+            optimized = CopyPropagator.Propagate(optimized);
+            optimized = ConstantFolder.Fold(optimized);
+            optimized = RemoveUnreachableCode(optimized);
+            optimized = DeadStoreEliminator.Eliminate(optimized);
+            if (optimized == body)
+            {
+                return body;
+            }
+
+            body = optimized;
+        }
+    }
+
+    private static BoundBlockStatement RemoveUnreachableCode(BoundBlockStatement body)
+    {
+        // A folded condition either always jumps or never does
+        ImmutableArray<BoundStatement>.Builder builder = ImmutableArray.CreateBuilder<BoundStatement>();
+        foreach (BoundStatement statement in body.statements)
+        {
+            if (statement is BoundConditionalGotoStatement { condition: BoundLiteralExpression literal } conditionalGoto)
+            {
+                if ((bool)literal.value == conditionalGoto.jmpIfTrue)
+                {
+                    builder.Add(new BoundGotoStatement(conditionalGoto.boundLabel));
+                }
+                continue;
+            }
+
+            builder.Add(statement);
+        }
+
+        // The graph only keeps the blocks reachable from the start
+        ControlFlowGraph graph = ControlFlowGraph.Create(new BoundBlockStatement(builder.ToImmutable()));
+        List<BoundStatement> statements = graph.blocks.SelectMany(block => block.statements).ToList();
+
+        // A goto to the label right after it falls through anyway
+        for (int i = statements.Count - 2; i >= 0; i--)
+        {
+            if (statements[i] is BoundGotoStatement gotoStatement &&
+                statements[i + 1] is BoundLabelStatement labelStatement &&
+                labelStatement.BoundLabel == gotoStatement.BoundLabel)
+            {
+                statements.RemoveAt(i);
+            }
+        }
+
+        // Labels nothing jumps to anymore would split blocks for nothing
+        HashSet<BoundLabel> targets = new HashSet<BoundLabel>();
+        foreach (BoundStatement statement in statements)
+        {
+            switch (statement)
+            {
+                case BoundGotoStatement gotoStatement:
+                    targets.Add(gotoStatement.BoundLabel);
+                    break;
+                case BoundConditionalGotoStatement conditionalGotoStatement:
+                    targets.Add(conditionalGotoStatement.boundLabel);
+                    break;
+            }
+        }
+
+        statements.RemoveAll(statement =>
+            statement is BoundLabelStatement labelStatement && !targets.Contains(labelStatement.BoundLabel));
+
+        if (statements.SequenceEqual(body.statements))
+        {
+            return body;
+        }
+
+        return new BoundBlockStatement(statements.ToImmutableArray());
+    }
+
     private static BoundBlockStatement Flatten(BoundStatement statement)
     {
         ImmutableArray<BoundStatement>.Builder builder = ImmutableArray.CreateBuilder<BoundStatement>();
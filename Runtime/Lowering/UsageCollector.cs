@@ -0,0 +1,87 @@
+﻿using System.Collections.Generic;
+using IllusionScript.Runtime.Binding;
+using IllusionScript.Runtime.Binding.Nodes.Expressions;
+using IllusionScript.Runtime.Binding.Nodes.Statements;
+using IllusionScript.Runtime.Binding.Operators;
+using IllusionScript.Runtime.Memory.Symbols;
+
+namespace IllusionScript.Runtime.Lowering;
+
+// Collects the variables an expression reads and assigns and whether evaluating it does more than computing a value
+internal sealed class UsageCollector : BoundTreeRewriter
+{
+    public readonly HashSet<VariableSymbol> reads;
+    public readonly HashSet<VariableSymbol> assignments;
+    public bool hasSideEffects { get; private set; }
+
+    private UsageCollector()
+    {
+        reads = new HashSet<VariableSymbol>();
+        assignments = new HashSet<VariableSymbol>();
+    }
+
+    public static UsageCollector Collect(BoundExpression expression)
+    {
+        UsageCollector usageCollector = new UsageCollector();
+        if (expression != null)
+        {
+            usageCollector.RewriteExpression(expression);
+        }
+
+        return usageCollector;
+    }
+
+    // Expression a statement evaluates before storing it in target, if it stores at all
+    public static BoundExpression GetEvaluated(BoundStatement statement, out VariableSymbol target)
+    {
+        target = null;
+        switch (statement)
+        {
+            case BoundVariableDeclarationStatement declaration:
+                target = declaration.variable;
+                return declaration.initializer;
+            case BoundExpressionStatement { expression: BoundAssignmentExpression assignmentExpression }:
+                target = assignmentExpression.variableSymbol;
+                return assignmentExpression.expression;
+            case BoundExpressionStatement expressionStatement:
+                return expressionStatement.expression;
+            case BoundConditionalGotoStatement conditionalGotoStatement:
+                return conditionalGotoStatement.condition;
+            case BoundReturnStatement returnStatement:
+                return returnStatement.expression;
+            default:
+                return null;
+        }
+    }
+
+    protected override BoundExpression RewriteVariableExpression(BoundVariableExpression node)
+    {
+        reads.Add(node.variableSymbol);
+        return node;
+    }
+
+    protected override BoundExpression RewriteAssignmentExpression(BoundAssignmentExpression node)
+    {
+        assignments.Add(node.variableSymbol);
+        hasSideEffects = true;
+        return base.RewriteAssignmentExpression(node);
+    }
+
+    protected override BoundExpression RewriteCallExpression(BoundCallExpression node)
+    {
+        hasSideEffects = true;
+        return base.RewriteCallExpression(node);
+    }
+
+    protected override BoundExpression RewriteBinaryExpression(BoundBinaryExpression node)
+    {
+        // A division by zero stops the machine
+        if (node.binaryOperator.operatorType is BoundBinaryOperatorType.Division or BoundBinaryOperatorType.Modulo &&
+            node.right is not BoundLiteralExpression { value: not 0 })
+        {
+            hasSideEffects = true;
+        }
+
+        return base.RewriteBinaryExpression(node);
+    }
+}
\ No newline at end of file
@@ -17,8 +17,63 @@ internal static class BuiltInFunctions
     public static readonly FunctionSymbol Rand = new FunctionSymbol("rand",
         ImmutableArray.Create(new ParameterSymbol("max", TypeSymbol.i64)), TypeSymbol.i64);
 
+    // Array arithmetic such as vadd_f64(out, a, b, length) or vsum_i64(a, length), the emitter writes the vadd to vdot
+    // instruction instead of a call. Arrays are passed as objects, sums and dot products of f32 arrays are f64.
+    private static readonly Dictionary<FunctionSymbol, (string inst, byte type)> vectorInstructions = new();
+
+    public static readonly ImmutableArray<FunctionSymbol> Vector = CreateVectorFunctions();
+
     public static IEnumerable<FunctionSymbol> GetAll() =>
         typeof(BuiltInFunctions).GetFields(BindingFlags.Public | BindingFlags.Static)
             .Where(f => f.FieldType == typeof(FunctionSymbol))
-            .Select(f => (FunctionSymbol)f.GetValue(null));
+            .Select(f => (FunctionSymbol)f.GetValue(null))
+            .Concat(Vector);
+
+    public static bool TryGetInstruction(FunctionSymbol function, out string inst, out byte type)
+    {
+        if (vectorInstructions.TryGetValue(function, out (string inst, byte type) instruction))
+        {
+            (inst, type) = instruction;
+            return true;
+        }
+
+        inst = null;
+        type = 0;
+        return false;
+    }
+
+    private static ImmutableArray<FunctionSymbol> CreateVectorFunctions()
+    {
+        // The type is the operand of the instruction, as in the VECTOR_ constants of CodeFusion.VM.Opcode
+        (string name, byte type, TypeSymbol result)[] types =
+        {
+            ("i64", 0, TypeSymbol.i64),
+            ("u64", 1, TypeSymbol.u64),
+            ("f64", 2, TypeSymbol.f64),
+            ("f32", 3, TypeSymbol.f64),
+        };
+        ParameterSymbol output = new ParameterSymbol("out", TypeSymbol.@object);
+        ParameterSymbol first = new ParameterSymbol("a", TypeSymbol.@object);
+        ParameterSymbol second = new ParameterSymbol("b", TypeSymbol.@object);
+        ParameterSymbol length = new ParameterSymbol("length", TypeSymbol.i64);
+
+        ImmutableArray<FunctionSymbol>.Builder functions = ImmutableArray.CreateBuilder<FunctionSymbol>();
+        foreach ((string name, byte type, TypeSymbol result) in types)
+        {
+            foreach (string inst in new[] { "vadd", "vsub", "vmul", "vfma", "vmin", "vmax" })
+            {
+                Add(inst, name, type, ImmutableArray.Create(output, first, second, length), TypeSymbol.@void);
+            }
+            Add("vsum", name, type, ImmutableArray.Create(first, length), result);
+            Add("vdot", name, type, ImmutableArray.Create(first, second, length), result);
+        }
+        return functions.ToImmutable();
+
+        void Add(string inst, string name, byte type, ImmutableArray<ParameterSymbol> parameters, TypeSymbol result)
+        {
+            FunctionSymbol function = new FunctionSymbol(inst + "_" + name, parameters, result);
+            vectorInstructions.Add(function, (inst, type));
+            functions.Add(function);
+        }
+    }
 }
\ No newline at end of file